@@ -0,0 +1,295 @@
+
+// Vectorized scanning for alignment byte and NOP padding runs in a segment byte snapshot
+#include "AlignScan.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define SCAN_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline unsigned int lowestBit(unsigned int mask) { unsigned long index; _BitScanForward(&index, mask); return index; }
+#else
+static inline unsigned int lowestBit(unsigned int mask) { return __builtin_ctz(mask); }
+#endif
+
+
+size_t findAlignByte(const unsigned char *buffer, size_t size)
+{
+	size_t i = 0;
+
+	#if defined(SCAN_AVX2)
+	const __m256i cc = _mm256_set1_epi8((char) 0xCC);
+	const __m256i nop = _mm256_set1_epi8((char) 0x90);
+	for (; (i + 32) <= size; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) (buffer + i));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cc), _mm256_cmpeq_epi8(v, nop)));
+		if (mask)
+			return(i + lowestBit(mask));
+	}
+	#elif defined(SCAN_SSE2)
+	const __m128i cc = _mm_set1_epi8((char) 0xCC);
+	const __m128i nop = _mm_set1_epi8((char) 0x90);
+	for (; (i + 16) <= size; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (buffer + i));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cc), _mm_cmpeq_epi8(v, nop)));
+		if (mask)
+			return(i + lowestBit(mask));
+	}
+	#endif
+
+	// Scalar fallback and remainder
+	for (; i < size; i++)
+	{
+		if ((buffer[i] == 0xCC) || (buffer[i] == 0x90))
+			return i;
+	}
+	return size;
+}
+
+size_t alignRunLength(const unsigned char *buffer, size_t size, unsigned char value)
+{
+	size_t i = 0;
+
+	// Most runs are short, so check the first few bytes before going wide
+	for (; (i < size) && (i < 8); i++)
+	{
+		if (buffer[i] != value)
+			return i;
+	}
+
+	#if defined(SCAN_AVX2)
+	const __m256i match = _mm256_set1_epi8((char) value);
+	for (; (i + 32) <= size; i += 32)
+	{
+		unsigned int mask = ~(unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (buffer + i)), match));
+		if (mask)
+			return(i + lowestBit(mask));
+	}
+	#elif defined(SCAN_SSE2)
+	const __m128i match = _mm_set1_epi8((char) value);
+	for (; (i + 16) <= size; i += 16)
+	{
+		unsigned int mask = (~(unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buffer + i)), match)) & 0xFFFF);
+		if (mask)
+			return(i + lowestBit(mask));
+	}
+	#endif
+
+	for (; i < size; i++)
+	{
+		if (buffer[i] != value)
+			return i;
+	}
+	return size;
+}
+
+size_t findPaddingByte(const unsigned char *buffer, size_t size, bool is64)
+{
+	size_t i = 0;
+
+	// Same as findAlignByte() with the multi-byte NOP lead bytes added.
+	// The lea/mov forms are only padding in 32 bit code.
+	#if defined(SCAN_AVX2)
+	const __m256i cc = _mm256_set1_epi8((char) 0xCC);
+	const __m256i nop = _mm256_set1_epi8((char) 0x90);
+	const __m256i opsize = _mm256_set1_epi8((char) 0x66);
+	const __m256i escape = _mm256_set1_epi8((char) 0x0F);
+	const __m256i cs = _mm256_set1_epi8((char) 0x2E);
+	const __m256i lea = _mm256_set1_epi8((char) (is64 ? 0xCC : 0x8D));
+	const __m256i mov = _mm256_set1_epi8((char) (is64 ? 0xCC : 0x89));
+	for (; (i + 32) <= size; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) (buffer + i));
+		__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, cc), _mm256_cmpeq_epi8(v, nop));
+		m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, opsize), _mm256_cmpeq_epi8(v, escape)));
+		m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, cs), _mm256_or_si256(_mm256_cmpeq_epi8(v, lea), _mm256_cmpeq_epi8(v, mov))));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(m);
+		if (mask)
+			return(i + lowestBit(mask));
+	}
+	#elif defined(SCAN_SSE2)
+	const __m128i cc = _mm_set1_epi8((char) 0xCC);
+	const __m128i nop = _mm_set1_epi8((char) 0x90);
+	const __m128i opsize = _mm_set1_epi8((char) 0x66);
+	const __m128i escape = _mm_set1_epi8((char) 0x0F);
+	const __m128i cs = _mm_set1_epi8((char) 0x2E);
+	const __m128i lea = _mm_set1_epi8((char) (is64 ? 0xCC : 0x8D));
+	const __m128i mov = _mm_set1_epi8((char) (is64 ? 0xCC : 0x89));
+	for (; (i + 16) <= size; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (buffer + i));
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, cc), _mm_cmpeq_epi8(v, nop));
+		m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, opsize), _mm_cmpeq_epi8(v, escape)));
+		m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, cs), _mm_or_si128(_mm_cmpeq_epi8(v, lea), _mm_cmpeq_epi8(v, mov))));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(m);
+		if (mask)
+			return(i + lowestBit(mask));
+	}
+	#endif
+
+	for (; i < size; i++)
+	{
+		switch (buffer[i])
+		{
+			case 0xCC: case 0x90: case 0x66: case 0x0F: case 0x2E:
+			return i;
+
+			case 0x8D: case 0x89:
+			if (!is64)
+				return i;
+			break;
+		};
+	}
+	return size;
+}
+
+// Size of a ModRM memory operand's SIB and displacement bytes if they're all zero displacement, else -1
+static int zeroDispLength(const unsigned char *buffer, size_t size, unsigned char modrm)
+{
+	int mod = (modrm >> 6), rm = (modrm & 7);
+	size_t length = 0;
+	if (mod == 3)
+		return 0;
+	if (rm == 4)
+	{
+		if (size < 1)
+			return -1;
+		if ((mod == 0) && ((buffer[0] & 7) == 5))
+			mod = 2;
+		length++;
+	}
+	else
+	if ((mod == 0) && (rm == 5))
+		mod = 2;
+
+	size_t dispSize = ((mod == 1) ? 1 : ((mod == 2) ? 4 : 0));
+	if (size < (length + dispSize))
+		return -1;
+	for (size_t i = 0; i < dispSize; i++)
+	{
+		if (buffer[length + i] != 0)
+			return -1;
+	}
+	return (int) (length + dispSize);
+}
+
+size_t nopLength(const unsigned char *buffer, size_t size, bool is64)
+{
+	if (size == 0)
+		return 0;
+
+	switch (buffer[0])
+	{
+		case 0x90:
+		return 1;
+
+		// "lea esi,[esi+0]", "lea edi,[edi+0]", optional zero displacement and "eiz" SIB forms
+		case 0x8D:
+		{
+			if (is64 || (size < 2))
+				return 0;
+			unsigned char modrm = buffer[1];
+			int reg = ((modrm >> 3) & 7), rm = (modrm & 7);
+			if (((modrm >> 6) == 3) || ((reg != 6) && (reg != 7)))
+				return 0;
+			if (rm == 4)
+			{
+				// Base the same register, no index
+				if ((size < 3) || (buffer[2] != (0x20 | reg)))
+					return 0;
+			}
+			else
+			if (rm != reg)
+				return 0;
+			int extra = zeroDispLength(buffer + 2, size - 2, modrm);
+			return((extra >= 0) ? (2 + extra) : 0);
+		}
+
+		// "mov esi,esi"
+		case 0x89:
+		return((!is64 && (size >= 2) && (buffer[1] == 0xF6)) ? 2 : 0);
+	};
+
+	// Operand size and CS segment prefixes, then "nop r/m" or "xchg ax,ax"
+	size_t i = 0;
+	bool hasCS = false;
+	for (; (i < size) && (i < 14); i++)
+	{
+		if (buffer[i] == 0x2E)
+			hasCS = true;
+		else
+		if (buffer[i] != 0x66)
+			break;
+	}
+	if ((i < size) && (buffer[i] == 0x90))
+		return(((i > 0) && !hasCS) ? (i + 1) : 0);
+	if (((i + 3) > size) || (buffer[i] != 0x0F) || (buffer[i + 1] != 0x1F) || (((buffer[i + 2] >> 3) & 7) != 0))
+		return 0;
+	int extra = zeroDispLength(buffer + (i + 3), size - (i + 3), buffer[i + 2]);
+	if ((extra < 0) || ((i + 3 + extra) > 15))
+		return 0;
+	return(i + 3 + extra);
+}
+
+size_t nopRunLength(const unsigned char *buffer, size_t size, bool is64, bool &multiByte)
+{
+	size_t i = 0;
+	multiByte = false;
+	while (i < size)
+	{
+		size_t length = nopLength(buffer + i, size - i, is64);
+		if (length == 0)
+			break;
+		if (length > 1)
+			multiByte = true;
+		i += length;
+	}
+	return i;
+}
+
+bool findAlignRun(const unsigned char *buffer, size_t size, size_t offset, unsigned long long baseEA, unsigned int alignment, bool is64, AlignRun &run)
+{
+	const unsigned long long alignMask = (alignment - 1);
+	while (offset < size)
+	{
+		size_t start = (offset + findPaddingByte(buffer + offset, size - offset, is64));
+		if (start >= size)
+			break;
+
+		// A 0xCC run, or a run of NOP instructions
+		unsigned char value = buffer[start];
+		bool multiByte = false;
+		size_t length;
+		if (value == 0xCC)
+			length = alignRunLength(buffer + start, size - start, value);
+		else
+		{
+			length = nopRunLength(buffer + start, size - start, is64, multiByte);
+			if (length == 0)
+			{
+				// Just a lead byte
+				offset = (start + 1);
+				continue;
+			}
+		}
+
+		// Do these bytes land on the alignment?
+		if (((baseEA + start + length) & alignMask) == 0)
+		{
+			run.offset = start;
+			run.length = length;
+			run.value = value;
+			run.multiByte = multiByte;
+			return true;
+		}
+		offset = (start + length);
+	}
+	return false;
+}
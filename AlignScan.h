@@ -0,0 +1,35 @@
+
+// Vectorized scanning for alignment byte and NOP padding runs in a segment byte snapshot
+#pragma once
+#include <stddef.h>
+
+// Run of the same 0xCC ("int 3") or 0x90 ("nop") byte, or a sequence of NOP instructions
+struct AlignRun
+{
+	size_t offset;
+	size_t length;
+	unsigned char value;	// First byte
+	bool multiByte;			// Has one or more multi-byte NOPs
+};
+
+// Offset of the first 0xCC or 0x90 byte, or 'size' if none
+size_t findAlignByte(const unsigned char *buffer, size_t size);
+
+// Length of the run of 'value' bytes at the buffer start
+size_t alignRunLength(const unsigned char *buffer, size_t size, unsigned char value);
+
+// Offset of the first byte that could start padding (0xCC, 0x90 or a multi-byte NOP lead byte), or 'size' if none
+size_t findPaddingByte(const unsigned char *buffer, size_t size, bool is64);
+
+// Length of the single NOP instruction at the buffer start, or 0 if there isn't one.
+// Recognizes the padding encodings compilers and assemblers emit:
+//  90, 66 90, [66..] [2E] 0F 1F /0 (zero displacement), and in 32 bit code
+//  "lea esi,[esi+0]", "lea edi,[edi+0]" (8D 76 00, 8D 74 26 00, 8D B6 00000000, 8D BC 27 00000000, etc.) and "mov esi,esi" (89 F6).
+size_t nopLength(const unsigned char *buffer, size_t size, bool is64);
+
+// Length of the sequence of NOP instructions at the buffer start
+size_t nopRunLength(const unsigned char *buffer, size_t size, bool is64, bool &multiByte);
+
+// Find the next align byte run, or NOP instruction sequence, starting at or after 'offset' that ends
+// on an 'alignment' boundary given the buffer's base address. Returns false if there are no more.
+bool findAlignRun(const unsigned char *buffer, size_t size, size_t offset, unsigned long long baseEA, unsigned int alignment, bool is64, AlignRun &run);
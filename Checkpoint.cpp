@@ -0,0 +1,107 @@
+
+// Run checkpoint, kept in the database so an aborted or crashed run can be resumed
+// It's saved with the IDB, so it always matches the database changes made up to it.
+#include "stdafx.h"
+#include "Checkpoint.h"
+#include <netnode.hpp>
+
+static const char NODE_NAME[] = "$ ExtraPass checkpoint";
+static const uchar BLOB_TAG = 'C';
+
+// Layout version, and a check the counters struct layout hasn't changed
+#define CHECKPOINT_VERSION 2
+
+struct Header
+{
+	UINT32 version;
+	UINT32 statsSize;
+	UINT32 eaSize;
+	UINT32 orderCount;
+	UINT32 segmentCount;
+	UINT32 stageCount;
+};
+
+template <class T> static void put(bytevec_t &blob, const T &value)
+{
+	blob.append(&value, sizeof(T));
+}
+
+template <class T> static bool get(const bytevec_t &blob, size_t &offset, T &value)
+{
+	if ((offset + sizeof(T)) > blob.size())
+		return false;
+	memcpy(&value, blob.begin() + offset, sizeof(T));
+	offset += sizeof(T);
+	return true;
+}
+
+void Checkpoint::save() const
+{
+	Header header = { CHECKPOINT_VERSION, sizeof(PassStats), sizeof(ea_t), (UINT32) order.size(), (UINT32) segments.size(), (UINT32) stages.size() };
+	bytevec_t blob;
+	put(blob, header);
+	for (size_t i = 0; i < order.size(); i++)
+		put(blob, order[i]);
+	put(blob, alignment);
+	put(blob, pass4Budget);
+	put(blob, timeSlice);
+	for (size_t i = 0; i < segments.size(); i++)
+		put(blob, segments[i]);
+	put(blob, segment);
+	put(blob, position);
+	put(blob, cursor);
+	put(blob, startFuncCount);
+	put(blob, pass4Used);
+	put(blob, stats);
+	for (size_t i = 0; i < stages.size(); i++)
+		put(blob, stages[i]);
+
+	netnode node(NODE_NAME, 0, true);
+	node.setblob(blob.begin(), blob.size(), 0, BLOB_TAG);
+}
+
+bool Checkpoint::load()
+{
+	netnode node(NODE_NAME);
+	if (node == BADNODE)
+		return false;
+	bytevec_t blob;
+	if (node.getblob(&blob, 0, BLOB_TAG) <= 0)
+		return false;
+
+	size_t offset = 0;
+	Header header;
+	if (!get(blob, offset, header) || (header.version != CHECKPOINT_VERSION) || (header.statsSize != sizeof(PassStats)) || (header.eaSize != sizeof(ea_t)))
+		return false;
+
+	order.resize(header.orderCount);
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		if (!get(blob, offset, order[i]))
+			return false;
+	}
+	if (!get(blob, offset, alignment) || !get(blob, offset, pass4Budget) || !get(blob, offset, timeSlice))
+		return false;
+	segments.resize(header.segmentCount);
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		if (!get(blob, offset, segments[i]))
+			return false;
+	}
+	if (!get(blob, offset, segment) || !get(blob, offset, position) || !get(blob, offset, cursor) || !get(blob, offset, startFuncCount) || !get(blob, offset, pass4Used) || !get(blob, offset, stats))
+		return false;
+	stages.resize(header.stageCount);
+	for (size_t i = 0; i < stages.size(); i++)
+	{
+		if (!get(blob, offset, stages[i]))
+			return false;
+	}
+	return(segment < segments.size());
+}
+
+void Checkpoint::remove()
+{
+	netnode node(NODE_NAME);
+	if (node != BADNODE)
+		node.kill();
+}
@@ -0,0 +1,42 @@
+
+// Run checkpoint, kept in the database so an aborted or crashed run can be resumed
+#pragma once
+#include "Passes.h"
+#include <vector>
+
+// Seconds between checkpoint saves while the passes run
+#define CHECKPOINT_INTERVAL 60.0
+
+// Pipeline stage counters
+struct StageCounters
+{
+	unsigned int runs;
+	unsigned long long steps;
+	double time;
+};
+
+struct Checkpoint
+{
+	// Options
+	std::vector<int> order;			// Pipeline stage indexes
+	unsigned int alignment;			// Passes::alignmentOverride
+	double pass4Budget;
+	int timeSlice;
+
+	// Progress
+	std::vector<EaRange> segments;	// Code segments of the run
+	unsigned int segment;			// The one being processed
+	unsigned int position;			// Pipeline order position in it
+	ea_t cursor;					// Passes::cursor() in the stage, BADADDR to start it from the top
+
+	// Counters
+	int startFuncCount;
+	double pass4Used;				// Passes::pass4Used()
+	PassStats stats;
+	std::vector<StageCounters> stages;	// By stage index
+
+	// Load the database's checkpoint, false if none or from an incompatible version
+	bool load();
+	void save() const;
+	static void remove();
+};
@@ -0,0 +1,186 @@
+
+// Platform neutral database facade
+// The processing passes only talk to the IDB through this narrow interface so they can be driven
+// by the real IDA kernel (IdaDatabase) or by an in-memory stand-in (MemoryDatabase) on any platform.
+#pragma once
+#include <stddef.h>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+
+// Same underlying types as the SDK "pro.h" (__EA64__) so both can be visible in the same unit
+typedef unsigned long long ea_t;
+typedef unsigned long long flags64_t;
+#ifndef BADADDR
+#define BADADDR ea_t(-1)
+#endif
+
+// Flag defines from SDK "bytes.hpp"
+// Duplicated here for builds without the SDK
+#ifndef BYTES_HPP
+#define MS_VAL   0x000000FFLU	// Mask for byte value
+#define FF_IVL   0x00000100LU	// Byte has value ?
+
+#define MS_CLS   0x00000600LU	// Mask for typing
+#define FF_CODE  0x00000600LU	// Code ?
+#define FF_DATA  0x00000400LU	// Data ?
+#define FF_TAIL  0x00000200LU	// Tail ?
+#define FF_UNK   0x00000000LU	// Unknown ?
+
+#define FF_REF   0x00001000LU	// has references
+#define FF_FLOW  0x00010000LU	// Exec flow from prev instruction
+
+#define MS_0TYPE 0x00F00000LU	// Mask for 1st arg typing
+#define FF_0OFF  0x00500000LU	// Offset?
+#define MS_1TYPE 0x0F000000LU	// Mask for the type of other operands
+#define FF_1OFF  0x05000000LU	// Offset?
+
+#define DT_TYPE  0xF0000000LU	// Data types
+#define FF_BYTE  0x00000000LU
+#define FF_WORD  0x10000000LU
+#define FF_DWORD 0x20000000LU
+#define FF_QWORD 0x30000000LU
+#define FF_ALIGN 0xB0000000LU
+
+#define FF_FUNC  0x10000000LU	// Function start? (code only)
+#endif
+
+// Function flags from SDK "funcs.hpp"
+#ifndef FUNCS_HPP
+#define FUNC_NORET 0x00000001	// Function doesn't return
+#endif
+
+// Flag tests, same as the SDK inlines
+namespace DbFlags
+{
+	inline bool is_code(flags64_t f)    { return((f & MS_CLS) == FF_CODE); }
+	inline bool is_data(flags64_t f)    { return((f & MS_CLS) == FF_DATA); }
+	inline bool is_tail(flags64_t f)    { return((f & MS_CLS) == FF_TAIL); }
+	inline bool is_unknown(flags64_t f) { return((f & MS_CLS) == FF_UNK); }
+	inline bool is_head(flags64_t f)    { return((f & FF_DATA) != 0); }
+	inline bool is_align(flags64_t f)   { return(is_data(f) && ((f & DT_TYPE) == FF_ALIGN)); }
+	inline bool is_func(flags64_t f)    { return(is_code(f) && ((f & FF_FUNC) != 0)); }
+	inline bool has_xref(flags64_t f)   { return((f & FF_REF) != 0); }
+	inline bool is_off1(flags64_t f)    { return((f & MS_1TYPE) == FF_1OFF); }
+}
+
+// Function, or function chunk, info
+struct FuncInfo
+{
+	ea_t startEA;
+	ea_t endEA;
+	unsigned long long flags;
+	int tailQty;	// Count of tail chunks (for function entry chunks)
+	ea_t owner;		// Entry chunk start (for tail chunks)
+};
+
+// Decoded instruction classes, just what the passes care about
+enum INSN_CLASS
+{
+	IC_OTHER,
+	IC_LEA,				// lea
+	IC_MOVX,			// movzx, movsx
+	IC_MOV_REG_BYTE,	// mov reg, byte ptr
+	IC_MOV,				// Any other mov
+	IC_RET,				// retn, retf, iret(x), syscall, sysret
+	IC_JMP,				// Direct near jmp
+	IC_JMP_OTHER,		// jmpfi, jmpni, jmpshort
+	IC_JCC,				// Conditional jumps
+	IC_CALL,			// call, callfi, callni
+	IC_INT3,
+	IC_NOP,
+};
+
+struct InsnInfo
+{
+	ea_t ea;
+	int size;
+	INSN_CLASS iclass;
+	ea_t target;	// Operand 0 address (branch target)
+};
+
+// Cross reference
+struct XrefInfo
+{
+	ea_t from;
+	bool isCode;
+};
+
+// Flow chart basic block
+struct FlowBlock
+{
+	ea_t startEA;
+	ea_t endEA;
+	std::vector<int> succ;	// Successor block indexes, blocks outside of the function are left out
+};
+
+// Named address
+struct NameInfo
+{
+	ea_t ea;
+	std::string name;
+};
+
+typedef bool (*testflags_t)(flags64_t flags, void *ud);
+
+// Database interface
+class Database
+{
+public:
+	virtual ~Database() {}
+
+	// Bytes and flags
+	virtual flags64_t getFlags(ea_t ea) = 0;		// Flags w/o the byte value
+	virtual flags64_t getFullFlags(ea_t ea) = 0;	// Flags with the byte value
+	virtual unsigned char getByte(ea_t ea) = 0;
+	virtual size_t getBytes(ea_t ea, void *buffer, size_t size) = 0;
+	virtual size_t getItemSize(ea_t ea) = 0;
+
+	// Item navigation
+	virtual ea_t nextHead(ea_t ea, ea_t maxEA) = 0;
+	virtual ea_t prevHead(ea_t ea, ea_t minEA) = 0;
+	virtual ea_t nextAddr(ea_t ea) = 0;
+	virtual ea_t nextUnknown(ea_t ea, ea_t maxEA) = 0;
+	virtual ea_t nextThat(ea_t ea, ea_t maxEA, testflags_t testf, void *ud = NULL) = 0;
+
+	// Item creation
+	virtual bool delItems(ea_t ea, size_t size) = 0;
+	virtual bool createByte(ea_t ea, size_t size) = 0;
+	virtual bool createAlign(ea_t ea, size_t size) = 0;
+	virtual int  createInsn(ea_t ea) = 0;
+	virtual bool decodeInsn(ea_t ea, InsnInfo &insn) = 0;
+
+	// Cross references
+	virtual ea_t firstCrefFrom(ea_t ea) = 0;
+	virtual ea_t firstCrefTo(ea_t ea) = 0;
+	virtual ea_t firstDrefFrom(ea_t ea) = 0;
+	virtual ea_t firstDrefTo(ea_t ea) = 0;
+	virtual size_t getXrefsTo(ea_t ea, std::vector<XrefInfo> &xrefs) = 0;
+
+	// Functions
+	virtual size_t getFuncQty() = 0;
+	virtual bool getnFunc(size_t n, FuncInfo &fi) = 0;
+	virtual bool getFunc(ea_t ea, FuncInfo &fi) = 0;		// Owner function of address
+	virtual bool getFuncChunk(ea_t ea, FuncInfo &fi) = 0;	// Function chunk containing address
+	virtual bool nextFuncChunk(ea_t ea, FuncInfo &fi) = 0;	// First function chunk starting at or after the address
+	virtual size_t getTailReferers(ea_t tailEA, std::vector<ea_t> &referers) = 0;	// Functions a tail chunk belongs to
+	virtual bool addFunc(ea_t start, ea_t end = BADADDR) = 0;
+	virtual bool removeFuncTail(ea_t funcEA, ea_t tailEA) = 0;
+	virtual bool getFlowChart(ea_t funcEA, size_t maxBlocks, std::vector<FlowBlock> &blocks) = 0;	// False if no function, or over 'maxBlocks'
+
+	// Misc
+	virtual bool getName(ea_t ea, std::string &name) = 0;
+	virtual size_t getNames(std::vector<NameInfo> &names) = 0;	// Appends all the named addresses, including imports
+	virtual int  getSegBitness(ea_t ea) = 0;	// Segment addressing size, 16, 32 or 64
+	virtual void getLoadedRange(ea_t &minEA, ea_t &maxEA) = 0;	// [lowest, highest + 1) address of all the segments
+	virtual void autoWait() = 0;
+	virtual void vmsg(const char *format, va_list va) = 0;
+
+	void msg(const char *format, ...)
+	{
+		va_list va;
+		va_start(va, format);
+		vmsg(format, va);
+		va_end(va);
+	}
+};
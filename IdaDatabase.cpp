@@ -0,0 +1,282 @@
+
+// Database facade over the IDA SDK kernel
+#include "stdafx.h"
+#include "IdaDatabase.h"
+#include <nalt.hpp>
+
+static void toFuncInfo(const func_t *f, FuncInfo &fi)
+{
+	fi.startEA = f->start_ea;
+	fi.endEA   = f->end_ea;
+	fi.flags   = f->flags;
+	if (f->flags & FUNC_TAIL)
+	{
+		fi.tailQty = 0;
+		fi.owner = f->owner;
+	}
+	else
+	{
+		fi.tailQty = f->tailqty;
+		fi.owner = f->start_ea;
+	}
+}
+
+flags64_t IdaDatabase::getFlags(ea_t ea)		{ return get_flags(ea); }
+flags64_t IdaDatabase::getFullFlags(ea_t ea)	{ return get_full_flags(ea); }
+unsigned char IdaDatabase::getByte(ea_t ea)		{ return get_byte(ea); }
+size_t IdaDatabase::getItemSize(ea_t ea)		{ return (size_t) get_item_size(ea); }
+
+size_t IdaDatabase::getBytes(ea_t ea, void *buffer, size_t size)
+{
+	ssize_t result = get_bytes(buffer, (ssize_t) size, ea);
+	return((result > 0) ? (size_t) result : 0);
+}
+
+ea_t IdaDatabase::nextHead(ea_t ea, ea_t maxEA)		{ return next_head(ea, maxEA); }
+ea_t IdaDatabase::prevHead(ea_t ea, ea_t minEA)		{ return prev_head(ea, minEA); }
+ea_t IdaDatabase::nextAddr(ea_t ea)					{ return next_addr(ea); }
+ea_t IdaDatabase::nextUnknown(ea_t ea, ea_t maxEA)	{ return next_unknown(ea, maxEA); }
+ea_t IdaDatabase::nextThat(ea_t ea, ea_t maxEA, testflags_t testf, void *ud) { return next_that(ea, maxEA, testf, ud); }
+
+bool IdaDatabase::delItems(ea_t ea, size_t size)	{ return del_items(ea, (DELIT_SIMPLE | DELIT_NOTRUNC), (asize_t) size); }
+bool IdaDatabase::createByte(ea_t ea, size_t size)	{ return create_byte(ea, (asize_t) size); }
+bool IdaDatabase::createAlign(ea_t ea, size_t size) { return create_align(ea, (asize_t) size, 0); }
+int  IdaDatabase::createInsn(ea_t ea)				{ return create_insn(ea); }
+
+bool IdaDatabase::decodeInsn(ea_t ea, InsnInfo &insn)
+{
+	insn_t cmd;
+	if (decode_insn(&cmd, ea) <= 0)
+		return false;
+
+	insn.ea = ea;
+	insn.size = cmd.size;
+	insn.target = cmd.ops[0].addr;
+	switch (cmd.itype)
+	{
+		case NN_lea:
+		insn.iclass = IC_LEA;
+		break;
+
+		case NN_movzx: case NN_movsx:
+		insn.iclass = IC_MOVX;
+		break;
+
+		case NN_mov:
+		if ((cmd.ops[0].type == o_reg) && (cmd.ops[1].dtype == dt_byte))
+			insn.iclass = IC_MOV_REG_BYTE;
+		else
+			insn.iclass = IC_MOV;
+		break;
+
+		case NN_retn: case NN_retf: case NN_iretw: case NN_iret: case NN_iretd:
+		case NN_iretq: case NN_syscall:
+		case NN_sysret:
+		insn.iclass = IC_RET;
+		break;
+
+		case NN_jmp:
+		insn.iclass = IC_JMP;
+		break;
+
+		case NN_jmpfi: case NN_jmpni: case NN_jmpshort:
+		insn.iclass = IC_JMP_OTHER;
+		break;
+
+		case NN_ja:  case NN_jae: case NN_jb:  case NN_jbe:  case NN_jc:   case NN_je:   case NN_jg:
+		case NN_jge: case NN_jl:  case NN_jle: case NN_jna:  case NN_jnae: case NN_jnb:  case NN_jnbe:
+		case NN_jnc: case NN_jne: case NN_jng: case NN_jnge: case NN_jnl:  case NN_jnle: case NN_jno:
+		case NN_jnp: case NN_jns: case NN_jnz: case NN_jo:   case NN_jp:  case NN_jpe:   case NN_jpo:
+		case NN_js:  case NN_jz:
+		insn.iclass = IC_JCC;
+		break;
+
+		case NN_call: case NN_callfi: case NN_callni:
+		insn.iclass = IC_CALL;
+		break;
+
+		case NN_int3:
+		insn.iclass = IC_INT3;
+		break;
+
+		case NN_nop:
+		insn.iclass = IC_NOP;
+		break;
+
+		default:
+		insn.iclass = IC_OTHER;
+		break;
+	};
+	return true;
+}
+
+ea_t IdaDatabase::firstCrefFrom(ea_t ea)	{ return get_first_cref_from(ea); }
+ea_t IdaDatabase::firstCrefTo(ea_t ea)		{ return get_first_cref_to(ea); }
+ea_t IdaDatabase::firstDrefFrom(ea_t ea)	{ return get_first_dref_from(ea); }
+ea_t IdaDatabase::firstDrefTo(ea_t ea)		{ return get_first_dref_to(ea); }
+
+size_t IdaDatabase::getXrefsTo(ea_t ea, std::vector<XrefInfo> &xrefs)
+{
+	xrefs.clear();
+	xrefblk_t xb;
+	if (xb.first_to(ea, XREF_ALL))
+	{
+		do
+		{
+			XrefInfo xi = { xb.from, (xb.iscode != 0) };
+			xrefs.push_back(xi);
+		} while (xb.next_to());
+	}
+	return xrefs.size();
+}
+
+size_t IdaDatabase::getFuncQty() { return get_func_qty(); }
+
+bool IdaDatabase::getnFunc(size_t n, FuncInfo &fi)
+{
+	if (func_t *f = getn_func(n))
+	{
+		toFuncInfo(f, fi);
+		return true;
+	}
+	return false;
+}
+
+bool IdaDatabase::getFunc(ea_t ea, FuncInfo &fi)
+{
+	if (func_t *f = get_func(ea))
+	{
+		toFuncInfo(f, fi);
+		return true;
+	}
+	return false;
+}
+
+bool IdaDatabase::getFuncChunk(ea_t ea, FuncInfo &fi)
+{
+	if (func_t *f = get_fchunk(ea))
+	{
+		toFuncInfo(f, fi);
+		return true;
+	}
+	return false;
+}
+
+bool IdaDatabase::addFunc(ea_t start, ea_t end) { return add_func(start, end); }
+
+bool IdaDatabase::nextFuncChunk(ea_t ea, FuncInfo &fi)
+{
+	func_t *f = get_fchunk(ea);
+	if (!f || (f->start_ea != ea))
+		f = get_next_fchunk(ea);
+	if (f)
+	{
+		toFuncInfo(f, fi);
+		return true;
+	}
+	return false;
+}
+
+size_t IdaDatabase::getTailReferers(ea_t tailEA, std::vector<ea_t> &referers)
+{
+	referers.clear();
+	func_t *f = get_fchunk(tailEA);
+	if (f && (f->flags & FUNC_TAIL) && (f->start_ea == tailEA))
+	{
+		if (f->refqty && f->referers)
+			referers.assign(f->referers, (f->referers + f->refqty));
+		else
+			referers.push_back(f->owner);
+	}
+	return referers.size();
+}
+
+bool IdaDatabase::removeFuncTail(ea_t funcEA, ea_t tailEA)
+{
+	if (func_t *f = get_func(funcEA))
+		return remove_func_tail(f, tailEA);
+	return false;
+}
+
+bool IdaDatabase::getFlowChart(ea_t funcEA, size_t maxBlocks, std::vector<FlowBlock> &blocks)
+{
+	blocks.clear();
+	func_t *f = get_func(funcEA);
+	if (!f)
+		return false;
+
+	// Don't even build it if the function is too big to have fewer blocks, 64 bytes a block is plenty
+	if ((size_t) calc_func_size(f) > (maxBlocks * 64))
+		return false;
+
+	qflow_chart_t fc("", f, BADADDR, BADADDR, FC_NOEXT);
+	if ((size_t) fc.size() > maxBlocks)
+		return false;
+
+	blocks.resize(fc.size());
+	for (int i = 0; i < fc.size(); i++)
+	{
+		blocks[i].startEA = fc.blocks[i].start_ea;
+		blocks[i].endEA = fc.blocks[i].end_ea;
+		for (int j = 0; j < fc.nsucc(i); j++)
+			blocks[i].succ.push_back(fc.succ(i, j));
+	}
+	return true;
+}
+
+bool IdaDatabase::getName(ea_t ea, std::string &name)
+{
+	qstring str;
+	if (get_name(&str, ea) > 0)
+	{
+		name = str.c_str();
+		return true;
+	}
+	return false;
+}
+
+static int idaapi importNameCallback(ea_t ea, const char *name, uval_t ord, void *param)
+{
+	if (name && *name)
+	{
+		NameInfo ni;
+		ni.ea = ea;
+		ni.name = name;
+		((std::vector<NameInfo> *) param)->push_back(ni);
+	}
+	return 1;
+}
+
+size_t IdaDatabase::getNames(std::vector<NameInfo> &names)
+{
+	// Name list, then the imports since they're not all in it
+	size_t count = get_nlist_size();
+	names.reserve(names.size() + count);
+	for (size_t i = 0; i < count; i++)
+	{
+		NameInfo ni;
+		ni.ea = get_nlist_ea(i);
+		ni.name = get_nlist_name(i);
+		names.push_back(ni);
+	}
+
+	uint moduleCount = get_import_module_qty();
+	for (uint i = 0; i < moduleCount; i++)
+		enum_import_names(i, importNameCallback, &names);
+	return names.size();
+}
+
+int IdaDatabase::getSegBitness(ea_t ea)
+{
+	segment_t *seg = getseg(ea);
+	return(seg ? seg->abits() : (inf_is_64bit() ? 64 : 32));
+}
+
+void IdaDatabase::getLoadedRange(ea_t &minEA, ea_t &maxEA)
+{
+	minEA = inf_get_min_ea();
+	maxEA = inf_get_max_ea();
+}
+
+void IdaDatabase::autoWait() { auto_wait(); }
+void IdaDatabase::vmsg(const char *format, va_list va) { ::vmsg(format, va); }
@@ -0,0 +1,49 @@
+
+// Database facade over the IDA SDK kernel
+#pragma once
+#include "Database.h"
+
+class IdaDatabase : public Database
+{
+public:
+	flags64_t getFlags(ea_t ea);
+	flags64_t getFullFlags(ea_t ea);
+	unsigned char getByte(ea_t ea);
+	size_t getBytes(ea_t ea, void *buffer, size_t size);
+	size_t getItemSize(ea_t ea);
+
+	ea_t nextHead(ea_t ea, ea_t maxEA);
+	ea_t prevHead(ea_t ea, ea_t minEA);
+	ea_t nextAddr(ea_t ea);
+	ea_t nextUnknown(ea_t ea, ea_t maxEA);
+	ea_t nextThat(ea_t ea, ea_t maxEA, testflags_t testf, void *ud = NULL);
+
+	bool delItems(ea_t ea, size_t size);
+	bool createByte(ea_t ea, size_t size);
+	bool createAlign(ea_t ea, size_t size);
+	int  createInsn(ea_t ea);
+	bool decodeInsn(ea_t ea, InsnInfo &insn);
+
+	ea_t firstCrefFrom(ea_t ea);
+	ea_t firstCrefTo(ea_t ea);
+	ea_t firstDrefFrom(ea_t ea);
+	ea_t firstDrefTo(ea_t ea);
+	size_t getXrefsTo(ea_t ea, std::vector<XrefInfo> &xrefs);
+
+	size_t getFuncQty();
+	bool getnFunc(size_t n, FuncInfo &fi);
+	bool getFunc(ea_t ea, FuncInfo &fi);
+	bool getFuncChunk(ea_t ea, FuncInfo &fi);
+	bool nextFuncChunk(ea_t ea, FuncInfo &fi);
+	size_t getTailReferers(ea_t tailEA, std::vector<ea_t> &referers);
+	bool addFunc(ea_t start, ea_t end = BADADDR);
+	bool removeFuncTail(ea_t funcEA, ea_t tailEA);
+	bool getFlowChart(ea_t funcEA, size_t maxBlocks, std::vector<FlowBlock> &blocks);
+
+	bool getName(ea_t ea, std::string &name);
+	size_t getNames(std::vector<NameInfo> &names);
+	int  getSegBitness(ea_t ea);
+	void getLoadedRange(ea_t &minEA, ea_t &maxEA);
+	void autoWait();
+	void vmsg(const char *format, va_list va);
+};
@@ -4,36 +4,12 @@
 #include <WaitBoxEx.h>
 #include <SegSelect.h>
 #include <IdaOgg.h>
-#include <unordered_set>
-#include <vector>
 
 #include "complete_ogg.h"
-
-//#define VBDEV
-//#define LOG_FILE
-
-// TODO: Could be a UI configuration choice
-// Now of days most compilers are going to be generating functions at 16 byte boundaries.
-// But not always the case for older executables or non-standard configurations.
-#define MINIMAL_ALIGNMENT 16  // 4, 8
-
-// Define to dump out problem functions
-//#define SHOW_PROBLEMS
-
-// Count of STATE_PASS_1 unknown byte gather passes
-#define UNKNOWN_PASSES 8
-
-
-// Flag defines from SDK "bytes.hpp"
-// Duplicated here for cases not exposed by the SDK
-#define MS_VAL  0x000000FFLU	// Mask for byte value
-#define FF_IVL  0x00000100LU	// Byte has value ?
-#define FF_REF  0x00001000LU	// has references
-#define FF_0OFF 0x00500000LU	// Offset?
-
-#define DT_TYPE  0xF0000000LU	// Data types
-#define FF_QWORD 0x30000000LU
-#define FF_ALIGN 0xB0000000LU
+#include "IdaDatabase.h"
+#include "Passes.h"
+#include "Pipeline.h"
+#include "Checkpoint.h"
 
 
 // Process states
@@ -42,17 +18,18 @@ enum STATES
     STATE_INIT,		// Initialize
 	STATE_START,	// Start processing
 
-    STATE_PASS_1,	// Find unknown data in code space
-    STATE_PASS_2,	// Fix missing "align" blocks
-	STATE_PASS_3,	// Fix lost code instructions
-	STATE_PASS_4,	// Fix missing functions
-	STATE_PASS_5,	// Fix incorrect tail call blocks
+	STATE_PASSES,	// Run the pass pipeline over the segment
 
     STATE_FINISH,	// Done
 
     STATE_EXIT,
 };
 
+// Time sliced runs: milliseconds the UI gets between slices, and seconds between progress lines
+#define SLICE_INTERVAL 20
+#define PROGRESS_INTERVAL 5.0
+#define SLICE_PASS1_BATCH 32	// Pass 1 batch size in time slices, each batch delete is two analysis waits in one step
+
 static const char SITE_URL[] = { "https://github.com/kweatherman/IDA_ExtraPass_PlugIn" };
 
 // UI options bit flags
@@ -62,38 +39,34 @@ const static WORD OPT_ALIGNBLOCKS = (1 << 1);
 const static WORD OPT_MISSINGCODE = (1 << 2);
 const static WORD OPT_MISSINGFUNC = (1 << 3);
 const static WORD OPT_FIXTAILBLKS = (1 << 4);
+const static WORD OPT_ALL = (OPT_DATATOBYTES | OPT_ALIGNBLOCKS | OPT_MISSINGCODE | OPT_MISSINGFUNC | OPT_FIXTAILBLKS);
+
+// Batch run argument flag, with it the argument's option bits select the passes.
+// Without it any non-zero argument is just a batch run, so "load_and_run_plugin("ExtraPass", 1)" runs the default passes.
+const static size_t ARG_PASS_BITS = (1 << 8);
 
 // === Function Prototypes ===
 static void showEndStats();
 static void nextState();
-static void processFuncGap(ea_t start, ea_t end);
-static void processFunc(func_t *f);
-static bool idaapi isAlignByte(flags64_t flags, void *ud = NULL);
-static bool idaapi isData(flags64_t flags, void *ud = NULL);
+static void registerStages();
+static void saveCheckpoint();
+static void setStageOrder();
+static void writeSummary();
 
 // === Data ===
-static TIMESTAMP s_startTime = 0, s_stepTime = 0;
-static std::vector<func_t*> s_funcList;
+static TIMESTAMP s_startTime = 0;
+static IdaDatabase s_db;
+static Passes s_passes(s_db);
+static Pipeline s_pipeline(s_passes);
 static SegSelect::segments codeSegs;
 static int segIndex = 0;
 static segment_t *s_thisSeg  = NULL;
-static ea_t s_segStart       = NULL;
-static ea_t s_segEnd         = NULL;
-static ea_t s_currentAddress = NULL;
-static ea_t s_lastAddress    = NULL;
 static BOOL s_isBreak        = FALSE;
 #ifdef LOG_FILE
 static FILE *s_logFile       = NULL;
 #endif
 static STATES s_state = STATE_INIT;
 static int  s_startFuncCount = 0;
-static int  s_pass1Loops     = 0;
-static UINT s_funcIndex      = 0;
-//
-static UINT s_unknownDataCount = 0;
-static UINT s_alignFixes       = 0;
-static UINT s_codeFixes        = 0;
-static UINT s_tailBlckRefFixes = 0;            
 //
 static BOOL s_doDataToBytes	= FALSE; // Pass 1
 static BOOL s_doAlignBlocks	= TRUE;	 // Pass 2
@@ -101,6 +74,26 @@ static BOOL s_doMissingCode	= TRUE;	 // Pass 3
 static BOOL s_doMissingFunc	= TRUE;	 // Pass 4
 static BOOL s_doFixTailBlks	= TRUE;	 // Pass 5
 static WORD s_audioAlertWhenDone = 1;
+static sval_t s_alignment = 0;	// Function alignment override, 0 for auto
+static sval_t s_pass4Budget = 0;	// Pass 4 time limit in seconds, 0 for none
+static sval_t s_timeSlice = 0;		// Time slice length in milliseconds, 0 to run without yielding to the UI
+//
+static qtimer_t s_timer = NULL;		// Time slice timer, while a sliced run is in progress
+static TIMESTAMP s_runStart = 0, s_sliceStart = 0, s_sliceLast = 0, s_progressTime = 0;
+static TIMESTAMP s_sliceWork = 0, s_sliceIdle = 0;
+static UINT32 s_sliceCount = 0;
+static TIMESTAMP s_longestStep = 0;	// Longest single step in a slice, and the stage it was in
+static qstring s_longestStage;
+//
+static Checkpoint s_checkpoint;
+static BOOL s_resume = FALSE;			// Resuming the checkpoint's run, till its stage is started
+static BOOL s_resumed = FALSE;
+static TIMESTAMP s_checkpointTime = 0;
+//
+static BOOL s_batch = FALSE;			// Headless, from a script
+static size_t s_runArg = 0;
+static qstring s_summaryPath;			// Batch summary file
+static const char *s_batchStatus = NULL;
 
 // Options dialog
 static const char optionDialog[] =
@@ -144,6 +137,18 @@ static const char optionDialog[] =
 	// checkbox -> s_wAudioAlertWhenDone
 	"<#Play sound on completion.#Play sound on completion.                                     :C>>\n"
 
+	// number -> s_alignment
+	"<#Function alignment used to find align blocks and function starts, a power of two.\n"
+	"Zero to detect it per segment from the existing function start addresses.#Function alignment (0 = auto):D:4:4::>\n"
+
+	// number -> s_pass4Budget
+	"<#Stop looking for missing functions after this many seconds, the largest and densest gaps are processed first.\n"
+	"Zero for no limit, gaps are processed in address order.#Missing functions time limit, seconds (0 = none):D:6:6::>\n"
+
+	// number -> s_timeSlice
+	"<#Run in slices of this many milliseconds from a timer so the database can be browsed meanwhile, with progress in the output window.\n"
+	"Run the plugin again to stop. Zero to run all at once with the wait box, the fastest.#Time slice, milliseconds (0 = none):D:6:6::>\n"
+
 
 	"<#Choose the code segment(s) to process.\nElse will use the first CODE segment by default.\n#Choose Code Segments:B:1:8::>\n"
     "                      "
@@ -159,9 +164,15 @@ static BOOL checkBreak()
             if (WaitBox::updateAndCancelCheck())
             {
                 msg("\n*** Aborted ***\n\n");
+				if (s_state == STATE_PASSES)
+				{
+					saveCheckpoint();
+					msg("Progress saved, run ExtraPass again to resume.\n");
+				}
 
                 // Show stats then directly to exit
                 showEndStats();
+				s_passes.clearFunctionList();
                 s_state = STATE_EXIT;
                 s_isBreak = TRUE;
                 return TRUE;
@@ -171,15 +182,6 @@ static BOOL checkBreak()
     return s_isBreak;
 }
 
-// Make and address range "unknown" so it can be set with something else
-static void makeUnknown(ea_t start, ea_t end)
-{
-	auto_wait();
-	del_items(start, (DELIT_SIMPLE | DELIT_NOTRUNC), (end - start));
-    auto_wait();
-}
-
-
 // Initialize
 static plugmod_t* idaapi init()
 {
@@ -189,6 +191,7 @@ static plugmod_t* idaapi init()
 		return PLUGIN_SKIP;
 
     s_state = STATE_INIT;
+	registerStages();
 	return PLUGIN_OK;
 }
 
@@ -197,6 +200,12 @@ void idaapi term()
 {
     try
     {
+		if (s_timer)
+		{
+			unregister_timer(s_timer);
+			s_timer = NULL;
+		}
+
         #ifdef LOG_FILE
         if(s_logFile)
         {
@@ -205,7 +214,7 @@ void idaapi term()
         }
         #endif
 
-		s_funcList.clear();
+		s_passes.clearFunctionList();
         OggPlay::endPlay();		      
     }
     CATCH()
@@ -219,887 +228,708 @@ static void idaapi chooseBtnHandler(int button_code, form_actions_t &fa)
 
 static void idaapi doHyperlink(int button_code, form_actions_t &fa) { open_url(SITE_URL); }
 
+// Pipeline stage hooks
+static void stageStart(Pipeline &pipeline, PipelineStage &stage)
+{
+	msg("===== %s =====\n", stage.title.c_str());
+}
 
-// Plug-in process
-bool idaapi run(size_t arg)
+static void stageEnd(Pipeline &pipeline, PipelineStage &stage)
 {
-    try
+	msg("Took %s.\n\n", TimeString(stage.lastTime));
+}
+
+static void pass2End(Pipeline &pipeline, PipelineStage &stage)
+{
+	if (s_passes.xrefMapBytes())
+	{
+		char buffer[32];
+		msg("Xref bitmap: %s bytes, built in %s.\n", NumberCommaString((UINT64) s_passes.xrefMapBytes(), buffer), TimeString(s_passes.xrefMapTime()));
+	}
+	stageEnd(pipeline, stage);
+}
+
+static void pass4End(Pipeline &pipeline, PipelineStage &stage)
+{
+	if (s_passes.gapPlanThreads())
+		msg("Gap plan: %u threads, took %s.\n", s_passes.gapPlanThreads(), TimeString(s_passes.gapPlanTime()));
+	stageEnd(pipeline, stage);
+}
+
+// Register the passes as pipeline stages, in the default run order.
+// Stage variants get registered here under their own name, to be run with "-OExtraPassStages:".
+static void registerStages()
+{
+	if (s_pipeline.stageCount())
+		return;
+	s_pipeline.add("pass1", "Fixing bad code bytes", &Passes::pass1Step, false, stageStart, stageEnd);
+	s_pipeline.add("pass2", "Fixing align blocks", &Passes::pass2Step, false, stageStart, pass2End);
+	s_pipeline.add("pass3", "Fixing missing code", &Passes::pass3Step, false, stageStart, stageEnd);
+	s_pipeline.add("pass4", "Fixing missing functions", &Passes::pass4Step, true, stageStart, pass4End);
+	s_pipeline.add("pass5", "Fixing bad tail blocks", &Passes::pass5Step, true, stageStart, stageEnd);
+}
+
+
+// Options dialog, returns FALSE if canceled
+static BOOL askOptions(const qstring &version)
+{
+    // Do UI for process pass selection
+	s_doDataToBytes = FALSE;
+	s_doAlignBlocks = s_doMissingCode = s_doMissingFunc = s_doFixTailBlks = TRUE;
+    s_audioAlertWhenDone = TRUE;
+	s_alignment = 0;
+	s_pass4Budget = 0;
+	s_timeSlice = 0;
+
+    WORD optionFlags = 0;
+    if (s_doDataToBytes) optionFlags |= OPT_DATATOBYTES;
+    if (s_doAlignBlocks) optionFlags |= OPT_ALIGNBLOCKS;
+    if (s_doMissingCode) optionFlags |= OPT_MISSINGCODE;
+    if (s_doMissingFunc) optionFlags |= OPT_MISSINGFUNC;
+	if (s_doFixTailBlks) optionFlags |= OPT_FIXTAILBLKS;
+
+    // To add forum URL to help box
+    int result = ask_form(optionDialog, version.c_str(), doHyperlink, &optionFlags, &s_audioAlertWhenDone, &s_alignment, &s_pass4Budget, &s_timeSlice, chooseBtnHandler);
+    if (!result || (optionFlags == 0))
     {
-        while (TRUE)
-        {
-            switch (s_state)
-            {
-                // Initialize
-                case STATE_INIT:
-                {
-					qstring version;
-					msg("\n>> ExtraPass: v: %s, built: %s\n", GetVersionString(MY_VERSION, version).c_str(), __DATE__);
-                    
-					// IDA must be IDLE
-					if (!auto_is_ok())
-					{
-						msg("** Wait for IDA to finish processing before starting plugin! **\n*** Aborted ***\n\n");
-						goto exit;
-					}
+        // User canceled, or no options selected, bail out
+        msg(" - Canceled -\n\n");
+		return FALSE;
+    }
 
-                    // Do UI for process pass selection
-					s_doDataToBytes = FALSE;
-					s_doAlignBlocks = s_doMissingCode = s_doMissingFunc = s_doFixTailBlks = TRUE;
-                    s_audioAlertWhenDone = TRUE;
-
-                    WORD optionFlags = 0;
-                    if (s_doDataToBytes) optionFlags |= OPT_DATATOBYTES;
-                    if (s_doAlignBlocks) optionFlags |= OPT_ALIGNBLOCKS;
-                    if (s_doMissingCode) optionFlags |= OPT_MISSINGCODE;
-                    if (s_doMissingFunc) optionFlags |= OPT_MISSINGFUNC;
-					if (s_doFixTailBlks) optionFlags |= OPT_FIXTAILBLKS;
-					codeSegs.clear();
-					segIndex = 0;
-					s_isBreak = FALSE;
+    s_doDataToBytes = ((optionFlags & OPT_DATATOBYTES) != 0);
+    s_doAlignBlocks = ((optionFlags & OPT_ALIGNBLOCKS) != 0);
+    s_doMissingCode = ((optionFlags & OPT_MISSINGCODE) != 0);
+    s_doMissingFunc = ((optionFlags & OPT_MISSINGFUNC) != 0);
+	s_doFixTailBlks = ((optionFlags & OPT_FIXTAILBLKS) != 0);                                
 
-                    // To add forum URL to help box
-                    int result = ask_form(optionDialog, version.c_str(), doHyperlink, &optionFlags, &s_audioAlertWhenDone, chooseBtnHandler);
-                    if (!result || (optionFlags == 0))
-                    {
-                        // User canceled, or no options selected, bail out
-                        msg(" - Canceled -\n\n");
-						goto exit;
-                    }
+	if ((s_alignment < 0) || (s_alignment > 4096) || (s_alignment & (s_alignment - 1)))
+	{
+		msg("** Function alignment %d is not a power of two, using auto detection. **\n", (int) s_alignment);
+		s_alignment = 0;
+	}
+	s_passes.alignmentOverride = (unsigned int) s_alignment;
+	s_passes.pass4Budget = ((s_pass4Budget > 0) ? (double) s_pass4Budget : 0.0);
+	if (s_timeSlice < 0)
+		s_timeSlice = 0;
 
-                    s_doDataToBytes = ((optionFlags & OPT_DATATOBYTES) != 0);
-                    s_doAlignBlocks = ((optionFlags & OPT_ALIGNBLOCKS) != 0);
-                    s_doMissingCode = ((optionFlags & OPT_MISSINGCODE) != 0);
-                    s_doMissingFunc = ((optionFlags & OPT_MISSINGFUNC) != 0);
-					s_doFixTailBlks = ((optionFlags & OPT_FIXTAILBLKS) != 0);                                
+	setStageOrder();
+	return TRUE;
+}
 
-                    // Ask for the log file name once
-                    #ifdef LOG_FILE
-                    if(!s_logFile)
-                    {
-                        if(char *szFileName = askfile_c(1, "*.txt", "Select a log file name:"))
-                        {
-                            // Open it for appending
-                            s_logFile = qfopen(szFileName, "ab");
-                        }
-                    }
-                    if(!s_logFile)
-                    {
-                        msg("** Log file open failed! Aborted. **\n");
-                        return false;
-                    }
-                    #endif
+// Stage run order, from the selected passes or the IDA command line, "-OExtraPassStages:pass4,pass5,pass4"
+static void setStageOrder()
+{
+	std::vector<int> order;
+	const BOOL passFlags[] = { s_doDataToBytes, s_doAlignBlocks, s_doMissingCode, s_doMissingFunc, s_doFixTailBlks };
+	for (int i = 0; i < (int) _countof(passFlags); i++)
+	{
+		if (passFlags[i])
+			order.push_back(i);
+	}
+	s_pipeline.setOrder(order);
+	if (const char *stages = get_plugin_options("ExtraPassStages"))
+	{
+		if (!s_pipeline.setOrder(stages))
+			msg("** Unknown stage in \"%s\", using the selected passes. **\n", stages);
+	}
+}
 
-                    s_thisSeg = NULL;
-                    s_unknownDataCount = s_alignFixes = s_codeFixes = s_tailBlckRefFixes = 0;
-                    s_pass1Loops = 0; s_funcIndex = 0;
-                    s_startFuncCount = (int) get_func_qty();
-					if (!s_startFuncCount)
-					{
-						msg("** No functions in this DB?! **\n*** Aborted ***\n\n");
-						goto exit;
-					}
+// Extra Pass 4 prologue signatures from a file, "-OExtraPassPrologues:<file>". Returns FALSE if it can't be read or parsed
+static BOOL loadPrologues()
+{
+	std::string text, error;
+	if (const char *path = get_plugin_options("ExtraPassPrologues"))
+	{
+		FILE *fp = qfopen(path, "rb");
+		if (!fp)
+		{
+			msg("** Can't open the prologue signature file \"%s\". **\n", path);
+			return FALSE;
+		}
+		char buffer[4096];
+		ssize_t size;
+		while ((size = qfread(fp, buffer, sizeof(buffer))) > 0)
+			text.append(buffer, (size_t) size);
+		qfclose(fp);
+	}
 
-                    char buffer[32];
-                    msg("Starting function count: %s\n", NumberCommaString(s_startFuncCount, buffer));
+	if (!s_passes.setExtraPrologues(text.c_str(), error))
+	{
+		msg("** Prologue signature file %s. **\n", error.c_str());
+		return FALSE;
+	}
+	return TRUE;
+}
 
-                    /*
-                    msg("\n=========== Segments ===========\n");
-                    int iSegCount = get_segm_qty();
-                    for(int i = 0; i < iSegCount; i++)
-                    {
-                        if(segment_t *pSegInfo = getnseg(i))
-                        {
-                        char szName[128] = {0};
-                        get_segm_name(pSegInfo, szName, (sizeof(szName) - 1));
-                        char szClass[16] = {0};
-                        get_segm_class(pSegInfo, szClass, (sizeof(szClass) - 1));
-                        msg("[%d] \"%s\", \"%s\".\n", i, szName, szClass);
-                        }
-                    }
-                    */
+// Batch mode options, from the plugin argument and the IDA command line. Returns FALSE on a bad one
+static BOOL batchOptions()
+{
+	s_audioAlertWhenDone = FALSE;
+	s_timeSlice = 0;
+	s_alignment = 0;
+	s_pass4Budget = 0;
+
+	// Passes, "-OExtraPassPasses:2345" or the argument's option bits with ARG_PASS_BITS
+	WORD optionFlags = ((s_runArg & ARG_PASS_BITS) ? (WORD) (s_runArg & OPT_ALL) : 0);
+	if (const char *passes = get_plugin_options("ExtraPassPasses"))
+	{
+		optionFlags = 0;
+		for (const char *p = passes; *p; p++)
+		{
+			if ((*p < '1') || (*p > '5'))
+			{
+				msg("** Bad pass list \"%s\", use pass numbers 1 to 5. **\n", passes);
+				return FALSE;
+			}
+			optionFlags |= (1 << (*p - '1'));
+		}
+	}
+	if (!optionFlags)
+		optionFlags = (OPT_ALIGNBLOCKS | OPT_MISSINGCODE | OPT_MISSINGFUNC | OPT_FIXTAILBLKS);
+	s_doDataToBytes = ((optionFlags & OPT_DATATOBYTES) != 0);
+	s_doAlignBlocks = ((optionFlags & OPT_ALIGNBLOCKS) != 0);
+	s_doMissingCode = ((optionFlags & OPT_MISSINGCODE) != 0);
+	s_doMissingFunc = ((optionFlags & OPT_MISSINGFUNC) != 0);
+	s_doFixTailBlks = ((optionFlags & OPT_FIXTAILBLKS) != 0);
+
+	// "-OExtraPassAlign:16", "-OExtraPassBudget:600"
+	if (const char *alignment = get_plugin_options("ExtraPassAlign"))
+		s_alignment = atoi(alignment);
+	if ((s_alignment < 0) || (s_alignment > 4096) || (s_alignment & (s_alignment - 1)))
+	{
+		msg("** Function alignment %d is not a power of two. **\n", (int) s_alignment);
+		return FALSE;
+	}
+	if (const char *budget = get_plugin_options("ExtraPassBudget"))
+		s_pass4Budget = atoi(budget);
+	s_passes.alignmentOverride = (unsigned int) s_alignment;
+	s_passes.pass4Budget = ((s_pass4Budget > 0) ? (double) s_pass4Budget : 0.0);
 
-                    // First chosen seg
-                    if (!codeSegs.empty())                        
-                        s_thisSeg = &codeSegs[segIndex++];                        
-                    else
-                    // Use the first CODE seg
-                    {
-                        int segCount = get_segm_qty();
-						int i = 0;
-                        for (; i < segCount; i++)
-                        {
-                            if (s_thisSeg = getnseg(i))
-                            {
-                                qstring sclass;
-                                if (get_segm_class(&sclass, s_thisSeg) <= 0)
-                                    break;
-                                else
-                                if (sclass == "CODE")
-                                    break;
-                            }
-                        }
-
-                        if (i >= segCount)
-                            s_thisSeg = NULL;
-                    }
+	// Code segments by name, "-OExtraPassSegments:.text;.text2". Else the first CODE segment
+	if (const char *segments = get_plugin_options("ExtraPassSegments"))
+	{
+		qstring name;
+		for (const char *p = segments; ; p++)
+		{
+			if (!*p || (*p == ';') || (*p == ','))
+			{
+				if (!name.empty())
+				{
+					segment_t *seg = get_segm_by_name(name.c_str());
+					if (!seg)
+					{
+						msg("** Segment \"%s\" not found. **\n", name.c_str());
+						return FALSE;
+					}
+					codeSegs.push_back(*seg);
+				}
+				name.clear();
+				if (!*p)
+					break;
+			}
+			else
+				name += *p;
+		}
+	}
 
-                    if (s_thisSeg)
-                    {
-                        WaitBox::show("ExtraPass", "Working..");
-                        WaitBox::updateAndCancelCheck(-1);
-                        s_segStart = s_thisSeg->start_ea;
-                        s_segEnd   = s_thisSeg->end_ea;
-                        nextState();
-                        break;
-                    }
-                    else
-                        msg("** No code segment found to process! **\n*** Aborted ***\n\n");                  
-                   
-                    // Canceled error, bail out
-					exit:;
-                    s_state = STATE_EXIT;
-                }
-                break;
+	setStageOrder();
+	return TRUE;
+}
 
-                // Start up process
-                case STATE_START:
-                {
-                    s_currentAddress = 0;
-
-					qstring name;
-                    if (get_segm_name(&name, s_thisSeg) <= 0)
-						name = "????";
-                    qstring sclass;
-                    if(get_segm_class(&sclass, s_thisSeg) <= 0)
-						sclass = "????";
-                    msg("\nSegment: \"%s\", type: %s, address: %llX-%llX, size: 0x%X\n\n", name.c_str(), sclass.c_str(), s_thisSeg->start_ea, s_thisSeg->end_ea, s_thisSeg->size());
-
-                    // Move to first process state
-                    s_startTime = GetTimeStamp();
-                    nextState();
-                }
-                break;
+// Options and progress from the checkpoint, returns FALSE if it doesn't fit the database anymore
+static BOOL resumeOptions()
+{
+	const Checkpoint &cp = s_checkpoint;
+	for (size_t i = 0; i < cp.order.size(); i++)
+	{
+		if ((cp.order[i] < 0) || (cp.order[i] >= (int) s_pipeline.stageCount()))
+			return FALSE;
+	}
+	if (cp.position > cp.order.size())
+		return FALSE;
+	for (size_t i = 0; i < cp.segments.size(); i++)
+	{
+		segment_t *seg = getseg(cp.segments[i].start);
+		if (!seg || (seg->start_ea != cp.segments[i].start) || (seg->end_ea != cp.segments[i].end))
+			return FALSE;
+		codeSegs.push_back(*seg);
+	}
 
+	s_pipeline.setOrder(cp.order);
+	s_alignment = (sval_t) cp.alignment;
+	s_passes.alignmentOverride = cp.alignment;
+	s_passes.pass4Budget = cp.pass4Budget;
+	s_pass4Budget = (sval_t) cp.pass4Budget;
+	s_timeSlice = (sval_t) cp.timeSlice;
+	s_audioAlertWhenDone = TRUE;
+	segIndex = (int) cp.segment;
+	s_resume = s_resumed = TRUE;
+
+	char buffer[32];
+	msg("Resuming, segment %u of %u, stage %u of %u.\n", (cp.segment + 1), (UINT32) cp.segments.size(), (cp.position + 1), (UINT32) cp.order.size());
+	msg("Functions at the original start: %s\n", NumberCommaString(cp.startFuncCount, buffer));
+	return TRUE;
+}
 
-                // Find unknown data runs in code section
-                //#define PASS1_DEBUG
-                case STATE_PASS_1:
-                {
-                    if (s_currentAddress < s_segEnd)
-                    {
-                        // Value at this location data?
-                        auto_wait();
-						flags64_t flags = get_flags(s_currentAddress);
-                        if (isData(flags))
-                        {
-                            #ifdef PASS1_DEBUG
-							msg(" \n");
-							qstring tmpStr;
-							idaFlags2String(flags, tmpStr);
-                            msg("%llX (%s)\n", s_currentAddress, tmpStr.c_str());
-                            #endif
-                            ea_t end = next_head(s_currentAddress, s_segEnd);
-
-                            // Handle an occasional over run case
-                            if (end == BADADDR)
-                            {
-                                #ifdef PASS1_DEBUG
-                                msg("%llX **** abort end\n", s_currentAddress);
-                                #endif
-                                s_currentAddress = (s_segEnd - 1);
-                                break;
-                            }
-
-                            // Skip if it has offset reference (most common occurrence)
-                            BOOL bSkip = FALSE;
-                            if (flags & FF_0OFF)
-                            {
-                                #ifdef PASS1_DEBUG
-                                msg("  skip offset.\n");
-                                #endif
-                                bSkip = TRUE;
-                            }
-							else
-							// Skip if the value is larger than a QWORD.
-							// It's probably an SSE or actual string value embedded data
-							if(((flags & DT_TYPE) > FF_QWORD) && ((flags & DT_TYPE) != FF_ALIGN))
-							{
-								#ifdef PASS1_DEBUG
-								msg("  skip by data type.\n");
-								#endif
-								bSkip = TRUE;
-							}
-							else
-                            // Has a reference?
-                            if (flags & FF_REF)
-                            {
-                                ea_t eaDRef = get_first_dref_to(s_currentAddress);
-                                if (eaDRef != BADADDR)
-                                {
-									#ifdef PASS1_DEBUG
-									msg("  has ref.\n");
-									#endif
-
-                                    // Ref part an offset?
-									flags64_t flags2 = get_flags(eaDRef);
-                                    if (is_code(flags2) && is_off1(flags2))
-                                    {
-                                        // Decide instruction to global "cmd" struct
-                                        BOOL bIsByteAccess = FALSE;
-										insn_t cmd;
-                                        if (decode_insn(&cmd, eaDRef))
-                                        {
-                                            switch (cmd.itype)
-                                            {
-												// Assume it's an embedded data array
-												case NN_lea:
-												{
-													#ifdef PASS1_DEBUG
-													msg("%llX lea.\n", s_currentAddress);
-													#endif
-													bSkip = TRUE;
-												}
-												break;
-
-                                                // movxx style move a byte?
-                                                case NN_movzx:
-                                                case NN_movsx:
-                                                {
-                                                    #ifdef PASS1_DEBUG
-                                                    msg("%llX movzx.\n", s_currentAddress);
-                                                    #endif
-                                                    bIsByteAccess = TRUE;
-                                                }
-                                                break;
-
-                                                case NN_mov:
-                                                {
-                                                    if ((cmd.ops[0].type == o_reg) && (cmd.ops[1].dtype == dt_byte))
-                                                    {
-                                                        #ifdef PASS1_DEBUG
-                                                        msg("%llX mov.\n", s_currentAddress);
-                                                        #endif
-                                                        /*
-                                                        msg(" [0] T: %d, D: %d, \n", cmd.Operands[0].type, cmd.Operands[0].dtyp);
-                                                        msg(" [1] T: %d, D: %d, \n", cmd.Operands[1].type, cmd.Operands[1].dtyp);
-                                                        msg(" [2] T: %d, D: %d, \n", cmd.Operands[2].type, cmd.Operands[2].dtyp);
-                                                        msg(" [3] T: %d, D: %d, \n", cmd.Operands[3].type, cmd.Operands[3].dtyp);
-                                                        */
-                                                        bIsByteAccess = TRUE;
-                                                    }
-                                                }
-                                                break;
-                                            };
-                                        }
-
-                                        // If it's byte access, assume it's a byte switch table
-                                        if (bIsByteAccess)
-                                        {
-                                            #ifdef PASS1_DEBUG
-                                            msg("%llX not byte.\n", s_currentAddress);
-                                            #endif
-
-                                            makeUnknown(s_currentAddress, end);
-
-                                            // Step through making the array, and any bad size a byte
-                                            //for(ea_t i = s_eaCurrentAddress; i < eaEnd; i++){ doByte(i, 1); }
-											create_byte(s_currentAddress, (end - s_currentAddress));
-                                            auto_wait();
-                                            bSkip = TRUE;
-                                        }
-                                    }
-                                }
-
-                            } // if (flags & FF_REF)
-
-                            // Make it unknown bytes
-                            if (!bSkip)
-                            {
-                                #ifdef PASS1_DEBUG
-                                msg("%llX %llX %02X unknown\n", s_currentAddress, end, get_flags(s_currentAddress));
-                                #endif
-
-                                makeUnknown(s_currentAddress, end);
-                                s_unknownDataCount++;
-                            }
-
-                            // Advance to next data value, or the end which ever comes first
-                            s_currentAddress = end;
-                            if (s_currentAddress < s_segEnd)
-                            {
-                                s_currentAddress = next_that(s_currentAddress, s_segEnd, isData, NULL);
-                                break;
-                            }
-
-                        } // if (isData(flags))
-                        else
-                        {
-                            // Advance to next data value, or the end which ever comes first
-                            s_currentAddress = next_that(s_currentAddress, s_segEnd, isData, NULL);
-                            break;
-                        }
+// Save the run's progress to the database checkpoint
+static void saveCheckpoint()
+{
+	Checkpoint &cp = s_checkpoint;
+	cp.order = s_pipeline.order();
+	cp.alignment = s_passes.alignmentOverride;
+	cp.pass4Budget = s_passes.pass4Budget;
+	cp.timeSlice = (int) s_timeSlice;
+
+	cp.segments.clear();
+	if (!codeSegs.empty())
+	{
+		for (size_t i = 0; i < codeSegs.size(); i++)
+		{
+			EaRange r = { codeSegs[i].start_ea, codeSegs[i].end_ea };
+			cp.segments.push_back(r);
+		}
+		cp.segment = (UINT32) (segIndex - 1);
+	}
+	else
+	{
+		EaRange r = { s_thisSeg->start_ea, s_thisSeg->end_ea };
+		cp.segments.push_back(r);
+		cp.segment = 0;
+	}
+	cp.position = (UINT32) s_pipeline.position();
+	cp.cursor = (s_pipeline.started() ? s_passes.cursor() : BADADDR);
+
+	cp.startFuncCount = s_startFuncCount;
+	cp.pass4Used = s_passes.pass4Used();
+	cp.stats = s_passes.stats;
+	cp.stages.resize(s_pipeline.stageCount());
+	for (size_t i = 0; i < s_pipeline.stageCount(); i++)
+	{
+		const PipelineStage &stage = s_pipeline.stage(i);
+		cp.stages[i].runs = stage.runs;
+		cp.stages[i].steps = stage.steps;
+		cp.stages[i].time = stage.time;
+	}
 
-                    } // if (s_currentAddress < s_segEnd)
+	cp.save();
+	s_checkpointTime = GetTimeStamp();
+}
 
-                    if (++s_pass1Loops < UNKNOWN_PASSES)
-                    {
-                        #ifdef PASS1_DEBUG
-                        msg("** Pass %d Unknowns: %u\n", s_pass1Loops, s_unknownDataCount);
-                        #endif
+// Save a checkpoint if it's time while the passes run
+static void checkpointTick()
+{
+	if ((s_state == STATE_PASSES) && ((GetTimeStamp() - s_checkpointTime) >= CHECKPOINT_INTERVAL))
+		saveCheckpoint();
+}
 
-                        s_currentAddress = s_lastAddress = s_segStart;
-                    }
-                    else
-                    {
-                        #ifdef PASS1_DEBUG
-                        msg("** Pass %d Unknowns: %u\n", s_pass1Loops, s_unknownDataCount);
-                        #endif
+// Run the current state, returns FALSE when the plugin run is done
+static BOOL processState()
+{
+    switch (s_state)
+    {
+        // Initialize
+        case STATE_INIT:
+        {
+			qstring version;
+			msg("\n>> ExtraPass: v: %s, built: %s\n", GetVersionString(MY_VERSION, version).c_str(), __DATE__);
+            
+			// IDA must be IDLE. A batch run just waits for it
+			if (s_batch)
+				auto_wait();
+			if (!auto_is_ok())
+			{
+				msg("** Wait for IDA to finish processing before starting plugin! **\n*** Aborted ***\n\n");
+				goto exit;
+			}
 
-                        nextState();
-                    }
-                }
-                break;  // Find unknown data values in code
+			// Offer to resume an unfinished run, else ask for the options
+			codeSegs.clear();
+			segIndex = 0;
+			s_isBreak = FALSE;
+			s_resume = s_resumed = FALSE;
+			if (s_batch)
+			{
+				// Batch runs resume without asking
+				if (s_checkpoint.load() && resumeOptions())
+				{
+					s_audioAlertWhenDone = FALSE;
+					s_timeSlice = 0;
+				}
+				else
+				{
+					codeSegs.clear();
+					segIndex = 0;
+					Checkpoint::remove();
+					if (!batchOptions())
+						goto exit;
+				}
+			}
+			else
+			if (s_checkpoint.load() && (ask_yn(ASKBTN_YES, "HIDECANCEL\nResume the unfinished ExtraPass run in this database?\nNo starts a new run.") == ASKBTN_YES))
+			{
+				if (!resumeOptions())
+				{
+					msg("** The saved run doesn't match the database segments anymore, start a new one. **\n*** Aborted ***\n\n");
+					Checkpoint::remove();
+					goto exit;
+				}
+			}
+			else
+			{
+				if (!askOptions(version))
+					goto exit;
+				Checkpoint::remove();
+			}
 
+			// Extra no-return callee names from the IDA command line, "-OExtraPassNoRet:name1;name2"
+			s_passes.extraNoRetNames.clear();
+			if (const char *noRetNames = get_plugin_options("ExtraPassNoRet"))
+			{
+				std::string name;
+				for (const char *p = noRetNames; ; p++)
+				{
+					if (!*p || (*p == ';') || (*p == ','))
+					{
+						if (!name.empty())
+							s_passes.extraNoRetNames.push_back(name);
+						name.clear();
+						if (!*p)
+							break;
+					}
+					else
+						name += (char) tolower((unsigned char) *p);
+				}
+			}
+			if (!loadPrologues())
+			{
+				msg("*** Aborted ***\n\n");
+				goto exit;
+			}
 
-                // Find missing align blocks
-                //#define PASS2_DEBUG
-                case STATE_PASS_2:
+            // Ask for the log file name once
+            #ifdef LOG_FILE
+            if(!s_logFile)
+            {
+                if(char *szFileName = askfile_c(1, "*.txt", "Select a log file name:"))
                 {
-                    // Still inside this code segment?
-                    ea_t end = s_segEnd;
-                    if (s_currentAddress < end)
-                    {
-                        // Look for next unknown alignment type byte
-                        // Will return BADADDR if none found which will catch in the endEA test
-						flags64_t flags = get_full_flags(s_currentAddress);
-                        if (!isAlignByte(flags))
-                            s_currentAddress = next_that(s_currentAddress, s_segEnd, isAlignByte, NULL);
-
-                        if (s_currentAddress < end)
-                        {
-                            // Catch when we get caught up in an array, etc.
-                            ea_t startAddress = s_currentAddress;
-                            if (s_currentAddress <= s_lastAddress)
-                            {
-                                // Move to next header and try again..
-                                #ifdef PASS2_DEBUG
-                                //msg("%llX, F: 0x%X *** Align test in array #1 ***\n", s_currentAddress, flags);
-                                #endif
-
-                                s_currentAddress = s_lastAddress = next_addr(s_currentAddress);
-                                break;
-                            }
-
-                            #ifdef PASS2_DEBUG
-                            //msg("%llX Start.\n", startAddress);
-                            //msg("%llX, F: %08X.\n", startAddress, get_flags_novalue(startAddress));
-                            #endif
-                            s_lastAddress = s_currentAddress;
-
-                            // Get run count of this align byte
-                            UINT alignByteCount = 1;
-                            BYTE startAlignValue = get_byte(startAddress);
-
-                            while (TRUE)
-                            {
-                                // Next byte
-                                s_currentAddress = next_addr(s_currentAddress);
-                                #ifdef PASS2_DEBUG
-                                //msg("%llX Next.\n", s_currentAddress);
-                                //msg("%llX, F: %08X.\n", s_currentAddress, get_flags_novalue(s_currentAddress));
-                                #endif
-
-                                if (s_currentAddress < end)
-                                {
-                                    // Catch when we get caught up in an array, etc.
-                                    if (s_currentAddress <= s_lastAddress)
-                                    {
-                                        #ifdef PASS2_DEBUG
-                                        //msg("%llX, F: %08X *** Align test in array #2 ***\n", startAddress, get_flags_novalue(s_currentAddress));
-                                        #endif
-                                        s_currentAddress = s_lastAddress = next_addr(s_currentAddress);
-                                        break;
-                                    }
-                                    s_lastAddress = s_currentAddress;
-
-                                    // Count if it' still the same byte
-                                    if (get_byte(s_currentAddress) == startAlignValue)
-                                        alignByteCount++;
-                                    else
-                                        break;
-                                }
-                                else
-                                    break;
-                            };
-
-                            // Do these bytes bring about at least a 16 (could be 32) align?
-                            // TODO: Must we consider other alignments such as 4 and 8?
-                            //       Probably a compiler option that is not normally used anymore.
-                            if (((startAddress + alignByteCount) & (16 - 1)) == 0)
-                            {
-                                // If short count, only try alignment if the line above or a below us has n xref
-                                // We don't want to try to align odd code and switch table bytes, etc.
-                                if (alignByteCount <= 2)
-                                {
-                                    BOOL hasRef = FALSE;
-
-                                    // Before us
-                                    ea_t endAddress = (startAddress + alignByteCount);
-                                    ea_t ref = get_first_cref_from(endAddress);
-                                    if (ref != BADADDR)
-                                    {
-                                        //msg("%llX cref from end.\n", endAddress);
-                                        hasRef = TRUE;
-                                    }
-                                    else
-                                    {
-                                        ref = get_first_cref_to(endAddress);
-                                        if (ref != BADADDR)
-                                        {
-                                            //msg("%llX cref to end.\n", endAddress);
-                                            hasRef = TRUE;
-                                        }
-                                    }
-
-                                    // After us
-                                    if (ref == BADADDR)
-                                    {
-                                        ea_t foreAddress = (startAddress - 1);
-                                        ref = get_first_cref_from(foreAddress);
-                                        if (ref != BADADDR)
-                                        {
-                                            //msg("%llX cref from start.\n", eaForeAddress);
-                                            hasRef = TRUE;
-                                        }
-                                        else
-                                        {
-                                            ref = get_first_cref_to(foreAddress);
-                                            if (ref != BADADDR)
-                                            {
-                                                //msg("%llX cref to start.\n", eaForeAddress);
-                                                hasRef = TRUE;
-                                            }
-                                        }
-                                    }
-
-                                    // No code ref, now look for a broken code ref
-                                    if (ref == BADADDR)
-                                    {
-                                        // This is still not complete as it could still be code, but pointing to a vftable
-                                        // entry in data.
-                                        // But should be fixed on more passes.
-                                        ea_t endAddress = (startAddress + alignByteCount);
-                                        ref = get_first_dref_from(endAddress);
-                                        if (ref != BADADDR)
-                                        {
-                                            // If it the ref points to code assume code is just broken here
-                                            if (is_code(get_flags(ref)))
-                                            {
-                                                //msg("%llX dref from end %08X.\n", eaRef, eaEndAddress);
-                                                hasRef = TRUE;
-                                            }
-                                        }
-                                        else
-                                        {
-                                            ref = get_first_dref_to(endAddress);
-                                            if (ref != BADADDR)
-                                            {
-                                                if (is_code(get_flags(ref)))
-                                                {
-                                                    //msg("%llX dref to end %08X.\n", eaRef, eaEndAddress);
-                                                    hasRef = TRUE;
-                                                }
-                                            }
-                                        }
-
-                                        if (ref == BADADDR)
-                                        {
-                                            //msg("%llX NO REF.\n", eaStartAddress);
-                                        }
-                                    }
-
-                                    // Assume it's not an alignment byte(s) and bail out
-                                    if (!hasRef) break;
-                                }
-
-                                // If it's not an align make block already try to fix it
-								flags64_t flags = get_flags(startAddress);
-								UINT itemSize = (UINT) get_item_size(startAddress);
-								if (!is_align(flags) || (itemSize != alignByteCount))
-								{
-									makeUnknown(startAddress, ((startAddress + alignByteCount) - 1));
-									BOOL result = create_align(startAddress, alignByteCount, 0);
-									auto_wait();
-									#ifdef PASS2_DEBUG
-									msg("%llX %d %d  %d %d %d DO ALIGN.\n", startAddress, alignByteCount, result, isAlign(flags), itemSize, get_item_size(startAddress));
-									#endif
-									if (result)
-									{
-										#ifdef PASS2_DEBUG
-										//msg("%llX %d ALIGN.\n", startAddress, alignByteCount);
-										#endif
-										s_alignFixes++;
-									}
-									else
-									{
-										// There are cases were IDA will fail even when the alignment block is obvious.
-										// Usually when it's an ALIGN(32) and there is a run of 16 align bytes
-										// Could at least do a code analyze on it. Then IDA will at least make a mini array of it
-										#ifdef PASS2_DEBUG
-										msg("%llX %d ALIGN FAIL ***\n", startAddress, alignByteCount);
-										//s_alignFails++;
-										#endif
-									}
-								}
-                            }
-                        }
-
-                        break;
-                    }
-
-					// Done, move to next state
-                    s_currentAddress = s_segEnd;
-                    nextState();
+                    // Open it for appending
+                    s_logFile = qfopen(szFileName, "ab");
                 }
-                break; // Find missing align blocks
+            }
+            if(!s_logFile)
+            {
+                msg("** Log file open failed! Aborted. **\n");
+                return false;
+            }
+            s_passes.logFile = s_logFile;
+            #endif
+
+            s_thisSeg = NULL;
+            s_passes.resetStats();
+			s_pipeline.resetStats();
+            s_startFuncCount = (int) get_func_qty();
+			if (!s_startFuncCount)
+			{
+				msg("** No functions in this DB?! **\n*** Aborted ***\n\n");
+				goto exit;
+			}
 
+			// Counters carry on from the saved run, including the function count it started with
+			if (s_resume)
+			{
+				s_startFuncCount = s_checkpoint.startFuncCount;
+				s_passes.stats = s_checkpoint.stats;
+				s_passes.setPass4Used(s_checkpoint.pass4Used);
+				for (size_t i = 0; (i < s_pipeline.stageCount()) && (i < s_checkpoint.stages.size()); i++)
+				{
+					PipelineStage &stage = s_pipeline.stage(i);
+					stage.runs = s_checkpoint.stages[i].runs;
+					stage.steps = s_checkpoint.stages[i].steps;
+					stage.time = s_checkpoint.stages[i].time;
+				}
+			}
+			s_checkpointTime = s_runStart = GetTimeStamp();
 
-                // Find missing code
-                //#define PASS3_DEBUG
-                case STATE_PASS_3:
-                {
-                    // Still inside segment?
-                    if (s_currentAddress < s_segEnd)
-                    {
-                        // Look for next unknown value
-                        ea_t startAddress = next_unknown(s_currentAddress, s_segEnd);
-                        if (startAddress < s_segEnd)
-                        {
-                            s_currentAddress = startAddress;
-
-                            // Catch when we get caught up in an array, etc.
-                            if (s_currentAddress <= s_lastAddress)
-                            {
-                                // Move to next header and try again..
-                                s_currentAddress = next_unknown(s_currentAddress, s_segEnd);
-                                s_lastAddress = s_currentAddress;
-                                break;
-                            }
-                            s_lastAddress = s_currentAddress;
-
-                            // Try to make code of it
-							if (!isAlignByte(get_full_flags(s_currentAddress)))
-							{
-								auto_wait();
-								int result = create_insn(s_currentAddress);
-								#ifdef PASS3_DEBUG
-								msg("%llX DO CODE %d\n", s_currentAddress, result);
-								#endif
-
-								if(result > 0)
-									s_codeFixes++;
-								else
-								{
-									#ifdef PASS3_DEBUG
-									msg("%llX fix fail.\n", s_currentAddress);
-									#endif
-								}
-							}
-
-                            s_currentAddress++;
-                            break;
-                        }
-                    }
+            char buffer[32];
+            msg("Starting function count: %s\n", NumberCommaString(s_startFuncCount, buffer));
 
-                    // Next state
-                    s_currentAddress = s_segEnd;
-                    nextState();
+            /*
+            msg("\n=========== Segments ===========\n");
+            int iSegCount = get_segm_qty();
+            for(int i = 0; i < iSegCount; i++)
+            {
+                if(segment_t *pSegInfo = getnseg(i))
+                {
+                char szName[128] = {0};
+                get_segm_name(pSegInfo, szName, (sizeof(szName) - 1));
+                char szClass[16] = {0};
+                get_segm_class(pSegInfo, szClass, (sizeof(szClass) - 1));
+                msg("[%d] \"%s\", \"%s\".\n", i, szName, szClass);
                 }
-                break; // End: Find missing code
-
+            }
+            */
 
-                // Discover missing functions part
-				//#define PASS4_DEBUG
-                case STATE_PASS_4:
+            // First chosen seg
+            if (!codeSegs.empty())                        
+                s_thisSeg = &codeSegs[segIndex++];                        
+            else
+            // Use the first CODE seg
+            {
+                int segCount = get_segm_qty();
+				int i = 0;
+                for (; i < segCount; i++)
                 {
-                    if (s_funcIndex < (s_funcList.size() - 1))
-                    {
-						// Process function gap from the end of one function to the start of the next
-
-						// Skip if first function body is not contiguous						
-						func_t *f = s_funcList[s_funcIndex + 0];
-						if (f->tailqty != 0)
-						{
-							#ifdef PASS4_DEBUG
-							static UINT nonContiguousCount = 0;
-							msg("%llX [%d] not contiguous %d\n", f->start_ea, nonContiguousCount++, f->tailqty);
-							#endif
-						}
-						else
-						{
-							ea_t a_end = f->end_ea;
-							ea_t b_start = s_funcList[s_funcIndex + 1]->start_ea;
-							processFuncGap(a_end, b_start);
-						}
-
-						s_funcIndex++;
-                    }
-                    else
+                    if (s_thisSeg = getnseg(i))
                     {
-                        s_currentAddress = s_segEnd;
-                        nextState();
+                        qstring sclass;
+                        if (get_segm_class(&sclass, s_thisSeg) <= 0)
+                            break;
+                        else
+                        if (sclass == "CODE")
+                            break;
                     }
                 }
-                break;
 
-				// Fix bad tail blocks				
-				case STATE_PASS_5:
+                if (i >= segCount)
+                    s_thisSeg = NULL;
+            }
+
+            if (s_thisSeg)
+            {
+				// Time sliced and batch runs leave the UI alone, progress goes to the output window
+				if (!s_timeSlice && !s_batch)
 				{
-					if (s_funcIndex < s_funcList.size())
-                    {						
-						// Fits not contiguous function problem type??
-						func_t *f = s_funcList[s_funcIndex];
-						if (f->tailqty == 1)
-						{
-							// Go check and handle it
-							processFunc(f);
-						}
-							
-						s_funcIndex++;
-                    }
-                    else
-                    {
-                        s_currentAddress = s_segEnd;
-                        nextState();
-                    }
+					WaitBox::show("ExtraPass", "Working..");
+					WaitBox::updateAndCancelCheck(-1);
 				}
-				break;
-
-                // Finished processing
-                case STATE_FINISH:
+                s_passes.setSegment(s_thisSeg->start_ea, s_thisSeg->end_ea);
                 nextState();
                 break;
+            }
+            else
+                msg("** No code segment found to process! **\n*** Aborted ***\n\n");                  
+           
+            // Canceled error, bail out
+			exit:;
+            s_state = STATE_EXIT;
+        }
+        break;
 
-                // Done processing
-                case STATE_EXIT:
-                {					
-                    nextState();
-                    goto BailOut;
-                }
-                break;
-            };
+        // Start up process
+        case STATE_START:
+        {
+			qstring name;
+            if (get_segm_name(&name, s_thisSeg) <= 0)
+				name = "????";
+            qstring sclass;
+            if(get_segm_class(&sclass, s_thisSeg) <= 0)
+				sclass = "????";
+            msg("\nSegment: \"%s\", type: %s, address: %llX-%llX, size: 0x%X\n", name.c_str(), sclass.c_str(), s_thisSeg->start_ea, s_thisSeg->end_ea, s_thisSeg->size());
+
+			// Function alignment for this segment
+			unsigned int alignment = s_passes.detectAlignment();
+			const unsigned int *histogram = s_passes.alignHistogram();
+			msg("Function alignment: %u (%s), starts by alignment: 1: %u, 2: %u, 4: %u, 8: %u, 16: %u, 32: %u, 64+: %u\n\n", alignment, (s_passes.alignmentOverride ? "set" : "auto"),
+				histogram[0], histogram[1], histogram[2], histogram[3], histogram[4], histogram[5], histogram[6]);
+
+            // Move to first process state
+            s_startTime = GetTimeStamp();
+            nextState();
+        }
+        break;
 
-            // Check & bail out on 'break' press
-			if (checkBreak())				
-				goto BailOut;			
-        };		
-    }
-	CATCH()
-	BailOut:;
-	WaitBox::hide();
-	return true;
-}
 
+        // Step the current pass stage
+        case STATE_PASSES:
+        if (!s_pipeline.step())
+            nextState();
+        break;
 
-// Get list of current functions prior to a processing pass
-static void cacheFunctionList()
-{
-	int funcCount = (int) get_func_qty();
-	s_funcList.clear();
-	s_funcList.resize(funcCount);
-	s_funcIndex = 0;
-
-	// Must get list of functions BEFORE we start processing since IDA enumeration will break as new functions are added
-	for (int i = 0; i < funcCount; i++)
-		s_funcList[i] = getn_func(i);
-}
+        // Finished processing
+        case STATE_FINISH:
+        nextState();
+        break;
 
+        // Done processing
+        case STATE_EXIT:
+        {					
+            nextState();
+            return FALSE;
+        }
+        break;
+    };
+	return TRUE;
+}
 
-// Do next state logic
-static void nextState()
+// Time slice timer callback, runs the states for a slice then gives the UI a turn until the next one
+static int idaapi sliceTimer(void *ud)
 {
-	// Rewind
-	if(s_state < STATE_FINISH)
+	try
 	{
-		// Top of code seg
-		s_currentAddress = s_lastAddress = s_segStart;
-		auto_wait();
-	}
-
-	// Logic
-	switch(s_state)
-	{
-		// Init
-		case STATE_INIT:
-		{
-			s_state = STATE_START;
-		}
-		break;
-
-		// Start
-		case STATE_START:
+		TIMESTAMP start = GetTimeStamp();
+		if (s_sliceLast != 0)
+			s_sliceIdle += (start - s_sliceLast);
+		s_sliceStart = start;
+		s_sliceCount++;
+
+		BOOL running = TRUE;
+		TIMESTAMP end = (start + ((TIMESTAMP) s_timeSlice / 1000.0));
+		TIMESTAMP now = start;
+		do
 		{
-			if(s_doDataToBytes)
-			{
-				msg("===== Fixing bad code bytes =====\n");
-				s_stepTime = GetTimeStamp();
-				s_state = STATE_PASS_1;
-			}
-			else
-			if(s_doAlignBlocks)
-			{
-				msg("===== Fixing align blocks =====\n");
-				s_stepTime = GetTimeStamp();
-				s_state = STATE_PASS_2;
-			}
-			else
-			if(s_doMissingCode)
-			{
-				msg("===== Fixing missing code =====\n");
-				s_stepTime = GetTimeStamp();
-				s_state = STATE_PASS_3;
-			}
-			else
-			if(s_doMissingFunc)
+			// A step can't be cut short, so the longest one is the slice overrun to expect
+			const PipelineStage *stage = s_pipeline.current();
+			running = processState();
+			TIMESTAMP stepEnd = GetTimeStamp();
+			if ((stepEnd - now) > s_longestStep)
 			{
-				msg("===== Fixing missing functions =====\n");
-				s_stepTime = GetTimeStamp();
-				cacheFunctionList();
-				s_state = STATE_PASS_4;
+				s_longestStep = (stepEnd - now);
+				s_longestStage = (stage ? stage->name.c_str() : "setup");
 			}
-			else
-			if (s_doFixTailBlks)
-			{
-				msg("===== Fixing bad tail blocks =====\n");
-				s_stepTime = GetTimeStamp();
-				cacheFunctionList();
-				s_state = STATE_PASS_5;
-			}
-			else
-				s_state = STATE_FINISH;
-		}
-		break;
+			now = stepEnd;
+		} while (running && (now < end));
 
-		// Find unknown data in code space
-		case STATE_PASS_1:
+		s_sliceLast = GetTimeStamp();
+		s_sliceWork += (s_sliceLast - start);
+		if (running)
 		{
-			msg("Took %s.\n\n", TimeString(GetTimeStamp() - s_stepTime));
+			checkpointTick();
 
-			if(s_doAlignBlocks)
-			{
-				msg("===== Fixing align blocks =====\n");
-				s_stepTime = GetTimeStamp();
-				s_state = STATE_PASS_2;
-			}
-			else
-			if(s_doMissingCode)
-			{
-				msg("===== Fixing missing code =====\n");
-				s_stepTime = GetTimeStamp();
-				s_state = STATE_PASS_3;
-			}
-			else
-			if(s_doMissingFunc)
+			// Progress readout
+			if ((s_sliceLast - s_progressTime) >= PROGRESS_INTERVAL)
 			{
-				msg("===== Fixing missing functions =====\n");
-				s_stepTime = GetTimeStamp();
-				cacheFunctionList();
-				s_state = STATE_PASS_4;
+				if (const PipelineStage *stage = s_pipeline.current())
+					msg("ExtraPass: %s, %u%%\n", stage->title.c_str(), s_passes.progress());
+				s_progressTime = s_sliceLast;
 			}
-			else
-			if (s_doFixTailBlks)
-			{
-				msg("===== Fixing bad tail blocks =====\n");
-				s_stepTime = GetTimeStamp();
-				cacheFunctionList();
-				s_state = STATE_PASS_5;
-			}
-			else
-				s_state = STATE_FINISH;
+			return SLICE_INTERVAL;
 		}
-		break;
+	}
+	CATCH()
 
+	// Done, or an exception
+	s_timer = NULL;
+	s_state = STATE_INIT;
+	return -1;
+}
 
-		// From missing align block pass
-		case STATE_PASS_2:
+// Plug-in process
+bool idaapi run(size_t arg)
+{
+	try
+	{
+		// A time sliced run is in progress, offer to stop it
+		if (s_timer)
 		{
-			msg("Took %s.\n\n", TimeString(GetTimeStamp() - s_stepTime));
-
-			if(s_doMissingCode)
+			if (ask_yn(ASKBTN_NO, "HIDECANCEL\nExtraPass is running, stop it?") == ASKBTN_YES)
 			{
-				msg("===== Fixing missing code =====\n");
-				s_stepTime = GetTimeStamp();
-				s_state = STATE_PASS_3;
-			}
-			else
-			if(s_doMissingFunc)
-			{
-				msg("===== Fixing missing functions =====\n");
-				s_stepTime = GetTimeStamp();
-				cacheFunctionList();
-				s_state = STATE_PASS_4;
-			}
-			else
-			if (s_doFixTailBlks)
-			{
-				msg("===== Fixing bad tail blocks =====\n");
-				s_stepTime = GetTimeStamp();
-				cacheFunctionList();
-				s_state = STATE_PASS_5;
+				msg("\n*** Aborted ***\n\n");
+				if (s_state == STATE_PASSES)
+				{
+					saveCheckpoint();
+					msg("Progress saved, run ExtraPass again to resume.\n");
+				}
+				showEndStats();
+				unregister_timer(s_timer);
+				s_timer = NULL;
+				s_passes.clearFunctionList();
+				s_state = STATE_INIT;
 			}
+			return true;
+		}
+
+		// Headless batch mode, from a script with a plugin argument or "-OExtraPassBatch"
+		s_runArg = arg;
+		s_batch = ((arg != 0) || (get_plugin_options("ExtraPassBatch") != NULL));
+		s_batchStatus = "failed";
+		if (s_batch)
+		{
+			s_runStart = 0;
+			s_startFuncCount = 0;
+			const char *path = get_plugin_options("ExtraPassBatch");
+			if (path && *path)
+				s_summaryPath = path;
 			else
-				s_state = STATE_FINISH;
+				s_summaryPath.sprnt("%s.extrapass.json", get_path(PATH_TYPE_IDB));
 		}
-		break;
 
-		// From missing code pass
-		case STATE_PASS_3:
+		// Options UI
+		processState();
+
+		// Run the passes from an IDA timer in time slices, returning to IDA now
+		s_passes.pass1BatchSize = PASS1_BATCH_SIZE;
+		if (s_timeSlice && !s_batch && (s_state != STATE_EXIT))
 		{
-			msg("Took %s.\n\n", TimeString(GetTimeStamp() - s_stepTime));
+			s_sliceCount = 0;
+			s_sliceWork = s_sliceIdle = 0.0;
+			s_sliceStart = s_sliceLast = 0;
+			s_longestStep = 0.0;
+			s_longestStage = "";
+			s_passes.pass1BatchSize = SLICE_PASS1_BATCH;
+			s_progressTime = GetTimeStamp();
+			s_timer = register_timer(0, sliceTimer, NULL);
+			if (s_timer)
+				return true;
+			msg("** Time slice timer failed, running without yielding. **\n");
+			WaitBox::show("ExtraPass", "Working..");
+			WaitBox::updateAndCancelCheck(-1);
+			s_timeSlice = 0;
+			s_passes.pass1BatchSize = PASS1_BATCH_SIZE;
+		}
 
-			if(s_doMissingFunc)
-			{
-				msg("===== Fixing missing functions =====\n");
-				s_stepTime = GetTimeStamp();
-				cacheFunctionList();
-				s_state = STATE_PASS_4;
-			}
-			else
-			if (s_doFixTailBlks)
-			{
-				msg("===== Fixing bad tail blocks =====\n");
-				s_stepTime = GetTimeStamp();
-				cacheFunctionList();
-				s_state = STATE_PASS_5;
-			}
-			else
-				s_state = STATE_FINISH;
+		// Or all at once
+		while (processState())
+		{
+			checkpointTick();
+
+			// Check & bail out on 'break' press
+			if (!s_batch && checkBreak())
+				break;
 		}
-		break;
+	}
+	CATCH()
+	WaitBox::hide();
+	s_state = STATE_INIT;
+	if (s_batch)
+	{
+		writeSummary();
+		s_batch = FALSE;
+	}
+	return true;
+}
 
-		// From missing function pass
-		case STATE_PASS_4:
+
+// Do next state logic
+static void nextState()
+{
+	// Logic
+	switch(s_state)
+	{
+		// Init
+		case STATE_INIT:
 		{
-			s_funcList.clear();
-			msg("Took %s.\n\n", TimeString(GetTimeStamp() - s_stepTime));			
+			s_state = STATE_START;
+		}
+		break;
 
-			if (s_doFixTailBlks)
+		// Start
+		case STATE_START:
+		{
+			if (s_resume)
 			{
-				msg("===== Fixing bad tail blocks =====\n");
-				s_stepTime = GetTimeStamp();
-				cacheFunctionList();
-				s_state = STATE_PASS_5;
+				s_pipeline.begin(s_checkpoint.position, s_checkpoint.cursor);
+				s_resume = FALSE;
 			}
 			else
-				s_state = STATE_FINISH;
+				s_pipeline.begin();
+			s_state = (s_pipeline.current() ? STATE_PASSES : STATE_FINISH);
 		}
 		break;
 
-		// From tail block fix pass
-		case STATE_PASS_5:
+		// From the last pipeline stage
+		case STATE_PASSES:
 		{
-			s_funcList.clear();
-			msg("Took %s.\n\n", TimeString(GetTimeStamp() - s_stepTime));
 			s_state = STATE_FINISH;
 		}
 		break;
@@ -1113,13 +943,14 @@ static void nextState()
             if (!codeSegs.empty() && (segIndex < (int) codeSegs.size()))
 			{
 				s_thisSeg = &codeSegs[segIndex++];              
-				s_segStart = s_thisSeg->start_ea;
-				s_segEnd   = s_thisSeg->end_ea;
+				s_passes.setSegment(s_thisSeg->start_ea, s_thisSeg->end_ea);
 				s_state = STATE_START;
 			}
 			else
 			{
 				msg("\n===== Done =====\n");
+				Checkpoint::remove();
+				s_batchStatus = "done";
 				showEndStats();
                 refresh_idaview_anyway();
 				WaitBox::hide();
@@ -1158,556 +989,217 @@ static void showEndStats()
 	if (functionsDelta != 0)
 		msg("Missing functions recovered: %c%s\n", ((functionsDelta >= 0) ? '+' : '-'), NumberCommaString(labs(functionsDelta), buffer)); // Can be negative/worse..
 
-	if(s_tailBlckRefFixes)
-		msg("Non-contiguous functions fixed: %s\n", NumberCommaString(s_tailBlckRefFixes, buffer));
-
-	if (s_alignFixes)
-		msg("Fixed alignment blocks: %s\n", NumberCommaString(s_alignFixes, buffer));
-
-	msg("Took %s in total.\n", TimeString(GetTimeStamp() - s_startTime));
-	msg(" \n");
-	refresh_idaview_anyway();
-}
-
-// Returns TRUE if flag byte is possibly a typical alignment byte
-static bool idaapi isAlignByte(flags64_t flags, void *ud)
-{
-	const flags64_t ALIGN_VALUE1 = (FF_IVL | 0xCC); // 0xCC (single byte "int 3") byte type
-	const flags64_t ALIGN_VALUE2 = (FF_IVL | 0x90); // NOP byte type
-
-	flags &= (FF_IVL | MS_VAL);
-	if((flags == ALIGN_VALUE1) || (flags == ALIGN_VALUE2))
-		return(TRUE);
-	else
-		return(FALSE);
-}
-
-// Return if flag is data type we want to convert to unknown bytes
-static bool idaapi isData(flags64_t flags, void *ud)
-{
-	return(!is_align(flags) && is_data(flags));
-}
-
+	const PassStats &stats = s_passes.stats;
+	if(stats.tailBlckRefFixes)
+		msg("Non-contiguous functions fixed: %s\n", NumberCommaString(stats.tailBlckRefFixes, buffer));
 
-static inline BOOL isJmpNotCntl(UINT type) { return((type >= NN_jmp) && (type <= NN_jmpshort)); } // Returns TRUE if is a non-conditional jump instruction type
-static inline BOOL isCall(UINT type) { return((type >= NN_call) && (type <= NN_callni)); }        // Returns TRUE if is call instruction type
+	if (stats.alignFixes)
+		msg("Fixed alignment blocks: %s\n", NumberCommaString(stats.alignFixes, buffer));
+	msg("Function starts by alignment: 1: %u, 2: %u, 4: %u, 8: %u, 16: %u, 32: %u, 64+: %u\n", stats.alignHistogram[0], stats.alignHistogram[1], stats.alignHistogram[2],
+		stats.alignHistogram[3], stats.alignHistogram[4], stats.alignHistogram[5], stats.alignHistogram[6]);
 
-// Try adding a function at specified address
-static BOOL tryFunction(ea_t codeStart, ea_t codeEnd, ea_t &current)
-{
-	BOOL result = FALSE;
-
-	auto_wait();
-	#ifdef LOG_FILE
-	Log(s_logFile, "%llX %llX Trying function.\n", codeStart, current);
-	#endif
-	//msg("  %llX %llX Trying function.\n", codeStart, codeEnd);
-
-	/// *** Don't use "get_func()" it has a bug, use "get_fchunk()" instead ***
+	if (stats.pass3Runs)
+	{
+		msg("Missing code unknown runs: %s", NumberCommaString(stats.pass3Runs, buffer));
+		msg(", create instruction calls: %s", NumberCommaString(stats.pass3Creates, buffer));
+		msg(", bytes skipped: %s\n", NumberCommaString(stats.pass3Skipped, buffer));
+	}
 
-	// Could belong as a chunk to an existing function already or already a function here recovered already between steps.
-	if(func_t *f = get_fchunk(codeStart))
+	if (stats.insnCreatesAvoided || stats.funcAddsAvoided)
 	{
-  		#ifdef LOG_FILE
-        Log(s_logFile, "  %llX %llX %llX F: %08X already function.\n", f->endEA, f->startEA, codeStart, get_flags_novalue(codeStart));
-		#endif
-		//msg("  %llX %llX %llX F: %08X already a function.\n", f->endEA, f->startEA, codeStart, getFlags(codeStart));
+		msg("Decoder rejected candidates, create instruction calls avoided: %s", NumberCommaString(stats.insnCreatesAvoided, buffer));
+		msg(", add function calls avoided: %s\n", NumberCommaString(stats.funcAddsAvoided, buffer));
+	}
 
-		current = prev_head(f->end_ea, codeStart); // Advance to end of the function -1 location (for a follow up "next_head()")
-		result = TRUE;
+	if (stats.gapCount)
+	{
+		msg("Function gaps: %s", NumberCommaString(stats.gapCount, buffer));
+		msg(", skipped as empty or padding only: %s\n", NumberCommaString(stats.gapsSkipped, buffer));
+		msg("Processed gap sizes: <16: %u, <64: %u, <256: %u, <1K: %u, <4K: %u, <16K: %u, 16K+: %u\n", stats.gapHistogram[0], stats.gapHistogram[1], stats.gapHistogram[2],
+			stats.gapHistogram[3], stats.gapHistogram[4], stats.gapHistogram[5], stats.gapHistogram[6]);
 	}
-	else
+	if (stats.prologueHits)
 	{
-		// Try function here
-		//flags_t flags = getFlags(codeEnd);
-		//flags = flags;
-		//if (add_func(codeStart, codeEnd /*BADADDR*/))
-
-		if(add_func(codeStart, BADADDR))
-		{
-			// Wait till IDA is done possibly creating the function, then get it's info
-			auto_wait();
-			if(func_t *f = get_fchunk(codeStart)) // get_func
-			{
-				#ifdef LOG_FILE
-				Log(s_logFile, "  %llX function success.\n", codeStart);
-				#endif
-				#ifdef VBDEV
-				msg("  " %llX function success.\n", codeStart);
-				#endif
-
-				// Look at function tail instruction
-				auto_wait();
-				BOOL isExpected = FALSE;
-				ea_t tailEa = prev_head(f->end_ea, codeStart);
-				if(tailEa != BADADDR)
-				{
-					insn_t cmd;
-					if(decode_insn(&cmd, tailEa))
-					{
-						switch(cmd.itype)
-						{
-							// A return?
-							case NN_retn: case NN_retf: case NN_iretw: case NN_iret: case NN_iretd:
-							case NN_iretq: case NN_syscall:
-							case NN_sysret:
-							{
-								isExpected = TRUE;
-							}
-							break;
-
-							// A jump? (chain to another function, etc.)
-							case NN_jmp: case NN_jmpfi:	case NN_jmpni: case NN_jmpshort:
-							// Can be a conditional branch to another incongruent chunk
-							case NN_ja:  case NN_jae: case NN_jb:  case NN_jbe:  case NN_jc:   case NN_je:   case NN_jg:
-							case NN_jge: case NN_jl:  case NN_jle: case NN_jna:  case NN_jnae: case NN_jnb:  case NN_jnbe:
-							case NN_jnc: case NN_jne: case NN_jng: case NN_jnge: case NN_jnl:  case NN_jnle: case NN_jno:
-							case NN_jnp: case NN_jns: case NN_jnz: case NN_jo:   case NN_jp:  case NN_jpe:   case NN_jpo:
-							case NN_js:  case NN_jz:
-							{
-								isExpected = TRUE;
-							}
-							break;
-
-							// A single align byte that was mistakenly made a function?
-							case NN_int3:
-							case NN_nop:
-							if(f->size() == 1)
-							{
-								// Try to make it an align
-                                makeUnknown(tailEa, (tailEa + 1));
-								if(!create_align(tailEa, 1, 0))
-								{
-									// If it fails, make it an instruction at least
-									//msg("  %llX ALIGN fail.\n", tailEA);
-									create_insn(tailEa);
-								}
-
-                                auto_wait();
-								//msg("  %llX ALIGN\n", tailEA);
-								isExpected = TRUE;
-							}
-							break;
-
-							// Return-less exception or exit handler?
-							case NN_call:
-							{
-								ea_t eaCRef = get_first_cref_from(tailEa);
-								if(eaCRef != BADADDR)
-								{
-                                    qstring str;
-                                    if (get_name(&str, eaCRef) > 0)
-                                    {
-                                        char name[MAXNAMELEN + 1];
-                                        strncpy_s(name, sizeof(name), str.c_str(), SIZESTR(name));
-                                        _strlwr(name);
-
-										static const char * const exitNames[] =
-										{
-											"exception",
-											"handler",
-											"exitprocess",
-											"fatalappexit",
-											"_abort",
-											"_exit",
-										};
-
-										for(int i = 0; i < (sizeof(exitNames) / sizeof(const char *)); i++)
-										{
-											if(strstr(name, exitNames[i]))
-											{
-												//msg("  %llX Exception\n", CodeStartEA);
-												isExpected = TRUE;
-												break;
-											}
-										}
-									}
-								}
-							}
-							// Drop through to default for "call"
-
-							// Allow if function has attribute "noreturn"
-							default:
-							{
-								if(f->flags & FUNC_NORET)
-								{
-									//msg("  %llX NORETURN\n", tailEA);
-									isExpected = TRUE;
-								}
-							}
-							break;
-						};
-					}
-
-					#ifdef SHOW_PROBLEMS
-					if(!isExpected)
-					{
-                        char name[MAXNAMELEN + 1];
-                        qstring str;
-                        if (get_name(&str, f->start_ea) > 0)
-                            strncpy_s(name, sizeof(name), str.c_str(), SIZESTR(name));
-                        else
-                            memcpy(name, "unknown", sizeof("unknown"));
-						msg("%llX" \"%s\" problem? <click me>\n", tailEa, name);
-						//msg("  T: %d\n", cmd.itype);
-
-						#ifdef LOG_FILE
-						Log(s_logFile, "%llX \"%s\" problem? <click me>\n", tailEa, name);
-						//Log(s_hLogFile, "  T: %d\n", cmd.itype);
-						#endif
-					}
-					#endif
-				}
-
-				// Update current look position to the end of this function
-				current = tailEa; // Advance to end of the function -1 location (for a follow up "next_head()")
-				result = TRUE;
-			}
-		}
+		msg("Prologue signature hits in gaps: %s", NumberCommaString(stats.prologueHits, buffer));
+		msg(", functions added at one: %s\n", NumberCommaString(stats.prologueFuncs, buffer));
 	}
-
-	return(result);
-}
-
-
-// Process the gap from the end of one function to the start of the next
-// looking for missing functions in between.
-static void processFuncGap(ea_t start, ea_t end)
-{
-	// Assume function boundaries at alignment
-	start = ((start + MINIMAL_ALIGNMENT) & ~((ea_t) (MINIMAL_ALIGNMENT - 1)));
-	#define IS_ALIGNED(_addr) (((_addr) & ((ea_t) (MINIMAL_ALIGNMENT - 1))) == 0)
-	s_currentAddress = start;
-
-	// Bail out if there is no gap here
-	if (end <= start)
-		return;
-
-	#ifdef LOG_FILE
-	Log(s_logFile, "\nS: %llX, E: %llX ==== PFG START ====\n", start, end);
-	#endif
-	#ifdef VBDEV
-	msg("%llX %llX ==== Gap\n", start, end);
-	#endif
-
-	// Walk backwards from the end to trim possible alignment section at the end
-	auto_wait();
-	ea_t ea = prev_head(end, start);
-	if (ea == BADADDR)
-		return;
-	else
+	if (stats.noRetLookups)
 	{
-		ea_t endSave = end;
-
-		while (ea >= start)
-		{
-			flags64_t flags = get_full_flags(ea);
-			if (isAlignByte(flags) || is_align(flags))
-			{
-				ea = prev_head(ea, start);
-				if (ea == BADADDR)
-					return;
-			}
-			else
-			{
-				end = next_head(ea, end);
-				// Can fail in some odd circumstances, so reset it back to whole gap size
-				if (end == BADADDR)
-					end = endSave;
-				break;
-			}
-		};
+		msg("No-return callees: %s", NumberCommaString(stats.noRetCallees, buffer));
+		msg(", trailing call lookups: %s", NumberCommaString(stats.noRetLookups, buffer));
+		msg(", hits: %s\n", NumberCommaString(stats.noRetHits, buffer));
+	}
+	if (stats.pass5Considered || stats.pass5Skipped)
+	{
+		msg("Non-contiguous function candidates: %s", NumberCommaString(stats.pass5Considered, buffer));
+		msg(", functions skipped without tails: %s\n", NumberCommaString(stats.pass5Skipped, buffer));
+	}
+	if (stats.tailsIndexed)
+	{
+		msg("Tail chunks indexed: %s", NumberCommaString(stats.tailsIndexed, buffer));
+		msg(", jump targets looked up outside the index: %s\n", NumberCommaString(stats.tailIndexMisses, buffer));
+	}
+	if (stats.multiTailFuncs)
+	{
+		msg("Multi-tail functions: %s", NumberCommaString(stats.multiTailFuncs, buffer));
+		msg(", shared tails made functions: %s", NumberCommaString(stats.multiTailFixes, buffer));
+		msg(", skipped: %s\n", NumberCommaString(stats.flowSkipped, buffer));
+		msg("Flow charts built: %s", NumberCommaString(stats.flowCharts, buffer));
+		msg(", cache hits: %s, took %s.\n", NumberCommaString(stats.flowCacheHits, buffer), TimeString(s_passes.flowTime()));
+	}
+	if (stats.gapsLeft)
+	{
+		msg("Missing functions time limit reached, gaps left: %s", NumberCommaString(stats.gapsLeft, buffer));
+		msg(", bytes: %s\n", NumberCommaString(stats.gapBytesLeft, buffer));
 	}
 
+	if (stats.xrefLookupsSaved)
+		msg("Align block xref lookups avoided: %s\n", NumberCommaString(stats.xrefLookupsSaved, buffer));
 
-    // Traverse gap
-	ea_t codeStart = BADADDR;
-	ea = start;
-
-    while(ea < end)
-    {
-		// Info flags for this address
-		flags64_t flags = get_full_flags(ea);
-		#ifdef LOG_FILE
-		Log(s_logFile, "  C: %llX, F: %08X, \"%s\".\n", ea, flags, getDisasmText(ea));
-		#endif
-		#ifdef VBDEV
-		qstring disStr;
-		getDisasmText(ea, disStr);
-		msg(" C: %llX, F: %08X, \"%s\".\n", ea, flags, disStr.c_str());
-		#endif
-
-		if(ea < start)
-		{
-			#ifdef LOG_FILE
-			Log(s_logFile, "**** Out of start range! %llX %llX %llX ****\n", ea, start, end);
-			#endif
-			return;
-		}
-        else
-		if(ea > end)
-		{
-			#ifdef LOG_FILE
-			Log(s_logFile, "**** Out of end range! %llX %llX %llX ****\n", ea, start, end);
-			#endif
-			return;
-		}
-
-		// Skip over "align" blocks.
-		// #1 we will typically see more of these then anything else
-		if(isAlignByte(flags) || is_align(flags))
-		{
-			// Function between code start?
-			if((codeStart != BADADDR) && IS_ALIGNED(codeStart))
-			{
-				#ifdef LOG_FILE
-				Log(s_logFile, "  %llX Trying function #1\n", codeStart);
-				#endif
-				#ifdef VBDEV
-				msg(">%llX Trying function #1\n", codeStart);
-				#endif
-
-				tryFunction(codeStart, end, ea);
-				codeStart = BADADDR;
-			}
-		}
-		else
-		// #2 case, we'll typically see data
-		if(isData(flags))
-		{
-			// Function between code start?
-			if((codeStart != BADADDR) && IS_ALIGNED(codeStart))
-			{
-				#ifdef LOG_FILE
-				Log(s_logFile, "  %llX Trying function #2\n", codeStart);
-				#endif
-				#ifdef VBDEV
-				msg(">%llX Trying function #2\n", codeStart);
-				#endif
-
-				tryFunction(codeStart, end, ea);
-				codeStart = BADADDR;
-			}
-		}
-		else
-		// Hit some code?
-		if(is_code(flags))
-		{
-			// Yes, mark the start of a possible code block
-			if(codeStart == BADADDR)
-			{
-				codeStart = ea;
-
-				#ifdef LOG_FILE
-				Log(s_logFile, "  %llX Trying function #3, assumed func start\n", codeStart);
-				#endif
-				#ifdef VBDEV
-				msg(">%llX Trying function #3, assumed func start\n", codeStart);
-				#endif
+	if (stats.nopPadBytes || stats.gapNopBytes)
+	{
+		msg("Multi-byte NOP padding bytes aligned: %s", NumberCommaString(stats.nopPadBytes, buffer));
+		msg(", recognized in function gaps: %s\n", NumberCommaString(stats.gapNopBytes, buffer));
+	}
 
-				if (IS_ALIGNED(codeStart))
-				{
-					if (tryFunction(codeStart, end, ea))
-						codeStart = BADADDR;
-				}
-			}
-		}
-		else
-		// Undefined?
-		// Usually 0xCC align bytes
-		if(is_unknown(flags))
-		{
-			#ifdef LOG_FILE
-			Log(s_logFile, "  C: %llX, Unknown type.\n", ea);
-			#endif
-			#ifdef VBDEV
-			msg("  C: %llX, Unknown type.\n", ea);
-			#endif
-
-			codeStart = BADADDR;
-		}
-		else
-		{
-			#ifdef LOG_FILE
-			Log(s_logFile, "  %llX ** unknown data type! **\n", ea);
-			#endif
-			#ifdef VBDEV
-			msg("  %llX ** unknown data type! **\n", ea);
-			#endif
-
-			codeStart = BADADDR;
-		}
+	if (stats.pass1Sweeps)
+	{
+		msg("Unknown data sweeps: %u, items revisited: %s\n", stats.pass1Sweeps, NumberCommaString(stats.pass1Revisits, buffer));
+		msg("Unknown data analysis waits saved: %s\n", NumberCommaString(stats.pass1WaitsSaved, buffer));
+		msg("Unknown data ref decode cache hits: %u, misses: %u\n", stats.refCacheHits, stats.refCacheMisses);
+	}
 
-		// Next item
-		auto_wait();
-		ea_t nextEa = BADADDR;
-		if(ea != BADADDR)
+	for (size_t i = 0; i < s_pipeline.stageCount(); i++)
+	{
+		const PipelineStage &stage = s_pipeline.stage(i);
+		if (stage.runs)
 		{
-			nextEa = next_head(ea, end);
-			if(nextEa != BADADDR)
-				ea = nextEa;
+			msg("Stage %s: runs: %u", stage.name.c_str(), stage.runs);
+			msg(", steps: %s, took %s.\n", NumberCommaString(stage.steps, buffer), TimeString(stage.time));
 		}
+	}
 
-		if((nextEa == BADADDR) || (ea == BADADDR))
-		{
-			// If have code and at the end, try a function from the start
-			if ((codeStart != BADADDR) && IS_ALIGNED(codeStart))
-			{
-				#ifdef LOG_FILE
-				Log(s_logFile, "  %llX Trying function #4\n", codeStart);
-				#endif
-				#ifdef VBDEV
-				msg(">%llX Trying function #4\n", codeStart);
-				#endif
-
-				tryFunction(codeStart, end, ea);
-				auto_wait();
-			}
-
-			#ifdef LOG_FILE
-			Log(s_logFile, " Gap end: %llX.\n", ea);
-			#endif
-			#ifdef VBDEV
-			msg(" Gap end: %llX.\n", ea);
-			#endif
-
-            break;
-		}
+	if (s_timer)
+	{
+		// Scheduling cost, time given to the UI between slices
+		TIMESTAMP now = GetTimeStamp();
+		TIMESTAMP work = (s_sliceWork + (now - s_sliceStart));
+		msg("Time slices: %s of %d ms", NumberCommaString(s_sliceCount, buffer), (int) s_timeSlice);
+		msg(", running %s", TimeString(work));
+		msg(" of %s", TimeString(now - s_runStart));
+		msg(", UI turns averaged %.1f ms", ((s_sliceCount > 1) ? ((s_sliceIdle * 1000.0) / (s_sliceCount - 1)) : 0.0));
+		msg(", longest step %.1f ms (%s).\n", (s_longestStep * 1000.0), s_longestStage.c_str());
+	}
 
-    }; // while(ea < start)
+	msg("Took %s in total.\n", TimeString(GetTimeStamp() - s_startTime));
+	msg(" \n");
+	refresh_idaview_anyway();
 }
 
-
-// Process suspected bad tail block, non-contiguous, function
-//#define PROCESSFUNC_DEBUG
-static void processFunc(func_t *f)
+// Batch summary counters, every PassStats one but the histograms and gapBytesLeft written after them
+static const struct
 {
-	const int MAX_INST_COUNT = 16;
-
-	// We're looking for a code pattern that:
-	// 1) At least 2 and up to MAX_INST_COUNT instructions max for the entry chunk
-	// 2) Has a single direct JMP to a tail block
-
-	int instsToJmp = 0;
-	ea_t jmpAddr = BADADDR;
-	ea_t ea = f->start_ea;
+	const char *name;
+	unsigned int PassStats::*field;
+} summaryStats[] =
+{
+	{ "unknownDataCount", &PassStats::unknownDataCount },
+	{ "alignFixes", &PassStats::alignFixes },
+	{ "codeFixes", &PassStats::codeFixes },
+	{ "tailBlckRefFixes", &PassStats::tailBlckRefFixes },
+	{ "pass1Sweeps", &PassStats::pass1Sweeps },
+	{ "pass1Revisits", &PassStats::pass1Revisits },
+	{ "pass1WaitsSaved", &PassStats::pass1WaitsSaved },
+	{ "refCacheHits", &PassStats::refCacheHits },
+	{ "refCacheMisses", &PassStats::refCacheMisses },
+	{ "nopPadBytes", &PassStats::nopPadBytes },
+	{ "gapNopBytes", &PassStats::gapNopBytes },
+	{ "xrefLookupsSaved", &PassStats::xrefLookupsSaved },
+	{ "pass3Runs", &PassStats::pass3Runs },
+	{ "pass3Creates", &PassStats::pass3Creates },
+	{ "pass3Skipped", &PassStats::pass3Skipped },
+	{ "insnCreatesAvoided", &PassStats::insnCreatesAvoided },
+	{ "funcAddsAvoided", &PassStats::funcAddsAvoided },
+	{ "gapCount", &PassStats::gapCount },
+	{ "gapsSkipped", &PassStats::gapsSkipped },
+	{ "prologueHits", &PassStats::prologueHits },
+	{ "prologueFuncs", &PassStats::prologueFuncs },
+	{ "noRetCallees", &PassStats::noRetCallees },
+	{ "noRetLookups", &PassStats::noRetLookups },
+	{ "noRetHits", &PassStats::noRetHits },
+	{ "tailsIndexed", &PassStats::tailsIndexed },
+	{ "tailIndexMisses", &PassStats::tailIndexMisses },
+	{ "pass5Considered", &PassStats::pass5Considered },
+	{ "pass5Skipped", &PassStats::pass5Skipped },
+	{ "multiTailFuncs", &PassStats::multiTailFuncs },
+	{ "flowCharts", &PassStats::flowCharts },
+	{ "flowCacheHits", &PassStats::flowCacheHits },
+	{ "flowSkipped", &PassStats::flowSkipped },
+	{ "multiTailFixes", &PassStats::multiTailFixes },
+	{ "gapsLeft", &PassStats::gapsLeft },
+};
 
-	for (; instsToJmp <= MAX_INST_COUNT; ++instsToJmp)
+// Write a JSON string value
+static void jsonString(FILE *fp, const char *text)
+{
+	qfputc('"', fp);
+	for (const char *p = text; *p; p++)
 	{
-		insn_t cmd;
-		if (decode_insn(&cmd, ea))
-		{
-			// Is it a non-conditional jump?
-			if (cmd.itype == NN_jmp)
-			{
-				if (jmpAddr == BADADDR)
-					jmpAddr = ea;
-				else
-				{
-					// Already seen a jump, bail out
-					jmpAddr = BADADDR;
-					break;
-				}
-			}
-
-			// Next instruction									
-			ea = next_head(ea, f->end_ea);
-
-			// End of the entry part reached
-			if (ea == BADADDR)
-				break;
-		}
+		if ((*p == '"') || (*p == '\\'))
+			qfprintf(fp, "\\%c", *p);
 		else
-		{
-			#ifdef PROCESSFUNC_DEBUG
-			msg("%llX bad instruction decode.\n", ea);
-			#endif
-			jmpAddr = BADADDR;
-			break;
-		}
-
+		if ((unsigned char) *p < ' ')
+			qfprintf(fp, "\\u%04X", (unsigned char) *p);
+		else
+			qfputc(*p, fp);
 	}
+	qfputc('"', fp);
+}
 
-	if ((jmpAddr != BADADDR) && (ea == BADADDR) && (instsToJmp >= 1))
+// Write the batch run summary, JSON
+static void writeSummary()
+{
+	FILE *fp = qfopen(s_summaryPath.c_str(), "wb");
+	if (!fp)
 	{
-		// Analise the jump target..
-		insn_t cmd;
-		if (decode_insn(&cmd, jmpAddr))
-		{
-			ea_t jmpTarget = cmd.ops[0].addr;
-			flags64_t flags = get_flags(jmpTarget);
-
-			// Skip if already a function, happens in odd cases but more likely we processed it's tail already
-			// Also should be code and have xrefs
-			if (!is_func(flags) && is_code(flags) && has_xref(flags))
-			{							
-				int xrefMinCount = 0;
-				xrefblk_t xb;
-				if (xb.first_to(jmpTarget, XREF_ALL))
-				{
-					do 
-					{ 
-						xrefMinCount++; 
-					} while (xb.next_to());
-				}
-
-				// Limit to those that more than one reference, or with only two instructions
-				// Somewhat contentious as there is still a good chance the target should be function still with just one xref still.
-				// But then the main reason to fix these is because of the ambiguity, much less of a problem for following/other function
-				// analysis tools.
-				if ((instsToJmp == 1) || (xrefMinCount > 1))
-				{
-					#ifdef PROCESSFUNC_DEBUG
-					qstring tmp;
-					idaFlags2String(flags, tmp);
-					static int tailFixCount = 0;
-					msg(" %llX %llX [%d] JMP refs: %d, inst2j: %d (%s)\n", jmpAddr, jmpTarget, tailFixCount++, xrefMinCount, instsToJmp, tmp.c_str());
-					#endif
-				
-					// Attempt to remove all function tail refs
-					xrefblk_t xb;
-					if (xb.first_to(jmpTarget, XREF_ALL))
-					{
-						do
-						{
-							if (xb.iscode)
-							{
-								s_tailBlckRefFixes++;
-
-								if (func_t *rf = get_func(xb.from))
-								{
-									if (!remove_func_tail(rf, jmpTarget))
-									{
-										#ifdef PROCESSFUNC_DEBUG										
-										msg("  %llX %llX ** remove_func_tail() failed! **\n", xb.from, jmpTarget);
-										#endif
-									}									
-								}
-								else
-								{
-									// Usually where IDA totally gets a function body wrong, or other odd cases where there is a undeclared function inside another function body
-									// Not a problem here since it doesn't cause the add_func() to fail.
-									// #TODO: This would be a good one to report back to the user as a problem area with SHOW_PROBLEMS on
-									#ifdef PROCESSFUNC_DEBUG
-									msg("  %llX %llX ** no function **\n", xb.from, jmpTarget);
-									#endif
-								}
-							}
-
-						} while (xb.next_to());
-					}
+		msg("** Summary file \"%s\" open failed! **\n", s_summaryPath.c_str());
+		return;
+	}
 
-					// Attempt to convert the former tail block init to a function
-					if (!add_func(jmpTarget, BADADDR))
-					{
-						#ifdef PROCESSFUNC_DEBUG
-						msg("  %llX ** add_func() failed! **\n", jmpTarget);
-						#endif
-					}
-				}
-			}
-		}
+	qstring version;
+	qfprintf(fp, "{\n  \"version\": ");
+	jsonString(fp, GetVersionString(MY_VERSION, version).c_str());
+	qfprintf(fp, ",\n  \"database\": ");
+	jsonString(fp, get_path(PATH_TYPE_IDB));
+	qfprintf(fp, ",\n  \"status\": \"%s\",\n", s_batchStatus);
+	qfprintf(fp, "  \"resumed\": %s,\n", (s_resumed ? "true" : "false"));
+	qfprintf(fp, "  \"startFunctions\": %d,\n", s_startFuncCount);
+	qfprintf(fp, "  \"endFunctions\": %d,\n", (int) get_func_qty());
+	qfprintf(fp, "  \"seconds\": %.3f,\n", (s_runStart ? (GetTimeStamp() - s_runStart) : 0.0));
+
+	const PassStats &stats = s_passes.stats;
+	qfprintf(fp, "  \"stats\": {");
+	for (size_t i = 0; i < _countof(summaryStats); i++)
+		qfprintf(fp, "%s\n    \"%s\": %u", (i ? "," : ""), summaryStats[i].name, stats.*summaryStats[i].field);
+	qfprintf(fp, ",\n    \"gapBytesLeft\": %llu", stats.gapBytesLeft);
+	qfprintf(fp, ",\n    \"alignHistogram\": [");
+	for (int i = 0; i < ALIGN_HISTOGRAM_SIZE; i++)
+		qfprintf(fp, "%s%u", (i ? ", " : ""), stats.alignHistogram[i]);
+	qfprintf(fp, "],\n    \"gapHistogram\": [");
+	for (int i = 0; i < GAP_HISTOGRAM_SIZE; i++)
+		qfprintf(fp, "%s%u", (i ? ", " : ""), stats.gapHistogram[i]);
+	qfprintf(fp, "]\n  },\n");
+
+	qfprintf(fp, "  \"stages\": [");
+	for (size_t i = 0, count = 0; i < s_pipeline.stageCount(); i++)
+	{
+		const PipelineStage &stage = s_pipeline.stage(i);
+		if (stage.runs)
+			qfprintf(fp, "%s\n    { \"name\": \"%s\", \"runs\": %u, \"steps\": %llu, \"seconds\": %.3f }", (count++ ? "," : ""), stage.name.c_str(), stage.runs, stage.steps, stage.time);
 	}
+	qfprintf(fp, "\n  ]\n}\n");
+	qfclose(fp);
+	msg("Summary written to \"%s\".\n", s_summaryPath.c_str());
 }
 
 // ============================================================================
@@ -1718,7 +1210,7 @@ const char PLUGIN_NAME[] = "ExtraPass";
 __declspec(dllexport) plugin_t PLUGIN =
 {
 	IDP_INTERFACE_VERSION,	// IDA version plug-in is written for
-	PLUGIN_UNL,				// Plug-in flags
+	0,						// Plug-in flags, stays loaded since a time sliced run continues after run() returns
 	init,					// Initialization function
 	term,					// Clean-up function
 	run,					// Main plug-in body
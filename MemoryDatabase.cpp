@@ -0,0 +1,670 @@
+
+// In-memory database stand-in
+#include "MemoryDatabase.h"
+#include "X86Decode.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace DbFlags;
+
+// Bits kept across item changes
+static const unsigned int KEEP_MASK = (unsigned int) FF_REF;
+#define FUNC_TAIL_FLAG 0x00008000 // SDK FUNC_TAIL
+
+MemoryDatabase::MemoryDatabase(ea_t base, const void *bytes, size_t size, bool is64) : m_base(base), m_end(base + size), m_is64(is64), m_quiet(false),
+	m_bytes((const unsigned char *) bytes, ((const unsigned char *) bytes) + size), m_flags(size, 0), m_funcOrderDirty(false)
+{
+}
+
+// ---- Image setup ----
+
+bool MemoryDatabase::makeCode(ea_t ea)
+{
+	if (!inRange(ea))
+		return false;
+	InsnInfo insn;
+	if (!decodeInsn(ea, insn) || !isRangeUnknown(ea, insn.size))
+		return false;
+
+	setItem(ea, insn.size, (unsigned int) FF_CODE);
+	ea_t prev = prevHead(ea, m_base);
+	InsnInfo prevInsn;
+	if ((prev != BADADDR) && flowsToNext(prev, prevInsn) && ((prev + prevInsn.size) == ea))
+		flagsAt(ea) |= (unsigned int) FF_FLOW;
+	if ((insn.target != BADADDR) && ((insn.iclass == IC_JMP) || (insn.iclass == IC_JCC) || (insn.iclass == IC_CALL)))
+		addCref(ea, insn.target);
+	return true;
+}
+
+bool MemoryDatabase::makeData(ea_t ea, size_t size, flags64_t dataType)
+{
+	if (!size || !inRange(ea) || !inRange(ea + size - 1) || !isRangeUnknown(ea, size))
+		return false;
+	setItem(ea, size, (unsigned int) (FF_DATA | (dataType & DT_TYPE)));
+	return true;
+}
+
+void MemoryDatabase::setOperandOffset(ea_t ea, int n)
+{
+	if (inRange(ea))
+		flagsAt(ea) |= (unsigned int) ((n == 0) ? FF_0OFF : FF_1OFF);
+}
+
+void MemoryDatabase::addXref(XrefMap &fromMap, XrefMap &toMap, ea_t from, ea_t to)
+{
+	fromMap[from].push_back(to);
+	toMap[to].push_back(from);
+	if (inRange(to))
+		flagsAt(to) |= (unsigned int) FF_REF;
+}
+
+void MemoryDatabase::addCref(ea_t from, ea_t to) { addXref(m_crefFrom, m_crefTo, from, to); }
+void MemoryDatabase::addDref(ea_t from, ea_t to) { addXref(m_drefFrom, m_drefTo, from, to); }
+
+bool MemoryDatabase::defineFunc(ea_t start, ea_t end, unsigned long long flags)
+{
+	if ((end <= start) || !inRange(start) || (end > m_end))
+		return false;
+	FuncInfo fi;
+	if (getFuncChunk(start, fi))
+		return false;
+
+	Func f = { end, flags, std::vector<ea_t>() };
+	m_funcs[start] = f;
+	Chunk c = { end, start };
+	m_chunks[start] = c;
+	if (is_code(flagsAt(start)))
+		flagsAt(start) |= (unsigned int) FF_FUNC;
+	m_funcOrderDirty = true;
+	return true;
+}
+
+bool MemoryDatabase::appendFuncTail(ea_t funcEA, ea_t start, ea_t end)
+{
+	std::map<ea_t, Func>::iterator it = m_funcs.find(funcEA);
+	FuncInfo fi;
+	if ((it == m_funcs.end()) || (end <= start) || !inRange(start) || (end > m_end) || getFuncChunk(start, fi))
+		return false;
+
+	it->second.tails.push_back(start);
+	Chunk c = { end, funcEA };
+	m_chunks[start] = c;
+	return true;
+}
+
+void MemoryDatabase::setName(ea_t ea, const char *name) { m_names[ea] = name; }
+
+// ---- Internal helpers ----
+
+ea_t MemoryDatabase::itemHead(ea_t ea)
+{
+	while ((ea > m_base) && is_tail(flagsAt(ea)))
+		ea--;
+	return ea;
+}
+
+bool MemoryDatabase::isRangeUnknown(ea_t ea, size_t size)
+{
+	if (!inRange(ea) || ((ea + size) > m_end))
+		return false;
+	const unsigned int *f = &m_flags[(size_t) (ea - m_base)];
+	for (size_t i = 0; i < size; i++)
+	{
+		if (!is_unknown(f[i]))
+			return false;
+	}
+	return true;
+}
+
+void MemoryDatabase::setItem(ea_t ea, size_t size, unsigned int headFlags)
+{
+	unsigned int *f = &m_flags[(size_t) (ea - m_base)];
+	f[0] = ((f[0] & KEEP_MASK) | headFlags);
+	for (size_t i = 1; i < size; i++)
+		f[i] = ((f[i] & KEEP_MASK) | (unsigned int) FF_TAIL);
+}
+
+void MemoryDatabase::removeXrefsFrom(ea_t ea)
+{
+	XrefMap *maps[2][2] = { { &m_crefFrom, &m_crefTo }, { &m_drefFrom, &m_drefTo } };
+	for (int m = 0; m < 2; m++)
+	{
+		XrefMap::iterator it = maps[m][0]->find(ea);
+		if (it == maps[m][0]->end())
+			continue;
+
+		for (size_t i = 0; i < it->second.size(); i++)
+		{
+			ea_t to = it->second[i];
+			XrefMap::iterator tt = maps[m][1]->find(to);
+			if (tt != maps[m][1]->end())
+			{
+				std::vector<ea_t> &v = tt->second;
+				v.erase(std::remove(v.begin(), v.end(), ea), v.end());
+				if (v.empty())
+					maps[m][1]->erase(tt);
+			}
+
+			if (inRange(to) && (m_crefTo.find(to) == m_crefTo.end()) && (m_drefTo.find(to) == m_drefTo.end()))
+				flagsAt(to) &= ~(unsigned int) FF_REF;
+		}
+		maps[m][0]->erase(it);
+	}
+}
+
+// Returns true if the instruction at 'ea' is code that falls through to the next one
+bool MemoryDatabase::flowsToNext(ea_t ea, InsnInfo &insn)
+{
+	if (!inRange(ea) || !is_code(flagsAt(ea)) || !decodeInsn(ea, insn))
+		return false;
+	switch (insn.iclass)
+	{
+		case IC_RET: case IC_JMP: case IC_JMP_OTHER: case IC_INT3:
+		return false;
+		default:
+		return true;
+	};
+}
+
+void MemoryDatabase::fillFuncInfo(ea_t start, const Func &f, FuncInfo &fi)
+{
+	fi.startEA = start;
+	fi.endEA = f.endEA;
+	fi.flags = f.flags;
+	fi.tailQty = (int) f.tails.size();
+	fi.owner = start;
+}
+
+const std::vector<ea_t> &MemoryDatabase::funcOrder()
+{
+	if (m_funcOrderDirty)
+	{
+		m_funcOrder.clear();
+		m_funcOrder.reserve(m_funcs.size());
+		for (std::map<ea_t, Func>::const_iterator it = m_funcs.begin(); it != m_funcs.end(); ++it)
+			m_funcOrder.push_back(it->first);
+		m_funcOrderDirty = false;
+	}
+	return m_funcOrder;
+}
+
+// ---- Bytes and flags ----
+
+flags64_t MemoryDatabase::getFlags(ea_t ea)
+{
+	return(inRange(ea) ? (flagsAt(ea) | FF_IVL) : 0);
+}
+
+flags64_t MemoryDatabase::getFullFlags(ea_t ea)
+{
+	return(inRange(ea) ? (flagsAt(ea) | FF_IVL | m_bytes[(size_t) (ea - m_base)]) : 0);
+}
+
+unsigned char MemoryDatabase::getByte(ea_t ea)
+{
+	return(inRange(ea) ? m_bytes[(size_t) (ea - m_base)] : 0xFF);
+}
+
+size_t MemoryDatabase::getBytes(ea_t ea, void *buffer, size_t size)
+{
+	if (!inRange(ea))
+		return 0;
+	size = std::min(size, (size_t) (m_end - ea));
+	memcpy(buffer, &m_bytes[(size_t) (ea - m_base)], size);
+	return size;
+}
+
+size_t MemoryDatabase::getItemSize(ea_t ea)
+{
+	if (!inRange(ea))
+		return 1;
+	ea = itemHead(ea);
+	if (!is_head(flagsAt(ea)))
+		return 1;
+	ea_t end = (ea + 1);
+	while ((end < m_end) && is_tail(flagsAt(end)))
+		end++;
+	return (size_t) (end - ea);
+}
+
+// ---- Item navigation ----
+
+ea_t MemoryDatabase::nextHead(ea_t ea, ea_t maxEA)
+{
+	maxEA = std::min(maxEA, m_end);
+	for (ea = std::max(ea + 1, m_base); ea < maxEA; ea++)
+	{
+		if (is_head(flagsAt(ea)))
+			return ea;
+	}
+	return BADADDR;
+}
+
+ea_t MemoryDatabase::prevHead(ea_t ea, ea_t minEA)
+{
+	minEA = std::max(minEA, m_base);
+	ea = std::min(ea, m_end);
+	while (ea > minEA)
+	{
+		ea--;
+		if (is_head(flagsAt(ea)))
+			return ea;
+	}
+	return BADADDR;
+}
+
+ea_t MemoryDatabase::nextAddr(ea_t ea)
+{
+	return(((ea + 1) < m_end) ? std::max(ea + 1, m_base) : BADADDR);
+}
+
+ea_t MemoryDatabase::nextUnknown(ea_t ea, ea_t maxEA)
+{
+	maxEA = std::min(maxEA, m_end);
+	for (ea = std::max(ea + 1, m_base); ea < maxEA; ea++)
+	{
+		if (is_unknown(flagsAt(ea)))
+			return ea;
+	}
+	return BADADDR;
+}
+
+ea_t MemoryDatabase::nextThat(ea_t ea, ea_t maxEA, testflags_t testf, void *ud)
+{
+	maxEA = std::min(maxEA, m_end);
+	for (ea = std::max(ea + 1, m_base); ea < maxEA; ea++)
+	{
+		if (testf(getFullFlags(ea), ud))
+			return ea;
+	}
+	return BADADDR;
+}
+
+// ---- Item creation ----
+
+bool MemoryDatabase::delItems(ea_t ea, size_t size)
+{
+	if (!inRange(ea))
+		return false;
+	ea_t end = std::min((ea + size), m_end);
+	for (ea = itemHead(ea); ea < end;)
+	{
+		unsigned int f = flagsAt(ea);
+		if (is_head(f))
+		{
+			size_t itemSize = getItemSize(ea);
+			if (is_code(f))
+				removeXrefsFrom(ea);
+			for (size_t i = 0; i < itemSize; i++)
+				flagsAt(ea + i) &= KEEP_MASK;
+			ea += itemSize;
+		}
+		else
+		{
+			flagsAt(ea) &= KEEP_MASK;
+			ea++;
+		}
+	}
+	return true;
+}
+
+bool MemoryDatabase::createByte(ea_t ea, size_t size)
+{
+	return makeData(ea, size, FF_BYTE);
+}
+
+bool MemoryDatabase::createAlign(ea_t ea, size_t size)
+{
+	return makeData(ea, size, FF_ALIGN);
+}
+
+int MemoryDatabase::createInsn(ea_t ea)
+{
+	if (!inRange(ea))
+		return 0;
+	if (is_code(flagsAt(ea)))
+		return (int) getItemSize(ea);
+	if (!makeCode(ea))
+		return 0;
+
+	// Queue up the flow for auto-analysis
+	InsnInfo insn;
+	decodeInsn(ea, insn);
+	if ((insn.iclass != IC_RET) && (insn.iclass != IC_JMP) && (insn.iclass != IC_JMP_OTHER) && (insn.iclass != IC_INT3))
+		m_queue.push_back(ea + insn.size);
+	if ((insn.target != BADADDR) && ((insn.iclass == IC_JMP) || (insn.iclass == IC_JCC)))
+		m_queue.push_back(insn.target);
+	return insn.size;
+}
+
+bool MemoryDatabase::decodeInsn(ea_t ea, InsnInfo &insn)
+{
+	if (!inRange(ea))
+		return false;
+	size_t offset = (size_t) (ea - m_base);
+	size_t avail = std::min((size_t) 16, (m_bytes.size() - offset));
+	return(x86Decode(&m_bytes[offset], avail, ea, m_is64, insn) > 0);
+}
+
+// ---- Cross references ----
+
+ea_t MemoryDatabase::firstCrefFrom(ea_t ea)
+{
+	// Ordinary flow first
+	InsnInfo insn;
+	if (flowsToNext(ea, insn) && inRange(ea + insn.size))
+		return(ea + insn.size);
+	XrefMap::const_iterator it = m_crefFrom.find(ea);
+	return((it != m_crefFrom.end()) ? it->second.front() : BADADDR);
+}
+
+ea_t MemoryDatabase::firstCrefTo(ea_t ea)
+{
+	if (inRange(ea) && (flagsAt(ea) & FF_FLOW))
+	{
+		ea_t prev = prevHead(ea, m_base);
+		if (prev != BADADDR)
+			return prev;
+	}
+	XrefMap::const_iterator it = m_crefTo.find(ea);
+	return((it != m_crefTo.end()) ? it->second.front() : BADADDR);
+}
+
+ea_t MemoryDatabase::firstDrefFrom(ea_t ea)
+{
+	XrefMap::const_iterator it = m_drefFrom.find(ea);
+	return((it != m_drefFrom.end()) ? it->second.front() : BADADDR);
+}
+
+ea_t MemoryDatabase::firstDrefTo(ea_t ea)
+{
+	XrefMap::const_iterator it = m_drefTo.find(ea);
+	return((it != m_drefTo.end()) ? it->second.front() : BADADDR);
+}
+
+size_t MemoryDatabase::getXrefsTo(ea_t ea, std::vector<XrefInfo> &xrefs)
+{
+	xrefs.clear();
+	if (inRange(ea) && (flagsAt(ea) & FF_FLOW))
+	{
+		XrefInfo xi = { prevHead(ea, m_base), true };
+		xrefs.push_back(xi);
+	}
+
+	XrefMap::const_iterator it = m_crefTo.find(ea);
+	if (it != m_crefTo.end())
+	{
+		for (size_t i = 0; i < it->second.size(); i++)
+		{
+			XrefInfo xi = { it->second[i], true };
+			xrefs.push_back(xi);
+		}
+	}
+	it = m_drefTo.find(ea);
+	if (it != m_drefTo.end())
+	{
+		for (size_t i = 0; i < it->second.size(); i++)
+		{
+			XrefInfo xi = { it->second[i], false };
+			xrefs.push_back(xi);
+		}
+	}
+	return xrefs.size();
+}
+
+// ---- Functions ----
+
+size_t MemoryDatabase::getFuncQty() { return m_funcs.size(); }
+
+bool MemoryDatabase::getnFunc(size_t n, FuncInfo &fi)
+{
+	const std::vector<ea_t> &order = funcOrder();
+	if (n >= order.size())
+		return false;
+	fillFuncInfo(order[n], m_funcs[order[n]], fi);
+	return true;
+}
+
+bool MemoryDatabase::getFunc(ea_t ea, FuncInfo &fi)
+{
+	FuncInfo chunk;
+	if (!getFuncChunk(ea, chunk))
+		return false;
+	fillFuncInfo(chunk.owner, m_funcs[chunk.owner], fi);
+	return true;
+}
+
+bool MemoryDatabase::getFuncChunk(ea_t ea, FuncInfo &fi)
+{
+	std::map<ea_t, Chunk>::const_iterator it = m_chunks.upper_bound(ea);
+	if (it == m_chunks.begin())
+		return false;
+	--it;
+	if (ea >= it->second.endEA)
+		return false;
+
+	if (it->second.owner == it->first)
+		fillFuncInfo(it->first, m_funcs[it->first], fi);
+	else
+	{
+		fi.startEA = it->first;
+		fi.endEA = it->second.endEA;
+		fi.flags = FUNC_TAIL_FLAG;
+		fi.tailQty = 0;
+		fi.owner = it->second.owner;
+	}
+	return true;
+}
+
+bool MemoryDatabase::nextFuncChunk(ea_t ea, FuncInfo &fi)
+{
+	std::map<ea_t, Chunk>::const_iterator it = m_chunks.lower_bound(ea);
+	if (it == m_chunks.end())
+		return false;
+	return getFuncChunk(it->first, fi);
+}
+
+// Tails only have the one owner here
+size_t MemoryDatabase::getTailReferers(ea_t tailEA, std::vector<ea_t> &referers)
+{
+	referers.clear();
+	std::map<ea_t, Chunk>::const_iterator it = m_chunks.find(tailEA);
+	if ((it != m_chunks.end()) && (it->second.owner != it->first))
+		referers.push_back(it->second.owner);
+	return referers.size();
+}
+
+// Linear sweep of the flow from 'start' until it ends with no pending forward branches
+bool MemoryDatabase::addFunc(ea_t start, ea_t end)
+{
+	FuncInfo fi;
+	if (!inRange(start) || getFuncChunk(start, fi))
+		return false;
+	if (is_unknown(flagsAt(start)))
+	{
+		createInsn(start);
+		autoWait();
+	}
+	if (!is_code(flagsAt(start)))
+		return false;
+
+	ea_t limit = std::min(end, m_end);
+	std::map<ea_t, Chunk>::const_iterator next = m_chunks.upper_bound(start);
+	if ((next != m_chunks.end()) && (next->first < limit))
+		limit = next->first;
+
+	ea_t ea = start, pending = start;
+	while (ea < limit)
+	{
+		if (is_unknown(flagsAt(ea)))
+		{
+			createInsn(ea);
+			autoWait();
+		}
+		if (!is_code(flagsAt(ea)))
+			break;
+
+		InsnInfo insn;
+		if (!decodeInsn(ea, insn))
+			break;
+		ea_t nextEa = (ea + insn.size);
+		if (((insn.iclass == IC_JCC) || (insn.iclass == IC_JMP)) && (insn.target > ea) && (insn.target < limit))
+			pending = std::max(pending, insn.target);
+		ea = nextEa;
+
+		if ((insn.iclass == IC_RET) || (insn.iclass == IC_JMP) || (insn.iclass == IC_JMP_OTHER) || (insn.iclass == IC_INT3))
+		{
+			if (pending < ea)
+				break;
+			// Skip padding up to the next branch target
+			while ((ea < pending) && !is_code(flagsAt(ea)))
+				ea++;
+		}
+	}
+	if (ea <= start)
+		return false;
+
+	return defineFunc(start, std::min(ea, limit));
+}
+
+bool MemoryDatabase::removeFuncTail(ea_t funcEA, ea_t tailEA)
+{
+	FuncInfo f, fi;
+	if (!getFunc(funcEA, f) || !getFuncChunk(tailEA, fi) || (fi.owner == fi.startEA) || (fi.owner != f.startEA))
+		return false;
+
+	std::map<ea_t, Func>::iterator it = m_funcs.find(fi.owner);
+	if (it == m_funcs.end())
+		return false;
+	std::vector<ea_t> &tails = it->second.tails;
+	tails.erase(std::remove(tails.begin(), tails.end(), fi.startEA), tails.end());
+	m_chunks.erase(fi.startEA);
+	return true;
+}
+
+// Basic blocks of the function's chunks, split at branches and the branch targets inside the function
+bool MemoryDatabase::getFlowChart(ea_t funcEA, size_t maxBlocks, std::vector<FlowBlock> &blocks)
+{
+	blocks.clear();
+	FuncInfo f;
+	if (!getFunc(funcEA, f))
+		return false;
+
+	std::vector<std::pair<ea_t, ea_t> > chunks;
+	chunks.push_back(std::make_pair(f.startEA, f.endEA));
+	const Func &func = m_funcs[f.startEA];
+	for (size_t i = 0; i < func.tails.size(); i++)
+		chunks.push_back(std::make_pair(func.tails[i], m_chunks[func.tails[i]].endEA));
+	std::sort(chunks.begin(), chunks.end());
+
+	struct local
+	{
+		static bool inFunc(const std::vector<std::pair<ea_t, ea_t> > &chunks, ea_t ea)
+		{
+			for (size_t i = 0; i < chunks.size(); i++)
+				if ((ea >= chunks[i].first) && (ea < chunks[i].second))
+					return true;
+			return false;
+		}
+	};
+
+	// Block leaders
+	std::vector<ea_t> leaders;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		leaders.push_back(chunks[i].first);
+		for (ea_t ea = chunks[i].first; ea < chunks[i].second;)
+		{
+			InsnInfo insn;
+			if (!decodeInsn(ea, insn))
+				break;
+			ea += insn.size;
+			if ((insn.iclass == IC_JMP) || (insn.iclass == IC_JCC) || (insn.iclass == IC_JMP_OTHER) || (insn.iclass == IC_RET) || (insn.iclass == IC_INT3))
+			{
+				if (ea < chunks[i].second)
+					leaders.push_back(ea);
+				if (((insn.iclass == IC_JMP) || (insn.iclass == IC_JCC)) && local::inFunc(chunks, insn.target))
+					leaders.push_back(insn.target);
+			}
+		}
+	}
+	std::sort(leaders.begin(), leaders.end());
+	leaders.erase(std::unique(leaders.begin(), leaders.end()), leaders.end());
+	if (leaders.size() > maxBlocks)
+		return false;
+
+	// Blocks, then their successors
+	for (size_t i = 0; i < leaders.size(); i++)
+	{
+		FlowBlock b;
+		b.startEA = leaders[i];
+		b.endEA = leaders[i] + 1;
+		for (size_t j = 0; j < chunks.size(); j++)
+			if ((b.startEA >= chunks[j].first) && (b.startEA < chunks[j].second))
+				b.endEA = (((i + 1) < leaders.size()) ? std::min(leaders[i + 1], chunks[j].second) : chunks[j].second);
+		blocks.push_back(b);
+	}
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		InsnInfo insn, last;
+		last.iclass = IC_OTHER;
+		last.target = BADADDR;
+		for (ea_t ea = blocks[i].startEA; (ea < blocks[i].endEA) && decodeInsn(ea, insn); ea += insn.size)
+			last = insn;
+
+		std::vector<ea_t> targets;
+		if (((last.iclass == IC_JMP) || (last.iclass == IC_JCC)) && (last.target != BADADDR))
+			targets.push_back(last.target);
+		if ((last.iclass != IC_JMP) && (last.iclass != IC_JMP_OTHER) && (last.iclass != IC_RET) && (last.iclass != IC_INT3))
+			targets.push_back(blocks[i].endEA);
+		for (size_t j = 0; j < targets.size(); j++)
+		{
+			std::vector<ea_t>::const_iterator it = std::lower_bound(leaders.begin(), leaders.end(), targets[j]);
+			if ((it != leaders.end()) && (*it == targets[j]))
+				blocks[i].succ.push_back((int) (it - leaders.begin()));
+		}
+	}
+	return true;
+}
+
+// ---- Misc ----
+
+bool MemoryDatabase::getName(ea_t ea, std::string &name)
+{
+	std::unordered_map<ea_t, std::string>::const_iterator it = m_names.find(ea);
+	if (it == m_names.end())
+		return false;
+	name = it->second;
+	return true;
+}
+
+size_t MemoryDatabase::getNames(std::vector<NameInfo> &names)
+{
+	for (std::unordered_map<ea_t, std::string>::const_iterator it = m_names.begin(); it != m_names.end(); ++it)
+	{
+		NameInfo ni;
+		ni.ea = it->first;
+		ni.name = it->second;
+		names.push_back(ni);
+	}
+	return names.size();
+}
+
+void MemoryDatabase::autoWait()
+{
+	// Follow queued code flow
+	while (!m_queue.empty())
+	{
+		ea_t ea = m_queue.back();
+		m_queue.pop_back();
+		if (inRange(ea) && is_unknown(flagsAt(ea)))
+			createInsn(ea);
+	}
+}
+
+void MemoryDatabase::vmsg(const char *format, va_list va)
+{
+	if (!m_quiet)
+		vprintf(format, va);
+}
@@ -0,0 +1,108 @@
+
+// In-memory database stand-in
+// Models flags, heads, xrefs and functions over a raw byte image so the passes can be run and
+// benchmarked without IDA. Only the parts of the kernel behavior the passes depend on are modeled.
+#pragma once
+#include "Database.h"
+#include <map>
+#include <unordered_map>
+
+class MemoryDatabase : public Database
+{
+public:
+	MemoryDatabase(ea_t base, const void *bytes, size_t size, bool is64 = true);
+
+	// Image setup
+	bool makeCode(ea_t ea);		// One instruction, no flow
+	bool makeData(ea_t ea, size_t size, flags64_t dataType = FF_BYTE);
+	void setOperandOffset(ea_t ea, int n);
+	void addCref(ea_t from, ea_t to);
+	void addDref(ea_t from, ea_t to);
+	bool defineFunc(ea_t start, ea_t end, unsigned long long flags = 0);
+	bool appendFuncTail(ea_t funcEA, ea_t start, ea_t end);
+	void setName(ea_t ea, const char *name);
+	void setQuiet(bool quiet) { m_quiet = quiet; }
+
+	ea_t startEA() const { return m_base; }
+	ea_t endEA() const { return m_end; }
+
+	// Database
+	flags64_t getFlags(ea_t ea);
+	flags64_t getFullFlags(ea_t ea);
+	unsigned char getByte(ea_t ea);
+	size_t getBytes(ea_t ea, void *buffer, size_t size);
+	size_t getItemSize(ea_t ea);
+
+	ea_t nextHead(ea_t ea, ea_t maxEA);
+	ea_t prevHead(ea_t ea, ea_t minEA);
+	ea_t nextAddr(ea_t ea);
+	ea_t nextUnknown(ea_t ea, ea_t maxEA);
+	ea_t nextThat(ea_t ea, ea_t maxEA, testflags_t testf, void *ud = NULL);
+
+	bool delItems(ea_t ea, size_t size);
+	bool createByte(ea_t ea, size_t size);
+	bool createAlign(ea_t ea, size_t size);
+	int  createInsn(ea_t ea);
+	bool decodeInsn(ea_t ea, InsnInfo &insn);
+
+	ea_t firstCrefFrom(ea_t ea);
+	ea_t firstCrefTo(ea_t ea);
+	ea_t firstDrefFrom(ea_t ea);
+	ea_t firstDrefTo(ea_t ea);
+	size_t getXrefsTo(ea_t ea, std::vector<XrefInfo> &xrefs);
+
+	size_t getFuncQty();
+	bool getnFunc(size_t n, FuncInfo &fi);
+	bool getFunc(ea_t ea, FuncInfo &fi);
+	bool getFuncChunk(ea_t ea, FuncInfo &fi);
+	bool nextFuncChunk(ea_t ea, FuncInfo &fi);
+	size_t getTailReferers(ea_t tailEA, std::vector<ea_t> &referers);
+	bool addFunc(ea_t start, ea_t end = BADADDR);
+	bool removeFuncTail(ea_t funcEA, ea_t tailEA);
+	bool getFlowChart(ea_t funcEA, size_t maxBlocks, std::vector<FlowBlock> &blocks);
+
+	bool getName(ea_t ea, std::string &name);
+	size_t getNames(std::vector<NameInfo> &names);
+	int  getSegBitness(ea_t /*ea*/) { return(m_is64 ? 64 : 32); }
+	void getLoadedRange(ea_t &minEA, ea_t &maxEA) { minEA = m_base; maxEA = m_end; }
+	void autoWait();
+	void vmsg(const char *format, va_list va);
+
+private:
+	struct Func
+	{
+		ea_t endEA;
+		unsigned long long flags;
+		std::vector<ea_t> tails;	// Tail chunk starts
+	};
+	struct Chunk
+	{
+		ea_t endEA;
+		ea_t owner;
+	};
+	typedef std::unordered_map<ea_t, std::vector<ea_t> > XrefMap;
+
+	inline bool inRange(ea_t ea) const { return((ea >= m_base) && (ea < m_end)); }
+	inline unsigned int &flagsAt(ea_t ea) { return m_flags[(size_t) (ea - m_base)]; }
+	ea_t itemHead(ea_t ea);
+	bool isRangeUnknown(ea_t ea, size_t size);
+	void setItem(ea_t ea, size_t size, unsigned int headFlags);
+	void removeXrefsFrom(ea_t ea);
+	void addXref(XrefMap &fromMap, XrefMap &toMap, ea_t from, ea_t to);
+	bool flowsToNext(ea_t ea, InsnInfo &insn);
+	void fillFuncInfo(ea_t start, const Func &f, FuncInfo &fi);
+	const std::vector<ea_t> &funcOrder();
+
+	ea_t m_base, m_end;
+	bool m_is64;
+	bool m_quiet;
+	std::vector<unsigned char> m_bytes;
+	std::vector<unsigned int> m_flags;	// Per byte flags, w/o the value
+	XrefMap m_crefFrom, m_crefTo, m_drefFrom, m_drefTo;
+	std::map<ea_t, Func> m_funcs;		// By entry chunk start
+	std::map<ea_t, Chunk> m_chunks;		// All chunks by start
+	std::vector<ea_t> m_funcOrder;		// Sorted entry starts for getnFunc()
+	bool m_funcOrderDirty;
+	std::unordered_map<ea_t, std::string> m_names;
+	std::vector<ea_t> m_queue;			// Pending auto-analysis addresses
+};
@@ -0,0 +1,2102 @@
+
+// ExtraPass processing passes
+#include "Passes.h"
+#include "AlignScan.h"
+#include "X86Decode.h"
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+using namespace DbFlags;
+
+void Passes::resetStats()
+{
+	memset(&stats, 0, sizeof(stats));
+	m_refClassCache.clear();
+	m_pass1Loops = 0;
+	m_funcIndex = 0;
+	m_gapListStarted = m_gapListValid = false;
+	m_tailIndexStarted = m_tailIndexValid = false;
+	m_pass4Used = 0.0;
+	m_flowCache.clear();
+	m_flowTime = 0.0;
+	m_noRetCallees.clear();
+	m_noRetNames.clear();
+	m_noRetIndex = 0;
+	m_noRetNamesRead = m_noRetValid = false;
+}
+
+void Passes::setSegment(ea_t start, ea_t end)
+{
+	m_segStart = start;
+	m_segEnd = end;
+	m_currentAddress = m_lastAddress = 0;
+	m_seekEA = start;
+	m_segBytes.clear();
+	m_segBytesRead = 0;
+	m_segBytesValid = false;
+	m_seg64 = ((end > start) && (m_db.getSegBitness(start) == 64));
+	m_db.getLoadedRange(m_loadedStart, m_loadedEnd);
+	m_alignment = DEFAULT_ALIGNMENT;
+	memset(m_alignHistogram, 0, sizeof(m_alignHistogram));
+	m_xrefMap.clear();
+	m_xrefMapEA = start;
+	m_xrefMapValid = false;
+	m_xrefMapTime = 0.0;
+	m_gapPlan.clear();
+	m_prologueHits.clear();
+	m_gapPlanBase = start;
+	m_gapPlanThreads = 0;
+	m_gapPlanTime = 0.0;
+}
+
+// Histogram the existing function start alignments in the segment and take the largest alignment
+// most of them share. Older 4 and 8 aligned binaries would otherwise get few functions recovered.
+unsigned int Passes::detectAlignment()
+{
+	memset(m_alignHistogram, 0, sizeof(m_alignHistogram));
+	unsigned int total = 0;
+	size_t funcCount = m_db.getFuncQty();
+	for (size_t i = lowerFuncIndex(m_segStart); i < funcCount; i++)
+	{
+		FuncInfo f;
+		if (m_db.getnFunc(i, f))
+		{
+			if (f.startEA >= m_segEnd)
+				break;
+
+			int bucket = 0;
+			while ((bucket < (ALIGN_HISTOGRAM_SIZE - 1)) && ((f.startEA & (((ea_t) 2 << bucket) - 1)) == 0))
+				bucket++;
+			m_alignHistogram[bucket]++;
+			stats.alignHistogram[bucket]++;
+			total++;
+		}
+	}
+
+	if (alignmentOverride)
+		m_alignment = alignmentOverride;
+	else
+	if (total < ALIGN_MIN_SAMPLES)
+		m_alignment = DEFAULT_ALIGNMENT;
+	else
+	{
+		// Largest alignment with enough starts at or above it, 4 minimum
+		m_alignment = 4;
+		unsigned int atOrAbove = 0;
+		for (int bucket = (ALIGN_HISTOGRAM_SIZE - 1); bucket >= 2; bucket--)
+		{
+			atOrAbove += m_alignHistogram[bucket];
+			if ((atOrAbove * 100) >= (total * ALIGN_MIN_PERCENT))
+			{
+				m_alignment = (1 << bucket);
+				break;
+			}
+		}
+	}
+	return m_alignment;
+}
+
+// Read the next BUILD_STEP_BYTES of the segment snapshot, returns false once it's all read
+bool Passes::loadSegmentBytes()
+{
+	if (m_segBytesValid)
+		return false;
+
+	size_t size = (size_t) (m_segEnd - m_segStart);
+	if (m_segBytesRead == 0)
+		m_segBytes.resize(size + 1);
+	size_t want = std::min((size_t) BUILD_STEP_BYTES, (size - m_segBytesRead));
+	size_t got = (want ? m_db.getBytes((m_segStart + m_segBytesRead), &m_segBytes[m_segBytesRead], want) : 0);
+	m_segBytesRead += got;
+
+	// A short read ends the snapshot like it did for the whole segment in one read
+	if ((got < want) || (m_segBytesRead >= size))
+	{
+		m_segBytes.resize(m_segBytesRead);
+		m_segBytesValid = true;
+	}
+	return true;
+}
+
+// Snapshot of the segment bytes, read once per segment. The passes step the read, this finishes it if they haven't
+const unsigned char *Passes::segmentBytes()
+{
+	while (loadSegmentBytes())
+		;
+	return(m_segBytes.empty() ? NULL : &m_segBytes[0]);
+}
+
+// Returns the length of the multi-byte NOP instruction at the address, else 0
+size_t Passes::nopInsnLength(ea_t ea)
+{
+	const unsigned char *bytes = segmentBytes();
+	if (bytes && (ea >= m_segStart) && (ea < (m_segStart + m_segBytes.size())))
+	{
+		size_t offset = (size_t) (ea - m_segStart);
+		size_t length = nopLength(bytes + offset, m_segBytes.size() - offset, m_seg64);
+		if ((length > 1) && (length == m_db.getItemSize(ea)))
+			return length;
+	}
+	return 0;
+}
+
+// Returns true if the item is alignment padding, including a multi-byte NOP instruction
+bool Passes::isPadding(ea_t ea, flags64_t flags)
+{
+	if (isAlignByte(flags) || is_align(flags))
+		return true;
+
+	if (is_code(flags))
+	{
+		size_t length = nopInsnLength(ea);
+		if (length)
+		{
+			stats.gapNopBytes += (unsigned int) length;
+			return true;
+		}
+	}
+	return false;
+}
+
+void Passes::rewind()
+{
+	// Top of code seg
+	m_currentAddress = m_lastAddress = m_segStart;
+
+	// Pass 1 starts with the whole segment as it's worklist
+	EaRange all = { m_segStart, m_segEnd };
+	m_pass1Ranges.assign(1, all);
+	m_pass1Changed.clear();
+	m_pass1Batch.clear();
+	m_pass1RangeIndex = 0;
+	m_pass1RangeEnd = m_segStart;
+	m_pass1Loops = 0;
+	m_pass3RunEnd = m_segStart;
+	m_seekEA = m_segStart;
+
+	m_db.autoWait();
+}
+
+// Address the pass being run has done everything below, the segment start when it can't tell.
+// Pass 1 only knows in its first sweep, and the Pass 4 time budget order isn't by address.
+ea_t Passes::cursor() const
+{
+	if (m_gapListValid)
+	{
+		if (pass4Budget > 0.0)
+			return m_segStart;
+		return((m_funcIndex < m_gapList.size()) ? m_gapList[m_funcIndex].start : m_segEnd);
+	}
+	if (m_tailIndexValid)
+		return((m_funcIndex < m_tailOwners.size()) ? m_tailOwners[m_funcIndex] : m_segEnd);
+	if (m_pass1Loops > 0)
+		return m_segStart;
+
+	ea_t ea = std::max(m_currentAddress, m_segStart);
+	if (!m_pass1Batch.empty())
+		ea = std::min(ea, m_pass1Batch.front().start);
+	return ea;
+}
+
+// Pick up the pass about to be run at a cursor() address
+void Passes::seek(ea_t ea)
+{
+	if ((ea <= m_segStart) || (ea > m_segEnd))
+		return;
+	m_currentAddress = m_lastAddress = ea;
+	m_pass1Ranges[0].start = ea;
+	m_pass1RangeEnd = ea;
+	m_pass3RunEnd = ea;
+	m_seekEA = ea;
+}
+
+// Sort and merge overlapping or touching ranges
+static void mergeRanges(std::vector<EaRange> &ranges)
+{
+	if (ranges.empty())
+		return;
+	std::sort(ranges.begin(), ranges.end(), [](const EaRange &a, const EaRange &b) { return(a.start < b.start); });
+
+	size_t out = 0;
+	for (size_t i = 1; i < ranges.size(); i++)
+	{
+		if (ranges[i].start <= ranges[out].end)
+			ranges[out].end = std::max(ranges[out].end, ranges[i].end);
+		else
+			ranges[++out] = ranges[i];
+	}
+	ranges.resize(out + 1);
+}
+
+void Passes::log(const char *format, ...)
+{
+	if (logFile)
+	{
+		va_list va;
+		va_start(va, format);
+		vfprintf(logFile, format, va);
+		va_end(va);
+		fflush(logFile);
+	}
+}
+
+// Make and address range "unknown" so it can be set with something else
+void Passes::makeUnknown(ea_t start, ea_t end)
+{
+	m_db.autoWait();
+	m_db.delItems(start, (size_t) (end - start));
+	invalidateRefClasses(start, end);
+	m_db.autoWait();
+}
+
+// Index of the first function starting at or after the address.
+// Binary search since the function table is ordered by start address.
+size_t Passes::lowerFuncIndex(ea_t ea)
+{
+	size_t low = 0, high = m_db.getFuncQty();
+	while (low < high)
+	{
+		size_t mid = (low + ((high - low) / 2));
+		FuncInfo f;
+		if (m_db.getnFunc(mid, f) && (f.startEA >= ea))
+			high = mid;
+		else
+			low = (mid + 1);
+	}
+	return low;
+}
+
+// Get list of current functions in the segment prior to a processing pass
+void Passes::cacheFunctionList()
+{
+	m_funcList.clear();
+	m_funcIndex = 0;
+	m_gapList.clear();
+	m_gapListStarted = m_gapListValid = false;
+	m_tailIndex.clear();
+	m_tailIndexStarted = m_tailIndexValid = false;
+	m_tailOwners.clear();
+
+	// Must get list of functions BEFORE we start processing since IDA enumeration will break as new functions are added
+	size_t funcCount = m_db.getFuncQty();
+	size_t first = lowerFuncIndex(m_segStart);
+	m_funcList.reserve(lowerFuncIndex(m_segEnd) - first);
+	for (size_t i = first; i < funcCount; i++)
+	{
+		FuncInfo f;
+		if (m_db.getnFunc(i, f))
+		{
+			if (f.startEA >= m_segEnd)
+				break;
+			m_funcList.push_back(f);
+		}
+	}
+}
+
+bool Passes::setExtraPrologues(const char *text, std::string &error)
+{
+	m_prologues32 = PrologueMatcher(false);
+	m_prologues64 = PrologueMatcher(true);
+	if (text && *text)
+	{
+		if (!m_prologues32.addList(text, false, error) || !m_prologues64.addList(text, true, error))
+		{
+			m_prologues32 = PrologueMatcher(false);
+			m_prologues64 = PrologueMatcher(true);
+			return false;
+		}
+	}
+	return true;
+}
+
+void Passes::clearFunctionList()
+{
+	m_funcList.clear();
+	m_gapList.clear();
+	m_gapPlan.clear();
+	m_prologueHits.clear();
+	m_gapListStarted = m_gapListValid = false;
+	m_tailIndex.clear();
+	m_tailIndexStarted = m_tailIndexValid = false;
+	m_tailOwners.clear();
+	m_flowCache.clear();
+}
+
+unsigned int Passes::progress() const
+{
+	if (m_gapListValid && !m_gapList.empty())
+		return (unsigned int) ((m_funcIndex * 100) / m_gapList.size());
+	if (m_tailIndexValid && !m_tailOwners.empty())
+		return (unsigned int) ((m_funcIndex * 100) / m_tailOwners.size());
+	if ((m_segEnd > m_segStart) && (m_currentAddress > m_segStart))
+		return (unsigned int) (((std::min(m_currentAddress, m_segEnd) - m_segStart) * 100) / (m_segEnd - m_segStart));
+	return 0;
+}
+
+
+// Queue a Pass 1 range to be made unknown, coalescing it with the previous one when adjacent
+void Passes::queueUnknown(ea_t start, ea_t end)
+{
+	if (!m_pass1Batch.empty() && (m_pass1Batch.back().end == start))
+		m_pass1Batch.back().end = end;
+	else
+	{
+		EaRange r = { start, end };
+		m_pass1Batch.push_back(r);
+	}
+
+	// Would have been a makeUnknown() wait pair
+	stats.pass1WaitsSaved += 2;
+
+	if (m_pass1Batch.size() >= pass1BatchSize)
+		flushUnknowns();
+}
+
+// Delete the queued Pass 1 ranges with one analysis wait for the whole batch
+void Passes::flushUnknowns()
+{
+	if (m_pass1Batch.empty())
+		return;
+
+	m_db.autoWait();
+	for (size_t i = 0; i < m_pass1Batch.size(); i++)
+	{
+		m_db.delItems(m_pass1Batch[i].start, (size_t) (m_pass1Batch[i].end - m_pass1Batch[i].start));
+		invalidateRefClasses(m_pass1Batch[i].start, m_pass1Batch[i].end);
+	}
+	m_db.autoWait();
+	stats.pass1WaitsSaved -= 2;
+
+	// Queue the new unknown bytes along with the items on either side of them for the next sweep,
+	// since that's where analysis can create new data.
+	for (size_t i = 0; i < m_pass1Batch.size(); i++)
+	{
+		EaRange changed = m_pass1Batch[i];
+		ea_t prev = m_db.prevHead(changed.start, m_segStart);
+		if (prev != BADADDR)
+			changed.start = prev;
+		if (changed.end < m_segEnd)
+			changed.end = std::min((changed.end + m_db.getItemSize(changed.end)), m_segEnd);
+		m_pass1Changed.push_back(changed);
+	}
+	m_pass1Batch.clear();
+}
+
+// Start the next Pass 1 worklist range, returns false when the worklist is done
+bool Passes::nextPass1Range()
+{
+	while (m_pass1RangeIndex >= m_pass1Ranges.size())
+	{
+		// Sweep complete, done if nothing changed
+		flushUnknowns();
+		#ifdef PASS1_DEBUG
+		m_db.msg("** Pass %d Unknowns: %u, changed ranges: %u\n", m_pass1Loops, stats.unknownDataCount, (unsigned int) m_pass1Changed.size());
+		#endif
+		if (m_pass1Changed.empty() || ((m_pass1Loops + 1) >= UNKNOWN_PASSES))
+			return false;
+
+		// Next sweep over just the changed areas
+		m_pass1Loops++;
+		m_pass1Ranges.swap(m_pass1Changed);
+		m_pass1Changed.clear();
+		mergeRanges(m_pass1Ranges);
+		m_pass1RangeIndex = 0;
+	}
+
+	if (m_pass1RangeIndex == 0)
+		stats.pass1Sweeps++;
+	const EaRange &r = m_pass1Ranges[m_pass1RangeIndex++];
+	m_currentAddress = r.start;
+	m_pass1RangeEnd = r.end;
+	return true;
+}
+
+// Drop cached referencing instruction classes in the range
+void Passes::invalidateRefClasses(ea_t start, ea_t end)
+{
+	if (!m_refClassCache.empty())
+		m_refClassCache.erase(m_refClassCache.lower_bound(start), m_refClassCache.lower_bound(end));
+}
+
+// Find unknown data runs in code section
+//#define PASS1_DEBUG
+
+// Decode and classify a data referencing instruction, memoized by it's address
+REF_ACCESS Passes::classifyRef(ea_t eaDRef, flags64_t flags)
+{
+	std::map<ea_t, RefClass>::iterator it = m_refClassCache.find(eaDRef);
+	if ((it != m_refClassCache.end()) && (it->second.flags == flags))
+	{
+		stats.refCacheHits++;
+		return it->second.access;
+	}
+	stats.refCacheMisses++;
+
+	REF_ACCESS access = RA_OTHER;
+	InsnInfo cmd;
+	if (m_db.decodeInsn(eaDRef, cmd))
+	{
+		switch (cmd.iclass)
+		{
+			// Assume it's an embedded data array
+			case IC_LEA:
+			{
+				#ifdef PASS1_DEBUG
+				m_db.msg("%llX lea.\n", eaDRef);
+				#endif
+				access = RA_ARRAY_BASE;
+			}
+			break;
+
+			// movxx style move a byte?
+			case IC_MOVX:
+			{
+				#ifdef PASS1_DEBUG
+				m_db.msg("%llX movzx.\n", eaDRef);
+				#endif
+				access = RA_BYTE_ACCESS;
+			}
+			break;
+
+			case IC_MOV_REG_BYTE:
+			{
+				#ifdef PASS1_DEBUG
+				m_db.msg("%llX mov.\n", eaDRef);
+				#endif
+				access = RA_BYTE_ACCESS;
+			}
+			break;
+
+			default:
+			break;
+		};
+	}
+
+	RefClass rc = { flags, access };
+	m_refClassCache[eaDRef] = rc;
+	return access;
+}
+
+bool Passes::pass1Step()
+{
+	if ((m_currentAddress >= m_pass1RangeEnd) && !nextPass1Range())
+		return false;
+
+	// Value at this location data?
+	// No analysis wait needed here since only batch deletes and the byte table fix change the DB, and both wait.
+	stats.pass1WaitsSaved++;
+	flags64_t flags = m_db.getFlags(m_currentAddress);
+	if (isData(flags))
+	{
+		#ifdef PASS1_DEBUG
+		m_db.msg(" \n");
+		m_db.msg("%llX (%08llX)\n", m_currentAddress, flags);
+		#endif
+		if (m_pass1Loops > 0)
+			stats.pass1Revisits++;
+
+		// Handle an occasional over run case
+		ea_t end = m_db.nextHead(m_currentAddress, m_segEnd);
+		if (end == BADADDR)
+			end = m_segEnd;
+
+		// Skip if it has offset reference (most common occurrence)
+		bool bSkip = false;
+		if (flags & FF_0OFF)
+		{
+			#ifdef PASS1_DEBUG
+			m_db.msg("  skip offset.\n");
+			#endif
+			bSkip = true;
+		}
+		else
+		// Skip if the value is larger than a QWORD.
+		// It's probably an SSE or actual string value embedded data
+		if (((flags & DT_TYPE) > FF_QWORD) && ((flags & DT_TYPE) != FF_ALIGN))
+		{
+			#ifdef PASS1_DEBUG
+			m_db.msg("  skip by data type.\n");
+			#endif
+			bSkip = true;
+		}
+		else
+		// Has a reference?
+		if (flags & FF_REF)
+		{
+			ea_t eaDRef = m_db.firstDrefTo(m_currentAddress);
+			if (eaDRef != BADADDR)
+			{
+				#ifdef PASS1_DEBUG
+				m_db.msg("  has ref.\n");
+				#endif
+
+				// Ref part an offset?
+				flags64_t flags2 = m_db.getFlags(eaDRef);
+				if (is_code(flags2) && is_off1(flags2))
+				{
+					REF_ACCESS access = classifyRef(eaDRef, flags2);
+					if (access == RA_ARRAY_BASE)
+						bSkip = true;
+
+					// If it's byte access, assume it's a byte switch table
+					if (access == RA_BYTE_ACCESS)
+					{
+						#ifdef PASS1_DEBUG
+						m_db.msg("%llX not byte.\n", m_currentAddress);
+						#endif
+
+						makeUnknown(m_currentAddress, end);
+
+						// Step through making the array, and any bad size a byte
+						m_db.createByte(m_currentAddress, (size_t) (end - m_currentAddress));
+						m_db.autoWait();
+						bSkip = true;
+					}
+				}
+			}
+
+		} // if (flags & FF_REF)
+
+		// Make it unknown bytes
+		if (!bSkip)
+		{
+			#ifdef PASS1_DEBUG
+			m_db.msg("%llX %llX %08llX unknown\n", m_currentAddress, end, m_db.getFlags(m_currentAddress));
+			#endif
+
+			queueUnknown(m_currentAddress, end);
+			stats.unknownDataCount++;
+		}
+
+		// The item right after this one could be data too
+		m_currentAddress = end;
+		if ((m_currentAddress < m_pass1RangeEnd) && isData(m_db.getFlags(m_currentAddress)))
+			return true;
+	}
+
+	// Advance to next data value, or the range end which ever comes first
+	if (m_currentAddress < m_pass1RangeEnd)
+		m_currentAddress = m_db.nextThat(m_currentAddress, m_pass1RangeEnd, isData);
+	return true;
+}
+
+
+// Addresses that can have xrefs from or to them: item heads, referenced bytes, and flow targets
+static bool canHaveXref(flags64_t flags, void * /*ud*/)
+{
+	return(is_head(flags) || has_xref(flags) || ((flags & FF_FLOW) != 0));
+}
+
+// Mark the segment addresses that might have code or data xrefs, streaming over the flags BUILD_STEP_BYTES
+// addresses a call. Anything with a clear bit is known to have none, so most Pass 2 short run neighbor checks
+// don't need to do the xref lookups. Addresses the map hasn't reached yet might have xrefs.
+void Passes::buildXrefMap()
+{
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	if (m_xrefMap.empty())
+		m_xrefMap.assign((((size_t) (m_segEnd - m_segStart) + 63) / 64), 0);
+
+	ea_t end = ((ea_t) std::min((m_segEnd - m_xrefMapEA), (ea_t) BUILD_STEP_BYTES) + m_xrefMapEA);
+	ea_t ea = m_xrefMapEA;
+	if ((ea < end) && !canHaveXref(m_db.getFlags(ea), NULL))
+		ea = m_db.nextThat(ea, end, canHaveXref);
+	while ((ea != BADADDR) && (ea < end))
+	{
+		size_t offset = (size_t) (ea - m_segStart);
+		m_xrefMap[offset >> 6] |= (1ULL << (offset & 63));
+		ea = m_db.nextThat(ea, end, canHaveXref);
+	}
+
+	m_xrefMapEA = end;
+	m_xrefMapValid = (end >= m_segEnd);
+	m_xrefMapTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Update the map's bits for a range after a fix has changed its items, through the item after it.
+// A head undefined before the range only leaves a set bit, which costs a lookup but is never wrong.
+void Passes::refreshXrefMap(ea_t start, ea_t end)
+{
+	if (m_xrefMap.empty())
+		return;
+	if (end < m_segEnd)
+		end += m_db.getItemSize(end);
+	if (end > m_segEnd)
+		end = m_segEnd;
+
+	for (ea_t ea = start; ea < end; ea++)
+	{
+		size_t offset = (size_t) (ea - m_segStart);
+		if (canHaveXref(m_db.getFlags(ea), NULL))
+			m_xrefMap[offset >> 6] |= (1ULL << (offset & 63));
+		else
+			m_xrefMap[offset >> 6] &= ~(1ULL << (offset & 63));
+	}
+}
+
+// Returns false if the address is known to have no xrefs
+bool Passes::maybeXref(ea_t ea)
+{
+	if ((ea < m_segStart) || (ea >= m_xrefMapEA))
+		return true;
+	size_t offset = (size_t) (ea - m_segStart);
+	return((m_xrefMap[offset >> 6] & (1ULL << (offset & 63))) != 0);
+}
+
+// Returns true if every byte in the range is unknown, or in an align item wholly inside it
+bool Passes::isFreePadding(ea_t start, ea_t end)
+{
+	for (ea_t ea = start; ea < end;)
+	{
+		flags64_t flags = m_db.getFlags(ea);
+		if (is_unknown(flags))
+			ea++;
+		else
+		if (is_align(flags) && ((ea + m_db.getItemSize(ea)) <= end))
+			ea += m_db.getItemSize(ea);
+		else
+			return false;
+	}
+	return true;
+}
+
+// Find missing align blocks
+//#define PASS2_DEBUG
+bool Passes::pass2Step()
+{
+	// Segment snapshot first
+	if (loadSegmentBytes())
+		return true;
+
+	// Find the next align byte run, or NOP instruction padding, that lands on the alignment in the segment snapshot
+	// Do these bytes bring about at least the segment's function alignment?
+	const unsigned char *bytes = segmentBytes();
+	AlignRun run;
+	if ((m_currentAddress < m_segEnd) && bytes && findAlignRun(bytes, m_segBytes.size(), (size_t) (m_currentAddress - m_segStart), m_segStart, m_alignment, m_seg64, run))
+	{
+		ea_t startAddress = (m_segStart + run.offset);
+		unsigned int alignByteCount = (unsigned int) run.length;
+		m_currentAddress = m_lastAddress = (startAddress + alignByteCount);
+		#ifdef PASS2_DEBUG
+		//m_db.msg("%llX Start.\n", startAddress);
+		#endif
+
+		// If short count, only try alignment if the line above or a below us has n xref
+		// We don't want to try to align odd code and switch table bytes, etc.
+		if (alignByteCount <= 2)
+		{
+			bool hasRef = false;
+
+			// Neither neighbor can have an xref?
+			ea_t endAddress = (startAddress + alignByteCount);
+			if (!m_xrefMapValid)
+				buildXrefMap();	// A chunk more each time, it soon runs ahead of the runs
+			if (!maybeXref(endAddress) && !maybeXref(startAddress - 1))
+			{
+				// Saved the cref from/to lookups on both ends and the dref from/to after
+				stats.xrefLookupsSaved += 6;
+				return true;
+			}
+
+			// Before us
+			ea_t ref = m_db.firstCrefFrom(endAddress);
+			if (ref != BADADDR)
+				hasRef = true;
+			else
+			{
+				ref = m_db.firstCrefTo(endAddress);
+				if (ref != BADADDR)
+					hasRef = true;
+			}
+
+			// After us
+			if (ref == BADADDR)
+			{
+				ea_t foreAddress = (startAddress - 1);
+				ref = m_db.firstCrefFrom(foreAddress);
+				if (ref != BADADDR)
+					hasRef = true;
+				else
+				{
+					ref = m_db.firstCrefTo(foreAddress);
+					if (ref != BADADDR)
+						hasRef = true;
+				}
+			}
+
+			// No code ref, now look for a broken code ref
+			if (ref == BADADDR)
+			{
+				// This is still not complete as it could still be code, but pointing to a vftable
+				// entry in data.
+				// But should be fixed on more passes.
+				ref = m_db.firstDrefFrom(endAddress);
+				if (ref != BADADDR)
+				{
+					// If it the ref points to code assume code is just broken here
+					if (is_code(m_db.getFlags(ref)))
+						hasRef = true;
+				}
+				else
+				{
+					ref = m_db.firstDrefTo(endAddress);
+					if (ref != BADADDR)
+					{
+						if (is_code(m_db.getFlags(ref)))
+							hasRef = true;
+					}
+				}
+			}
+
+			// Assume it's not an alignment byte(s) and bail out
+			if (!hasRef)
+				return true;
+		}
+
+		// Leave multi-byte NOPs that are already code or overlap data alone, they're typically loop alignment inside a function,
+		// or the tail of a data item that happens to decode as NOPs. Gap padding made code is handled by Pass 4.
+		flags64_t flags = m_db.getFlags(startAddress);
+		if (run.multiByte && !isFreePadding(startAddress, (startAddress + alignByteCount)))
+			return true;
+
+		// If it's not an align make block already try to fix it
+		size_t itemSize = m_db.getItemSize(startAddress);
+		if (!is_align(flags) || (itemSize != alignByteCount))
+		{
+			makeUnknown(startAddress, ((startAddress + alignByteCount) - 1));
+			bool result = m_db.createAlign(startAddress, alignByteCount);
+			m_db.autoWait();
+			refreshXrefMap(startAddress, (startAddress + alignByteCount));
+			#ifdef PASS2_DEBUG
+			m_db.msg("%llX %d %d  %d %d DO ALIGN.\n", startAddress, alignByteCount, result, is_align(flags), (int) itemSize);
+			#endif
+			if (result)
+			{
+				stats.alignFixes++;
+				if (run.multiByte)
+					stats.nopPadBytes += alignByteCount;
+			}
+			else
+			{
+				// There are cases were IDA will fail even when the alignment block is obvious.
+				// Usually when it's an ALIGN(32) and there is a run of 16 align bytes
+				// Could at least do a code analyze on it. Then IDA will at least make a mini array of it
+				#ifdef PASS2_DEBUG
+				m_db.msg("%llX %d ALIGN FAIL ***\n", startAddress, alignByteCount);
+				#endif
+			}
+		}
+
+		return true;
+	}
+
+	// Done, move to next state
+	m_currentAddress = m_segEnd;
+	return false;
+}
+
+
+// Find missing code
+//#define PASS3_DEBUG
+
+// Returns true if code could start at the address according to the built-in decoder: the first instruction ends
+// by 'end', and it and the instructions that follow decode into something sane.
+// Direct targets only need to be in the database, code often calls a thunk or function in another code segment.
+// Addresses outside of the segment snapshot are left for IDA to decide.
+bool Passes::isPlausibleCode(ea_t ea, ea_t end)
+{
+	const unsigned char *bytes = segmentBytes();
+	if (!bytes || (ea < m_segStart) || (ea >= (m_segStart + m_segBytes.size())))
+		return true;
+
+	size_t offset = (size_t) (ea - m_segStart);
+	size_t avail = (m_segBytes.size() - offset);
+	InsnInfo insn;
+	if (!x86Decode(bytes + offset, avail, ea, m_seg64, insn) || ((ea + insn.size) > end))
+		return false;
+	return x86Plausible(bytes + offset, avail, ea, m_seg64, PLAUSIBLE_INSNS, m_loadedStart, m_loadedEnd);
+}
+
+// Start the next maximal run of unknown bytes at or after the current address, returns false when there are no more
+bool Passes::nextPass3Run()
+{
+	if (m_currentAddress >= m_segEnd)
+		return false;
+	ea_t start = m_currentAddress;
+	if (!is_unknown(m_db.getFlags(start)))
+	{
+		start = m_db.nextUnknown(start, m_segEnd);
+		if ((start == BADADDR) || (start >= m_segEnd))
+			return false;
+	}
+
+	// Runs up to the next item
+	ea_t end = m_db.nextHead(start, m_segEnd);
+	if ((end == BADADDR) || (end > m_segEnd))
+		end = m_segEnd;
+
+	m_currentAddress = start;
+	m_pass3RunEnd = end;
+	stats.pass3Runs++;
+	#ifdef PASS3_DEBUG
+	m_db.msg("%llX %llX unknown run.\n", start, end);
+	#endif
+	return true;
+}
+
+bool Passes::pass3Step()
+{
+	// Segment snapshot first
+	if (loadSegmentBytes())
+		return true;
+
+	if ((m_currentAddress >= m_pass3RunEnd) && !nextPass3Run())
+	{
+		// Next state
+		m_currentAddress = m_segEnd;
+		return false;
+	}
+
+	// Only try code at plausible instruction starts.
+	// Skip alignment byte runs, and zero fill since "00 00 00 00" is never real code.
+	ea_t ea = m_currentAddress;
+	const unsigned char *bytes = segmentBytes();
+	if (bytes && (ea < (m_segStart + m_segBytes.size())))
+	{
+		size_t offset = (size_t) (ea - m_segStart);
+		size_t avail = (size_t) (std::min(m_pass3RunEnd, (ea_t) (m_segStart + m_segBytes.size())) - ea);
+		unsigned char value = bytes[offset];
+		size_t skip = 0;
+		if ((value == 0xCC) || (value == 0x90))
+			skip = alignRunLength(bytes + offset, avail, value);
+		else
+		if (value == 0)
+		{
+			skip = alignRunLength(bytes + offset, avail, 0);
+			if (skip < 4)
+				skip = 0;
+		}
+		if (skip)
+		{
+			stats.pass3Skipped += (unsigned int) skip;
+			m_currentAddress = (ea + skip);
+			return true;
+		}
+	}
+
+	// Has to decode, fit in the run, and look like code
+	if (!isPlausibleCode(ea, m_pass3RunEnd))
+	{
+		stats.insnCreatesAvoided++;
+		m_currentAddress = (ea + 1);
+		return true;
+	}
+
+	// Try to make code of it
+	int result = m_db.createInsn(ea);
+	stats.pass3Creates++;
+	#ifdef PASS3_DEBUG
+	m_db.msg("%llX DO CODE %d\n", ea, result);
+	#endif
+
+	if (result > 0)
+	{
+		stats.codeFixes++;
+
+		// Let IDA follow the flow, then pick up at the next unknown run after the new instruction.
+		// Whatever IDA flowed through is skipped.
+		m_db.autoWait();
+		ea_t next = (ea + result);
+		if (next < m_pass3RunEnd)
+		{
+			ea_t unknown = next;
+			if (!is_unknown(m_db.getFlags(unknown)))
+				unknown = m_db.nextUnknown(unknown, m_segEnd);
+			if ((unknown == BADADDR) || (unknown > m_pass3RunEnd))
+				unknown = m_pass3RunEnd;
+			stats.pass3Skipped += (unsigned int) (unknown - next);
+		}
+		m_currentAddress = next;
+		m_pass3RunEnd = next;
+	}
+	else
+	{
+		#ifdef PASS3_DEBUG
+		m_db.msg("%llX fix fail.\n", ea);
+		#endif
+
+		// Next byte
+		m_currentAddress = (ea + 1);
+	}
+
+	return true;
+}
+
+
+// Discover missing functions part
+//#define PASS4_DEBUG
+
+// For code test
+static bool isCodeFlags(flags64_t flags, void * /*ud*/)
+{
+	return is_code(flags);
+}
+
+// Returns true if the gap has code other than padding in it.
+// Only runs of code can become a function in processFuncGap(), a gap of padding, data, and unknown bytes is a no-op.
+bool Passes::gapHasCode(ea_t start, ea_t end)
+{
+	// First code item that isn't a NOP
+	ea_t ea = start;
+	if (!is_code(m_db.getFlags(ea)))
+		ea = m_db.nextThat(ea, end, isCodeFlags);
+	while ((ea != BADADDR) && (ea < end))
+	{
+		if (!isAlignByte(m_db.getFullFlags(ea)) && !nopInsnLength(ea))
+			return true;
+		ea = m_db.nextThat(ea, end, isCodeFlags);
+	}
+	return false;
+}
+
+// Count of gap bytes that might be code, not padding or zero fill.
+// Size times code density, to process the gaps most likely to have functions first.
+size_t Passes::gapCodeBytes(ea_t start, ea_t end)
+{
+	const unsigned char *bytes = segmentBytes();
+	if (!bytes || (start < m_segStart) || (start >= (m_segStart + m_segBytes.size())))
+		return (size_t) (end - start);
+
+	const unsigned char *ptr = (bytes + (size_t) (start - m_segStart));
+	const unsigned char *last = (ptr + (size_t) (std::min(end, (ea_t) (m_segStart + m_segBytes.size())) - start));
+	size_t count = 0;
+	for (; ptr < last; ptr++)
+	{
+		if ((*ptr != 0) && (*ptr != 0xCC) && (*ptr != 0x90))
+			count++;
+	}
+	return count;
+}
+
+static double secondsNow()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Plan a gap from the segment byte snapshot alone, no database access so it can run on a worker thread.
+// Flags the all padding gaps, gets the decoder verdict for each aligned address a function could start at,
+// and finds the prologue signature matches.
+// Every result depends only on the bytes and the gap, so the plan is the same for any thread count.
+void Passes::planGap(FuncGap &gap, std::vector<ea_t> &prologueHits)
+{
+	ea_t start = ((gap.start + m_alignment) & ~((ea_t) (m_alignment - 1)));
+	const unsigned char *bytes = (m_segBytes.empty() ? NULL : &m_segBytes[0]);
+	ea_t bytesEnd = (m_segStart + m_segBytes.size());
+	gap.padding = false;
+	if (!bytes || (start < m_segStart) || (gap.end > bytesEnd))
+		return;
+
+	// All padding bytes, can skip without looking at the flags
+	size_t offset = (size_t) (start - m_segStart);
+	size_t size = (size_t) (gap.end - start);
+	size_t i = 0;
+	while (i < size)
+	{
+		size_t length;
+		if (bytes[offset + i] == 0xCC)
+			length = alignRunLength(bytes + offset + i, (size - i), 0xCC);
+		else
+		{
+			bool multiByte;
+			length = nopRunLength(bytes + offset + i, (size - i), m_seg64, multiByte);
+		}
+		if (!length)
+			break;
+		i += length;
+	}
+	if (i >= size)
+	{
+		gap.padding = true;
+		return;
+	}
+
+	// Prologue signatures where a function can start
+	const PrologueMatcher &prologues = (m_seg64 ? m_prologues64 : m_prologues32);
+	size_t gapEnd = (offset + size);
+	size_t at = offset;
+	int sig;
+	while ((at = prologues.find(bytes, gapEnd, at, sig)) < gapEnd)
+	{
+		if (isAnchored(bytes, at))
+		{
+			prologueHits.push_back(m_segStart + at);
+			gap.prologues++;
+		}
+		at++;
+	}
+
+	if (pass4Budget > 0.0)
+		gap.codeBytes = gapCodeBytes(start, gap.end);
+
+	// Function start candidates
+	for (ea_t ea = start; ea < gap.end; ea += m_alignment)
+		m_gapPlan[(size_t) ((ea - m_gapPlanBase) / m_alignment)] = (isPlausibleCode(ea, m_segEnd) ? GP_CODE : GP_NOT_CODE);
+}
+
+// Plan the [first, last) gaps in parallel, each worker takes the next block of gaps until there are none left.
+// The snapshot and verdict map must be set up before, since the workers read them.
+void Passes::planGaps(size_t first, size_t last)
+{
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	std::atomic<size_t> next(first);
+	size_t count = (last - first);
+	unsigned int threadCount = (planThreads ? planThreads : std::thread::hardware_concurrency());
+	threadCount = (unsigned int) std::max((size_t) 1, std::min((size_t) threadCount, ((count + (GAP_PLAN_BLOCK - 1)) / GAP_PLAN_BLOCK)));
+
+	// Each worker keeps its own prologue hits, merged and sorted after
+	std::vector< std::vector<ea_t> > workerHits(threadCount);
+	auto worker = [this, &next, last](std::vector<ea_t> *prologueHits)
+	{
+		size_t block;
+		while ((block = next.fetch_add(GAP_PLAN_BLOCK)) < last)
+		{
+			size_t blockEnd = std::min((block + GAP_PLAN_BLOCK), last);
+			for (size_t i = block; i < blockEnd; i++)
+				planGap(m_gapList[i], *prologueHits);
+		}
+	};
+
+	// This thread is one of the workers, if a thread can't be started the rest just take longer
+	std::vector<std::thread> threads;
+	try
+	{
+		for (unsigned int i = 1; i < threadCount; i++)
+			threads.push_back(std::thread(worker, &workerHits[i]));
+	}
+	catch (...)
+	{
+	}
+	worker(&workerHits[0]);
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	// The gaps are in address order, so these hits all go after the earlier calls' ones
+	size_t hitsStart = m_prologueHits.size();
+	for (size_t i = 0; i < workerHits.size(); i++)
+		m_prologueHits.insert(m_prologueHits.end(), workerHits[i].begin(), workerHits[i].end());
+	std::sort((m_prologueHits.begin() + hitsStart), m_prologueHits.end());
+
+	m_gapPlanThreads = std::max(m_gapPlanThreads, (unsigned int) (threads.size() + 1));
+	m_gapPlanTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Returns the gap plan decoder verdict for a function start, or asks the decoder if the address wasn't planned
+bool Passes::isPlannedCode(ea_t ea)
+{
+	if ((ea >= m_gapPlanBase) && ((ea & ((ea_t) (m_alignment - 1))) == 0))
+	{
+		size_t index = (size_t) ((ea - m_gapPlanBase) / m_alignment);
+		if ((index < m_gapPlan.size()) && (m_gapPlan[index] != GP_UNKNOWN))
+			return(m_gapPlan[index] == GP_CODE);
+	}
+	return isPlausibleCode(ea, m_segEnd);
+}
+
+// Returns true if a segment snapshot offset is on the alignment, or right after padding, a return, or a jump.
+// Short signatures like "sub esp,imm8" are common inside functions too, so only these matches count.
+bool Passes::isAnchored(const unsigned char *bytes, size_t offset) const
+{
+	if (((m_segStart + offset) & (m_alignment - 1)) == 0)
+		return true;
+	if ((offset >= 1) && ((bytes[offset - 1] == 0xCC) || (bytes[offset - 1] == 0x90) || (bytes[offset - 1] == 0xC3)))	// int 3, nop, ret
+		return true;
+	if ((offset >= 2) && (bytes[offset - 2] == 0xEB))	// jmp rel8
+		return true;
+	if ((offset >= 3) && (bytes[offset - 3] == 0xC2))	// ret imm16
+		return true;
+	return((offset >= 5) && (bytes[offset - 5] == 0xE9));	// jmp rel32
+}
+
+// Returns true if code starts with a prologue signature and isn't flowed into from the instruction before it.
+// Catches function starts the alignment rule misses, like one right after an unaligned thunk.
+bool Passes::isPrologueSeed(ea_t ea, flags64_t flags)
+{
+	if (!is_code(flags) || ((flags & FF_FLOW) != 0))
+		return false;
+	return std::binary_search(m_prologueHits.begin(), m_prologueHits.end(), ea);
+}
+
+// Gaps between the snapshot's contiguous functions, unplanned and in address order
+void Passes::collectGaps()
+{
+	m_gapList.clear();
+	for (size_t i = 0; i < m_funcList.size(); i++)
+	{
+		// Skip if first function body is not contiguous
+		if (m_funcList.tailQty[i] != 0)
+		{
+			#ifdef PASS4_DEBUG
+			static unsigned int nonContiguousCount = 0;
+			m_db.msg("%llX [%u] not contiguous %d\n", m_funcList.startEA[i], nonContiguousCount++, m_funcList.tailQty[i]);
+			#endif
+			continue;
+		}
+
+		// From the end of one function to the start of the next, or the segment end for the last
+		FuncGap gap;
+		gap.start = m_funcList.endEA[i];
+		gap.end = (((i + 1) < m_funcList.size()) ? m_funcList.startEA[i + 1] : m_segEnd);
+		if (gap.start < m_seekEA)
+			continue;
+		gap.codeBytes = 0;
+		gap.padding = false;
+		gap.prologues = 0;
+		stats.gapCount++;
+
+		// Same alignment rounding as processFuncGap()
+		ea_t start = ((gap.start + m_alignment) & ~((ea_t) (m_alignment - 1)));
+		if (gap.end <= start)
+			stats.gapsSkipped++;
+		else
+			m_gapList.push_back(gap);
+	}
+}
+
+// Build the Pass 4 worklist from the collected gaps GAP_PLAN_STEP gaps a call, keeping only the gaps processFuncGap()
+// can do something with. The byte checks are planned in parallel, the flags are checked and the functions added on this
+// thread in gap order. Returns false once the worklist is done.
+bool Passes::buildGapList()
+{
+	// Verdict map first
+	if (m_gapPlanned == 0)
+	{
+		m_gapPlanBase = (m_segStart & ~((ea_t) (m_alignment - 1)));
+		m_gapPlan.assign((size_t) (((m_segEnd - m_gapPlanBase) / m_alignment) + 1), GP_UNKNOWN);
+		m_prologueHits.clear();
+		m_gapPlanThreads = 0;
+		m_gapPlanTime = 0.0;
+		m_gapKept = 0;
+	}
+
+	size_t first = m_gapPlanned;
+	size_t last = std::min((first + GAP_PLAN_STEP), m_gapList.size());
+	planGaps(first, last);
+	m_gapPlanned = last;
+
+	// Drop the padding only gaps, and those without code. Kept ones move down over the already checked
+	for (size_t i = first; i < last; i++)
+	{
+		const FuncGap &gap = m_gapList[i];
+		ea_t start = ((gap.start + m_alignment) & ~((ea_t) (m_alignment - 1)));
+		if (gap.padding || !gapHasCode(start, gap.end))
+		{
+			stats.gapsSkipped++;
+			continue;
+		}
+
+		ea_t size = (gap.end - start);
+		int bucket = 0;
+		while ((bucket < (GAP_HISTOGRAM_SIZE - 1)) && (size >= ((ea_t) 16 << (bucket * 2))))
+			bucket++;
+		stats.gapHistogram[bucket]++;
+		stats.prologueHits += gap.prologues;
+		m_gapList[m_gapKept++] = gap;
+	}
+	if (m_gapPlanned < m_gapList.size())
+		return true;
+	m_gapList.resize(m_gapKept);
+
+	// With a time budget, most expected yield first. Stable so ties stay in address order
+	if (pass4Budget > 0.0)
+		std::stable_sort(m_gapList.begin(), m_gapList.end(), [](const FuncGap &a, const FuncGap &b)
+		{
+			return(((a.prologues * (size_t) PROLOGUE_YIELD) + a.codeBytes) > ((b.prologues * (size_t) PROLOGUE_YIELD) + b.codeBytes));
+		});
+
+	m_funcIndex = 0;
+	m_gapListValid = true;
+	return false;
+}
+
+bool Passes::pass4Step()
+{
+	// Gap list first, built over several steps
+	if (!m_gapListValid)
+	{
+		if (!m_gapListStarted)
+		{
+			m_pass4Start = secondsNow();
+			collectGaps();
+
+			// Out of time in an earlier segment? Count this one's gaps as left without planning them
+			if ((pass4Budget > 0.0) && (m_pass4Used >= pass4Budget))
+			{
+				for (size_t i = 0; i < m_gapList.size(); i++)
+				{
+					stats.gapsLeft++;
+					stats.gapBytesLeft += (m_gapList[i].end - m_gapList[i].start);
+				}
+				m_gapList.clear();
+				m_currentAddress = m_segEnd;
+				return false;
+			}
+			m_gapPlanned = 0;
+			m_gapListStarted = true;
+		}
+		else
+		if (!m_noRetValid)
+			buildNoRetSet();
+		else
+		if (!loadSegmentBytes())
+			buildGapList();
+		return true;
+	}
+
+	if (m_funcIndex < m_gapList.size())
+	{
+		// Out of time? Count what's left and end the pass
+		if ((pass4Budget > 0.0) && ((m_pass4Used + (secondsNow() - m_pass4Start)) >= pass4Budget))
+		{
+			for (; m_funcIndex < m_gapList.size(); m_funcIndex++)
+			{
+				stats.gapsLeft++;
+				stats.gapBytesLeft += (m_gapList[m_funcIndex].end - m_gapList[m_funcIndex].start);
+			}
+		}
+		else
+		{
+			processFuncGap(m_gapList[m_funcIndex].start, m_gapList[m_funcIndex].end);
+			m_funcIndex++;
+			return true;
+		}
+	}
+
+	m_pass4Used += (secondsNow() - m_pass4Start);
+	m_currentAddress = m_segEnd;
+	return false;
+}
+
+
+// Fix bad tail blocks
+
+// Index the tail chunks in the segment in one pass over them BUILD_STEP_ITEMS function chunks a call, with their referring
+// functions and reference counts. Then the worklist of the functions that have tails. Returns false once both are done.
+bool Passes::buildTailIndex()
+{
+	if (!m_tailIndexStarted)
+	{
+		m_tailIndex.clear();
+		m_tailIndex.refStart.push_back(0);
+		m_tailIndexEA = m_segStart;
+		m_tailIndexStarted = true;
+	}
+
+	std::vector<ea_t> referers;
+	std::vector<XrefInfo> xrefs;
+	FuncInfo fi;
+	ea_t ea = m_tailIndexEA;
+	for (unsigned int chunks = 0; (ea < m_segEnd) && m_db.nextFuncChunk(ea, fi) && (fi.startEA < m_segEnd); chunks++)
+	{
+		if (chunks == BUILD_STEP_ITEMS)
+		{
+			m_tailIndexEA = ea;
+			return true;
+		}
+
+		if ((fi.owner != fi.startEA) && m_db.getTailReferers(fi.startEA, referers))
+		{
+			m_tailIndex.tailEA.push_back(fi.startEA);
+			m_tailIndex.tailEndEA.push_back(fi.endEA);
+			m_tailIndex.xrefQty.push_back((int) m_db.getXrefsTo(fi.startEA, xrefs));
+			m_tailIndex.referers.insert(m_tailIndex.referers.end(), referers.begin(), referers.end());
+			m_tailIndex.refStart.push_back(m_tailIndex.referers.size());
+			m_tailIndex.detached.push_back(false);
+		}
+		ea = std::max(fi.endEA, (fi.startEA + 1));
+	}
+
+	stats.tailsIndexed += (unsigned int) m_tailIndex.size();
+
+	// Only functions with tails can need fixing
+	m_tailOwners.clear();
+	for (size_t i = 0; i < m_funcList.size(); i++)
+	{
+		if (m_funcList.startEA[i] < m_seekEA)
+			continue;
+		if (m_funcList.tailQty[i] > 0)
+			m_tailOwners.push_back(m_funcList.startEA[i]);
+		else
+			stats.pass5Skipped++;
+	}
+	stats.pass5Considered += (unsigned int) m_tailOwners.size();
+
+	m_funcIndex = 0;
+	m_tailIndexValid = true;
+	return false;
+}
+
+bool Passes::pass5Step()
+{
+	// Tail index first, built over several steps
+	if (!m_tailIndexValid)
+	{
+		buildTailIndex();
+		return true;
+	}
+
+	if (m_funcIndex < m_tailOwners.size())
+	{
+		// Fits not contiguous function problem type??
+		// Refresh since earlier tail fixes can change it
+		FuncInfo f;
+		if (m_db.getFunc(m_tailOwners[m_funcIndex], f))
+		{
+			// Go check and handle it
+			if (f.tailQty == 1)
+				processFunc(f);
+			else
+			if (f.tailQty > 1)
+				processMultiTail(f);
+		}
+
+		m_funcIndex++;
+		return true;
+	}
+	else
+	{
+		m_currentAddress = m_segEnd;
+		return false;
+	}
+}
+
+
+// Flow chart of the function, from the cache or built if within the size and time limits
+const std::vector<FlowBlock> *Passes::flowChart(ea_t funcEA)
+{
+	std::unordered_map<ea_t, std::vector<FlowBlock> >::const_iterator it = m_flowCache.find(funcEA);
+	if (it != m_flowCache.end())
+	{
+		stats.flowCacheHits++;
+		return &it->second;
+	}
+	if (m_flowTime >= FLOW_TIME_LIMIT)
+		return NULL;
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	std::vector<FlowBlock> blocks;
+	bool result = m_db.getFlowChart(funcEA, FLOW_MAX_BLOCKS, blocks);
+	m_flowTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	if (!result)
+		return NULL;
+
+	stats.flowCharts++;
+	std::vector<FlowBlock> &cached = m_flowCache[funcEA];
+	cached.swap(blocks);
+	return &cached;
+}
+
+// Returns true if there's a code reference to the address from outside the function
+bool Passes::hasOutsideCref(const FuncInfo &f, ea_t ea)
+{
+	std::vector<XrefInfo> xrefs;
+	m_db.getXrefsTo(ea, xrefs);
+	for (size_t i = 0; i < xrefs.size(); i++)
+	{
+		FuncInfo rf;
+		if (xrefs[i].isCode && (!m_db.getFunc(xrefs[i].from, rf) || (rf.startEA != f.startEA)))
+			return true;
+	}
+	return false;
+}
+
+// Look for shared tail chunks in a function with more than one tail, that should be functions of their own.
+// Typical of PGO builds where a common block gets jumped to from several functions.
+// A tail qualifies when, in the function's flow chart:
+//  1) Nothing falls through into it, it's only jumped to.
+//  2) None of its blocks branch back out of it into the rest of the function.
+//  3) It's shared with another function, or jumped to from code outside this one. Jumps from the function itself
+//     and data references, like its .pdata entry, don't make a cold block a function.
+//#define MULTITAIL_DEBUG
+void Passes::processMultiTail(const FuncInfo &f)
+{
+	stats.multiTailFuncs++;
+	const std::vector<FlowBlock> *chart = flowChart(f.startEA);
+	if (!chart)
+	{
+		stats.flowSkipped++;
+		return;
+	}
+
+	// Copy since a fix drops the cached chart
+	std::vector<FlowBlock> blocks(*chart);
+	bool changed = false;
+	for (size_t i = 0; i < blocks.size(); i++)
+	{
+		// Tail entry block?
+		int found = m_tailIndex.find(blocks[i].startEA);
+		if (found < 0)
+			continue;
+		size_t index = (size_t) found;
+		ea_t tailStart = m_tailIndex.tailEA[index], tailEnd = m_tailIndex.tailEndEA[index];
+		size_t refererCount = (m_tailIndex.refStart[index + 1] - m_tailIndex.refStart[index]);
+		if ((refererCount < 2) && ((m_tailIndex.xrefQty[index] < 2) || !hasOutsideCref(f, tailStart)))
+			continue;
+
+		bool qualifies = true;
+		for (size_t j = 0; qualifies && (j < blocks.size()); j++)
+		{
+			bool inTail = ((blocks[j].startEA >= tailStart) && (blocks[j].startEA < tailEnd));
+			for (size_t k = 0; qualifies && (k < blocks[j].succ.size()); k++)
+			{
+				const FlowBlock &succ = blocks[blocks[j].succ[k]];
+				bool succInTail = ((succ.startEA >= tailStart) && (succ.startEA < tailEnd));
+
+				// Falls into the tail entry, or the tail branches back out
+				if (!inTail && (succ.startEA == tailStart) && (blocks[j].endEA == tailStart))
+					qualifies = false;
+				else
+				if (inTail && !succInTail)
+					qualifies = false;
+			}
+		}
+		if (!qualifies)
+			continue;
+
+		flags64_t flags = m_db.getFlags(tailStart);
+		if (is_func(flags) || !is_code(flags))
+			continue;
+
+		#ifdef MULTITAIL_DEBUG
+		m_db.msg("%llX %llX shared tail, referers: %u, refs: %d\n", f.startEA, tailStart, (unsigned int) refererCount, m_tailIndex.xrefQty[index]);
+		#endif
+
+		// Detach it from all the functions it's in, then make it one
+		for (size_t j = m_tailIndex.refStart[index]; j < m_tailIndex.refStart[index + 1]; j++)
+		{
+			stats.tailBlckRefFixes++;
+			m_db.removeFuncTail(m_tailIndex.referers[j], tailStart);
+			m_flowCache.erase(m_tailIndex.referers[j]);
+		}
+		m_tailIndex.detached[index] = true;
+		if (m_db.addFunc(tailStart, BADADDR))
+			stats.multiTailFixes++;
+		changed = true;
+	}
+
+	if (changed)
+		m_flowCache.erase(f.startEA);
+}
+
+// Returns TRUE if flag byte is possibly a typical alignment byte
+bool isAlignByte(flags64_t flags, void * /*ud*/)
+{
+	const flags64_t ALIGN_VALUE1 = (FF_IVL | 0xCC); // 0xCC (single byte "int 3") byte type
+	const flags64_t ALIGN_VALUE2 = (FF_IVL | 0x90); // NOP byte type
+
+	flags &= (FF_IVL | MS_VAL);
+	if ((flags == ALIGN_VALUE1) || (flags == ALIGN_VALUE2))
+		return(true);
+	else
+		return(false);
+}
+
+// Return if flag is data type we want to convert to unknown bytes
+bool isData(flags64_t flags, void * /*ud*/)
+{
+	return(!is_align(flags) && is_data(flags));
+}
+
+
+// Name fragments of typical return-less exception and exit handlers, lower case
+static const char * const exitNames[] =
+{
+	"exception",
+	"handler",
+	"exitprocess",
+	"fatalappexit",
+	"_abort",
+	"_exit",
+};
+
+// Gather the callees a function can end with a call to: the no-return functions,
+// and the functions and imports with an exit name. BUILD_STEP_ITEMS functions or names a call, the name list itself is
+// read in one. Returns false once the set is done.
+bool Passes::buildNoRetSet()
+{
+	if (!m_noRetNamesRead)
+	{
+		if (m_noRetIndex == 0)
+			m_noRetCallees.clear();
+		size_t funcCount = m_db.getFuncQty();
+		size_t last = std::min((m_noRetIndex + BUILD_STEP_ITEMS), funcCount);
+		for (; m_noRetIndex < last; m_noRetIndex++)
+		{
+			FuncInfo f;
+			if (m_db.getnFunc(m_noRetIndex, f) && (f.flags & FUNC_NORET))
+				m_noRetCallees.insert(f.startEA);
+		}
+		if (m_noRetIndex < funcCount)
+			return true;
+
+		m_noRetNames.clear();
+		m_db.getNames(m_noRetNames);
+		m_noRetNamesRead = true;
+		m_noRetIndex = 0;
+		return true;
+	}
+
+	std::vector<NameInfo> &names = m_noRetNames;
+	size_t last = std::min((m_noRetIndex + BUILD_STEP_ITEMS), names.size());
+	for (size_t i = m_noRetIndex; i < last; i++)
+	{
+		std::string &name = names[i].name;
+		for (size_t j = 0; j < name.size(); j++)
+			name[j] = (char) tolower((unsigned char) name[j]);
+
+		bool found = false;
+		for (size_t j = 0; !found && (j < (sizeof(exitNames) / sizeof(const char *))); j++)
+			found = (strstr(name.c_str(), exitNames[j]) != NULL);
+		for (size_t j = 0; !found && (j < extraNoRetNames.size()); j++)
+			found = (name.find(extraNoRetNames[j]) != std::string::npos);
+		if (found)
+			m_noRetCallees.insert(names[i].ea);
+	}
+	m_noRetIndex = last;
+	if (m_noRetIndex < names.size())
+		return true;
+
+	std::vector<NameInfo>().swap(m_noRetNames);
+	stats.noRetCallees = (unsigned int) m_noRetCallees.size();
+	m_noRetValid = true;
+	return false;
+}
+
+// Try adding a function at specified address
+bool Passes::tryFunction(ea_t codeStart, ea_t &current)
+{
+	bool result = false;
+
+	m_db.autoWait();
+	#ifdef LOG_FILE
+	log("%llX %llX Trying function.\n", codeStart, current);
+	#endif
+
+	/// *** Don't use "get_func()" it has a bug, use "get_fchunk()" instead ***
+
+	// Could belong as a chunk to an existing function already or already a function here recovered already between steps.
+	FuncInfo f;
+	if (m_db.getFuncChunk(codeStart, f))
+	{
+		#ifdef LOG_FILE
+		log("  %llX %llX %llX F: %08llX already function.\n", f.endEA, f.startEA, codeStart, m_db.getFlags(codeStart));
+		#endif
+
+		current = m_db.prevHead(f.endEA, codeStart); // Advance to end of the function -1 location (for a follow up "next_head()")
+		result = true;
+	}
+	else
+	if (!isPlannedCode(codeStart))
+	{
+		// Built-in decoder says it's not code that could start a function
+		#ifdef LOG_FILE
+		log("  %llX not plausible code.\n", codeStart);
+		#endif
+		stats.funcAddsAvoided++;
+	}
+	else
+	{
+		// Try function here
+		if (m_db.addFunc(codeStart, BADADDR))
+		{
+			// Wait till IDA is done possibly creating the function, then get it's info
+			m_db.autoWait();
+			if (m_db.getFuncChunk(codeStart, f))
+			{
+				#ifdef LOG_FILE
+				log("  %llX function success.\n", codeStart);
+				#endif
+				#ifdef VBDEV
+				m_db.msg("  %llX function success.\n", codeStart);
+				#endif
+
+				// Look at function tail instruction
+				m_db.autoWait();
+				#ifdef SHOW_PROBLEMS
+				bool isExpected = false;
+				#endif
+				ea_t tailEa = m_db.prevHead(f.endEA, codeStart);
+				if (tailEa != BADADDR)
+				{
+					InsnInfo cmd;
+					if (m_db.decodeInsn(tailEa, cmd))
+					{
+						switch (cmd.iclass)
+						{
+							// A return?
+							case IC_RET:
+							{
+								#ifdef SHOW_PROBLEMS
+								isExpected = true;
+								#endif
+							}
+							break;
+
+							// A jump? (chain to another function, etc.)
+							case IC_JMP: case IC_JMP_OTHER:
+							// Can be a conditional branch to another incongruent chunk
+							case IC_JCC:
+							{
+								#ifdef SHOW_PROBLEMS
+								isExpected = true;
+								#endif
+							}
+							break;
+
+							// A single align byte that was mistakenly made a function?
+							case IC_INT3:
+							case IC_NOP:
+							if ((f.endEA - f.startEA) == 1)
+							{
+								// Try to make it an align
+								makeUnknown(tailEa, (tailEa + 1));
+								if (!m_db.createAlign(tailEa, 1))
+								{
+									// If it fails, make it an instruction at least
+									m_db.createInsn(tailEa);
+								}
+
+								m_db.autoWait();
+								#ifdef SHOW_PROBLEMS
+								isExpected = true;
+								#endif
+							}
+							break;
+
+							// Return-less exception or exit handler?
+							case IC_CALL:
+							{
+								ea_t eaCRef = m_db.firstCrefFrom(tailEa);
+								if (eaCRef != BADADDR)
+								{
+									stats.noRetLookups++;
+									if (m_noRetCallees.find(eaCRef) != m_noRetCallees.end())
+									{
+										stats.noRetHits++;
+										#ifdef SHOW_PROBLEMS
+										isExpected = true;
+										#endif
+									}
+								}
+							}
+							// Falls through - a "call" can be to a function with the "noreturn" attribute
+							default:
+							{
+								// Allow if function has attribute "noreturn"
+								#ifdef SHOW_PROBLEMS
+								if (f.flags & FUNC_NORET)
+									isExpected = true;
+								#endif
+							}
+							break;
+						};
+					}
+
+					#ifdef SHOW_PROBLEMS
+					if (!isExpected)
+					{
+						std::string name;
+						if (!m_db.getName(f.startEA, name))
+							name = "unknown";
+						m_db.msg("%llX \"%s\" problem? <click me>\n", tailEa, name.c_str());
+
+						#ifdef LOG_FILE
+						log("%llX \"%s\" problem? <click me>\n", tailEa, name.c_str());
+						#endif
+					}
+					#endif
+				}
+
+				// Update current look position to the end of this function
+				current = tailEa; // Advance to end of the function -1 location (for a follow up "next_head()")
+				result = true;
+			}
+		}
+	}
+
+	return(result);
+}
+
+
+// Process the gap from the end of one function to the start of the next
+// looking for missing functions in between.
+void Passes::processFuncGap(ea_t start, ea_t end)
+{
+	// Assume function boundaries at alignment
+	start = ((start + m_alignment) & ~((ea_t) (m_alignment - 1)));
+	#define IS_ALIGNED(_addr) (((_addr) & ((ea_t) (m_alignment - 1))) == 0)
+	m_currentAddress = start;
+
+	// Bail out if there is no gap here
+	if (end <= start)
+		return;
+
+	#ifdef LOG_FILE
+	log("\nS: %llX, E: %llX ==== PFG START ====\n", start, end);
+	#endif
+	#ifdef VBDEV
+	m_db.msg("%llX %llX ==== Gap\n", start, end);
+	#endif
+
+	// Walk backwards from the end to trim possible alignment section at the end
+	m_db.autoWait();
+	ea_t ea = m_db.prevHead(end, start);
+	if (ea == BADADDR)
+		return;
+	else
+	{
+		ea_t endSave = end;
+
+		while (ea >= start)
+		{
+			flags64_t flags = m_db.getFullFlags(ea);
+			if (isPadding(ea, flags))
+			{
+				ea = m_db.prevHead(ea, start);
+				if (ea == BADADDR)
+					return;
+			}
+			else
+			{
+				end = m_db.nextHead(ea, end);
+				// Can fail in some odd circumstances, so reset it back to whole gap size
+				if (end == BADADDR)
+					end = endSave;
+				break;
+			}
+		};
+	}
+
+
+	// Traverse gap
+	ea_t codeStart = BADADDR;
+	ea = start;
+
+	while (ea < end)
+	{
+		// Info flags for this address
+		flags64_t flags = m_db.getFullFlags(ea);
+		#ifdef LOG_FILE
+		log("  C: %llX, F: %08llX.\n", ea, flags);
+		#endif
+		#ifdef VBDEV
+		m_db.msg(" C: %llX, F: %08llX.\n", ea, flags);
+		#endif
+
+		if (ea < start)
+		{
+			#ifdef LOG_FILE
+			log("**** Out of start range! %llX %llX %llX ****\n", ea, start, end);
+			#endif
+			return;
+		}
+		else
+		if (ea > end)
+		{
+			#ifdef LOG_FILE
+			log("**** Out of end range! %llX %llX %llX ****\n", ea, start, end);
+			#endif
+			return;
+		}
+
+		// Skip over "align" blocks.
+		// #1 we will typically see more of these then anything else
+		if (isPadding(ea, flags))
+		{
+			// Function between code start?
+			if ((codeStart != BADADDR) && IS_ALIGNED(codeStart))
+			{
+				#ifdef LOG_FILE
+				log("  %llX Trying function #1\n", codeStart);
+				#endif
+				#ifdef VBDEV
+				m_db.msg(">%llX Trying function #1\n", codeStart);
+				#endif
+
+				tryFunction(codeStart, ea);
+				codeStart = BADADDR;
+			}
+		}
+		else
+		// #2 case, we'll typically see data
+		if (isData(flags))
+		{
+			// Function between code start?
+			if ((codeStart != BADADDR) && IS_ALIGNED(codeStart))
+			{
+				#ifdef LOG_FILE
+				log("  %llX Trying function #2\n", codeStart);
+				#endif
+				#ifdef VBDEV
+				m_db.msg(">%llX Trying function #2\n", codeStart);
+				#endif
+
+				tryFunction(codeStart, ea);
+				codeStart = BADADDR;
+			}
+		}
+		else
+		// Hit some code?
+		if (is_code(flags))
+		{
+			// Yes, mark the start of a possible code block
+			bool tried = false;
+			if (codeStart == BADADDR)
+			{
+				codeStart = ea;
+
+				#ifdef LOG_FILE
+				log("  %llX Trying function #3, assumed func start\n", codeStart);
+				#endif
+				#ifdef VBDEV
+				m_db.msg(">%llX Trying function #3, assumed func start\n", codeStart);
+				#endif
+
+				if (IS_ALIGNED(codeStart))
+				{
+					if (tryFunction(codeStart, ea))
+						codeStart = BADADDR;
+					tried = true;
+				}
+			}
+
+			// Unaligned, or inside a code run, but starts like a function and nothing flows into it
+			if (!tried && isPrologueSeed(ea, flags))
+			{
+				#ifdef LOG_FILE
+				log("  %llX Trying function #5, prologue signature\n", ea);
+				#endif
+				#ifdef VBDEV
+				m_db.msg(">%llX Trying function #5, prologue signature\n", ea);
+				#endif
+
+				FuncInfo f;
+				bool known = m_db.getFuncChunk(ea, f);
+				if (tryFunction(ea, ea))
+				{
+					if (!known)
+						stats.prologueFuncs++;
+					codeStart = BADADDR;
+				}
+			}
+		}
+		else
+		// Undefined?
+		// Usually 0xCC align bytes
+		if (is_unknown(flags))
+		{
+			#ifdef LOG_FILE
+			log("  C: %llX, Unknown type.\n", ea);
+			#endif
+			#ifdef VBDEV
+			m_db.msg("  C: %llX, Unknown type.\n", ea);
+			#endif
+
+			codeStart = BADADDR;
+		}
+		else
+		{
+			#ifdef LOG_FILE
+			log("  %llX ** unknown data type! **\n", ea);
+			#endif
+			#ifdef VBDEV
+			m_db.msg("  %llX ** unknown data type! **\n", ea);
+			#endif
+
+			codeStart = BADADDR;
+		}
+
+		// Next item
+		m_db.autoWait();
+		ea_t nextEa = BADADDR;
+		if (ea != BADADDR)
+		{
+			nextEa = m_db.nextHead(ea, end);
+			if (nextEa != BADADDR)
+				ea = nextEa;
+		}
+
+		if ((nextEa == BADADDR) || (ea == BADADDR))
+		{
+			// If have code and at the end, try a function from the start
+			if ((codeStart != BADADDR) && IS_ALIGNED(codeStart))
+			{
+				#ifdef LOG_FILE
+				log("  %llX Trying function #4\n", codeStart);
+				#endif
+				#ifdef VBDEV
+				m_db.msg(">%llX Trying function #4\n", codeStart);
+				#endif
+
+				tryFunction(codeStart, ea);
+				m_db.autoWait();
+			}
+
+			#ifdef LOG_FILE
+			log(" Gap end: %llX.\n", ea);
+			#endif
+			#ifdef VBDEV
+			m_db.msg(" Gap end: %llX.\n", ea);
+			#endif
+
+			break;
+		}
+
+	}; // while(ea < start)
+}
+
+
+// Process suspected bad tail block, non-contiguous, function
+//#define PROCESSFUNC_DEBUG
+void Passes::processFunc(const FuncInfo &f)
+{
+	const int MAX_INST_COUNT = 16;
+
+	// We're looking for a code pattern that:
+	// 1) At least 2 and up to MAX_INST_COUNT instructions max for the entry chunk
+	// 2) Has a single direct JMP to a tail block
+
+	int instsToJmp = 0;
+	ea_t jmpAddr = BADADDR;
+	ea_t ea = f.startEA;
+
+	for (; instsToJmp <= MAX_INST_COUNT; ++instsToJmp)
+	{
+		InsnInfo cmd;
+		if (m_db.decodeInsn(ea, cmd))
+		{
+			// Is it a non-conditional jump?
+			if (cmd.iclass == IC_JMP)
+			{
+				if (jmpAddr == BADADDR)
+					jmpAddr = ea;
+				else
+				{
+					// Already seen a jump, bail out
+					jmpAddr = BADADDR;
+					break;
+				}
+			}
+
+			// Next instruction
+			ea = m_db.nextHead(ea, f.endEA);
+
+			// End of the entry part reached
+			if (ea == BADADDR)
+				break;
+		}
+		else
+		{
+			#ifdef PROCESSFUNC_DEBUG
+			m_db.msg("%llX bad instruction decode.\n", ea);
+			#endif
+			jmpAddr = BADADDR;
+			break;
+		}
+
+	}
+
+	if ((jmpAddr != BADADDR) && (ea == BADADDR) && (instsToJmp >= 1))
+	{
+		// Analise the jump target..
+		InsnInfo cmd;
+		if (m_db.decodeInsn(jmpAddr, cmd))
+		{
+			ea_t jmpTarget = cmd.target;
+			flags64_t flags = m_db.getFlags(jmpTarget);
+
+			// Skip if already a function, happens in odd cases but more likely we processed it's tail already
+			// Also should be code and have xrefs
+			if (!is_func(flags) && is_code(flags) && has_xref(flags))
+			{
+				// Reference count and referring functions from the tail index.
+				// Else the slow way, from the function of each code reference.
+				int xrefMinCount;
+				const ea_t *referers;
+				size_t refererCount;
+				std::vector<ea_t> xrefFuncs;
+				int index = m_tailIndex.find(jmpTarget);
+				if (index >= 0)
+				{
+					xrefMinCount = m_tailIndex.xrefQty[index];
+					referers = (m_tailIndex.referers.data() + m_tailIndex.refStart[index]);
+					refererCount = (m_tailIndex.refStart[index + 1] - m_tailIndex.refStart[index]);
+				}
+				else
+				{
+					stats.tailIndexMisses++;
+					std::vector<XrefInfo> xrefs;
+					xrefMinCount = (int) m_db.getXrefsTo(jmpTarget, xrefs);
+					for (size_t i = 0; i < xrefs.size(); i++)
+					{
+						if (xrefs[i].isCode)
+						{
+							FuncInfo rf;
+							if (m_db.getFunc(xrefs[i].from, rf))
+								xrefFuncs.push_back(rf.startEA);
+							else
+							{
+								// Usually where IDA totally gets a function body wrong, or other odd cases where there is a undeclared function inside another function body
+								// Not a problem here since it doesn't cause the add_func() to fail.
+								// #TODO: This would be a good one to report back to the user as a problem area with SHOW_PROBLEMS on
+								#ifdef PROCESSFUNC_DEBUG
+								m_db.msg("  %llX %llX ** no function **\n", xrefs[i].from, jmpTarget);
+								#endif
+							}
+						}
+					}
+					referers = xrefFuncs.data();
+					refererCount = xrefFuncs.size();
+				}
+
+				// Limit to those that more than one reference, or with only two instructions
+				// Somewhat contentious as there is still a good chance the target should be function still with just one xref still.
+				// But then the main reason to fix these is because of the ambiguity, much less of a problem for following/other function
+				// analysis tools.
+				if ((instsToJmp == 1) || (xrefMinCount > 1))
+				{
+					#ifdef PROCESSFUNC_DEBUG
+					static int tailFixCount = 0;
+					m_db.msg(" %llX %llX [%d] JMP refs: %d, inst2j: %d (%08llX)\n", jmpAddr, jmpTarget, tailFixCount++, xrefMinCount, instsToJmp, flags);
+					#endif
+
+					// Attempt to remove the tail from all the functions it's in
+					for (size_t i = 0; i < refererCount; i++)
+					{
+						stats.tailBlckRefFixes++;
+						if (!m_db.removeFuncTail(referers[i], jmpTarget))
+						{
+							#ifdef PROCESSFUNC_DEBUG
+							m_db.msg("  %llX %llX ** remove_func_tail() failed! **\n", referers[i], jmpTarget);
+							#endif
+						}
+					}
+
+					if (index >= 0)
+						m_tailIndex.detached[index] = true;
+
+					// Attempt to convert the former tail block init to a function
+					if (!m_db.addFunc(jmpTarget, BADADDR))
+					{
+						#ifdef PROCESSFUNC_DEBUG
+						m_db.msg("  %llX ** add_func() failed! **\n", jmpTarget);
+						#endif
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,344 @@
+
+// ExtraPass processing passes
+#pragma once
+#include "Database.h"
+#include "PrologueScan.h"
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
+
+//#define VBDEV
+//#define LOG_FILE
+
+// Function alignment is detected per segment from the existing function start addresses.
+// Now of days most compilers are going to be generating functions at 16 byte boundaries,
+// but not always the case for older executables or non-standard configurations.
+// This is the default when there are too few functions in the segment to tell.
+#define DEFAULT_ALIGNMENT 16
+#define ALIGN_MIN_SAMPLES 32	// Function starts needed for detection
+#define ALIGN_MIN_PERCENT 75	// Percentage of starts that must be at an alignment to select it
+#define ALIGN_HISTOGRAM_SIZE 7	// Function start alignment buckets: 1, 2, 4, 8, 16, 32, 64+
+
+// Define to dump out problem functions
+//#define SHOW_PROBLEMS
+
+// Max count of STATE_PASS_1 unknown byte gather sweeps.
+// After the first full sweep only the ranges changed by the previous one are revisited.
+#define UNKNOWN_PASSES 8
+
+// Default count of coalesced unknown ranges Pass 1 collects before deleting them as one batch
+#define PASS1_BATCH_SIZE 256
+
+// Instructions the built-in decoder checks from a Pass 3/4 candidate before asking IDA to create anything
+#define PLAUSIBLE_INSNS 4
+
+// Pass 5 flow charts of functions with multiple tail chunks.
+// Functions with more basic blocks than this are skipped, and so are the rest once the run has spent the time limit building them.
+#define FLOW_MAX_BLOCKS 1024
+#define FLOW_TIME_LIMIT 30.0
+
+// Pass 4 gaps a plan worker thread takes at a time
+#define GAP_PLAN_BLOCK 64
+
+// Pass setup work done per step, so a time sliced run keeps getting back to the UI on a large segment.
+// Segment snapshot bytes and xref map addresses, functions, names, and function chunks, and Pass 4 gaps planned.
+#define BUILD_STEP_BYTES 0x100000
+#define BUILD_STEP_ITEMS 4096
+#define GAP_PLAN_STEP 4096
+
+// Pass 4 gap expected yield bytes per prologue signature hit, for the time budget ordering
+#define PROLOGUE_YIELD 256
+
+// Pass 4 function gap size buckets: <16, <64, <256, <1K, <4K, <16K, 16K+
+#define GAP_HISTOGRAM_SIZE 7
+
+// Pass 1 access class of a data referencing instruction
+enum REF_ACCESS
+{
+	RA_OTHER,
+	RA_ARRAY_BASE,	// lea, assume it's an embedded data array
+	RA_BYTE_ACCESS,	// movzx/movsx or mov reg, byte; assume it's a byte switch table
+};
+
+// Pass 4 gap plan decoder verdict for an aligned address
+enum GAP_PLAN
+{
+	GP_UNKNOWN,		// Not planned, ask the decoder
+	GP_CODE,		// Plausible function start
+	GP_NOT_CODE,
+};
+
+// Address range [start, end)
+struct EaRange
+{
+	ea_t start, end;
+};
+
+// Pass 4 function gap, raw [function end, next start)
+struct FuncGap
+{
+	ea_t start, end;
+	size_t codeBytes;	// Expected yield, snapshot bytes that aren't padding or zero fill. Only counted with a time budget
+	bool padding;		// Nothing but padding bytes
+	unsigned int prologues;	// Prologue signature hits
+};
+
+// Snapshot of the functions in a segment in parallel arrays, so the pass loops only touch the fields they use
+struct FuncSnapshot
+{
+	std::vector<ea_t> startEA;
+	std::vector<ea_t> endEA;
+	std::vector<int> tailQty;
+	std::vector<unsigned long long> flags;
+
+	size_t size() const { return startEA.size(); }
+	void clear() { startEA.clear(); endEA.clear(); tailQty.clear(); flags.clear(); }
+	void reserve(size_t count) { startEA.reserve(count); endEA.reserve(count); tailQty.reserve(count); flags.reserve(count); }
+	void push_back(const FuncInfo &f)
+	{
+		startEA.push_back(f.startEA);
+		endEA.push_back(f.endEA);
+		tailQty.push_back(f.tailQty);
+		flags.push_back(f.flags);
+	}
+};
+
+// Pass 5 reverse index from tail chunk start to the functions it belongs to, in compressed rows
+struct TailIndex
+{
+	std::vector<ea_t> tailEA;		// Sorted tail chunk starts
+	std::vector<ea_t> tailEndEA;
+	std::vector<int> xrefQty;		// References to each tail start
+	std::vector<size_t> refStart;	// Each tail's first entry in 'referers', plus an end entry
+	std::vector<ea_t> referers;		// Referring function starts
+	std::vector<bool> detached;		// Tail since detached from its functions, the entry is stale
+
+	size_t size() const { return tailEA.size(); }
+	void clear() { tailEA.clear(); tailEndEA.clear(); xrefQty.clear(); refStart.clear(); referers.clear(); detached.clear(); }
+
+	// Index of a tail start that's still attached, or -1
+	int find(ea_t ea) const
+	{
+		std::vector<ea_t>::const_iterator it = std::lower_bound(tailEA.begin(), tailEA.end(), ea);
+		if ((it == tailEA.end()) || (*it != ea) || detached[it - tailEA.begin()])
+			return -1;
+		return (int) (it - tailEA.begin());
+	}
+};
+
+// Pass result counters
+struct PassStats
+{
+	unsigned int unknownDataCount;
+	unsigned int alignFixes;
+	unsigned int codeFixes;
+	unsigned int tailBlckRefFixes;
+
+	unsigned int pass1Sweeps;		// Pass 1 sweeps, including the first full one
+	unsigned int pass1Revisits;		// Data items examined again after the first sweep
+	unsigned int pass1WaitsSaved;	// auto_wait() calls avoided by batching
+	unsigned int refCacheHits;		// Pass 1 referencing instruction class cache
+	unsigned int refCacheMisses;
+
+	unsigned int nopPadBytes;		// Pass 2 multi-byte NOP padding bytes aligned
+	unsigned int gapNopBytes;		// Pass 4 multi-byte NOP padding bytes recognized in function gaps
+
+	unsigned int alignHistogram[ALIGN_HISTOGRAM_SIZE];	// Function starts by alignment, all segments
+
+	unsigned int xrefLookupsSaved;	// Pass 2 short run xref queries answered by the xref bitmap
+
+	unsigned int pass3Runs;			// Pass 3 unknown byte runs examined
+	unsigned int pass3Creates;		// Pass 3 create_insn() calls
+	unsigned int pass3Skipped;		// Pass 3 run bytes not tried; padding, zero fill, or flowed over
+
+	unsigned int insnCreatesAvoided;	// Pass 3 candidates the built-in decoder rejected, create_insn() not called
+	unsigned int funcAddsAvoided;		// Pass 4 candidates the built-in decoder rejected, add_func() not called
+
+	unsigned int gapCount;			// Pass 4 function gaps, between contiguous functions
+	unsigned int gapsSkipped;		// Pass 4 gaps with nothing but padding, or nothing at all
+	unsigned int gapHistogram[GAP_HISTOGRAM_SIZE];	// Pass 4 processed gap sizes
+	unsigned int prologueHits;		// Pass 4 prologue signature matches in function gaps
+	unsigned int prologueFuncs;		// Pass 4 functions added at a prologue signature that wouldn't have been tried otherwise
+	unsigned int noRetCallees;		// No-return callee set size
+	unsigned int noRetLookups;		// Pass 4 trailing call callee lookups
+	unsigned int noRetHits;			// Those that were a no-return callee
+	unsigned int tailsIndexed;		// Pass 5 tail chunks in the reverse index
+	unsigned int tailIndexMisses;	// Pass 5 jump targets not in it, looked up the slow way
+	unsigned int pass5Considered;	// Pass 5 functions with tail chunks, the only ones looked at
+	unsigned int pass5Skipped;		// Pass 5 functions without
+	unsigned int multiTailFuncs;	// Pass 5 functions with more than one tail chunk examined with a flow chart
+	unsigned int flowCharts;		// Pass 5 flow charts built
+	unsigned int flowCacheHits;
+	unsigned int flowSkipped;		// Pass 5 multi-tail functions skipped for size or the time limit
+	unsigned int multiTailFixes;	// Pass 5 shared tail chunks made functions
+	unsigned int gapsLeft;			// Pass 4 gaps not processed when the time budget ran out
+	unsigned long long gapBytesLeft;
+};
+
+// The five passes over a code segment.
+// Each pass is stepped one item at a time by the driver so it can check for user break, etc.
+class Passes
+{
+public:
+	Passes(Database &db) : logFile(NULL), pass1BatchSize(PASS1_BATCH_SIZE), alignmentOverride(0), pass4Budget(0.0), planThreads(0), m_db(db), m_prologues32(false), m_prologues64(true) { resetStats(); setSegment(0, 0); }
+
+	void resetStats();
+	void setSegment(ea_t start, ea_t end);
+	void rewind();	// Back to the top of the code segment
+
+	// For a checkpoint, the pass being run's progress address, and to resume a pass there after rewind()
+	ea_t cursor() const;
+	void seek(ea_t ea);
+
+	// Select the segment's function alignment, from the existing function starts or the override
+	unsigned int detectAlignment();
+	unsigned int alignment() const { return m_alignment; }
+	const unsigned int *alignHistogram() const { return m_alignHistogram; }	// This segment's
+
+	// This segment's Pass 2 xref bitmap, if it was built
+	size_t xrefMapBytes() const { return(m_xrefMap.size() * sizeof(m_xrefMap[0])); }
+	double xrefMapTime() const { return m_xrefMapTime; }
+
+	// This segment's Pass 4 gap plan
+	unsigned int gapPlanThreads() const { return m_gapPlanThreads; }
+	double gapPlanTime() const { return m_gapPlanTime; }
+	const std::vector<unsigned char> &gapPlan() const { return m_gapPlan; }	// GAP_PLAN verdicts by aligned address from the segment start
+	const std::vector<ea_t> &prologueHits() const { return m_prologueHits; }
+
+	// Seconds spent building Pass 5 flow charts this run
+	double flowTime() const { return m_flowTime; }
+
+	// Pass 4 seconds spent in finished segments this run, against the time budget. Set after resetStats() to carry on a resumed run's
+	double pass4Used() const { return m_pass4Used; }
+	void setPass4Used(double seconds) { m_pass4Used = seconds; }
+
+	// Reset the Pass 4 prologue signatures to the built-in ones plus a PrologueMatcher::addList() text, which can be empty.
+	// Returns false with the problem in 'error' if the text doesn't parse, leaving just the built-in ones.
+	bool setExtraPrologues(const char *text, std::string &error);
+
+	// Get list of current functions in the segment prior to a processing pass
+	void cacheFunctionList();
+	void clearFunctionList();
+
+	// Rough percent done of the pass being run, from its worklist position or the segment address
+	unsigned int progress() const;
+
+	// Process one item of the pass, returns false when the pass is complete
+	bool pass1Step();	// Find unknown data in code space
+	bool pass2Step();	// Fix missing "align" blocks
+	bool pass3Step();	// Fix lost code instructions
+	bool pass4Step();	// Fix missing functions
+	bool pass5Step();	// Fix incorrect tail call blocks
+
+	PassStats stats;
+	FILE *logFile;
+	unsigned int pass1BatchSize;
+	unsigned int alignmentOverride;	// Power of two, 0 for auto detection
+	double pass4Budget;				// Pass 4 seconds for the whole run, 0 for no limit. With a limit the most productive gaps go first
+	unsigned int planThreads;		// Pass 4 gap plan threads, 0 for one per core
+	std::vector<std::string> extraNoRetNames;	// Lower case name fragments of no-return callees, in addition to the built-in ones
+
+private:
+	bool tryFunction(ea_t codeStart, ea_t &current);
+	void processFuncGap(ea_t start, ea_t end);
+	void processFunc(const FuncInfo &f);
+	void processMultiTail(const FuncInfo &f);
+	bool hasOutsideCref(const FuncInfo &f, ea_t ea);
+	const std::vector<FlowBlock> *flowChart(ea_t funcEA);
+	void makeUnknown(ea_t start, ea_t end);
+	void log(const char *format, ...);
+	bool nextPass1Range();
+	void queueUnknown(ea_t start, ea_t end);
+	void flushUnknowns();
+	REF_ACCESS classifyRef(ea_t eaDRef, flags64_t flags);
+	void invalidateRefClasses(ea_t start, ea_t end);
+	bool loadSegmentBytes();
+	const unsigned char *segmentBytes();
+	bool isPadding(ea_t ea, flags64_t flags);
+	size_t nopInsnLength(ea_t ea);
+	void buildXrefMap();
+	bool maybeXref(ea_t ea);
+	void refreshXrefMap(ea_t start, ea_t end);
+	bool isFreePadding(ea_t start, ea_t end);
+	bool nextPass3Run();
+	bool isPlausibleCode(ea_t ea, ea_t end);
+	size_t lowerFuncIndex(ea_t ea);
+	void collectGaps();
+	bool buildGapList();
+	bool gapHasCode(ea_t start, ea_t end);
+	size_t gapCodeBytes(ea_t start, ea_t end);
+	void planGap(FuncGap &gap, std::vector<ea_t> &prologueHits);
+	void planGaps(size_t first, size_t last);
+	bool isPlannedCode(ea_t ea);
+	bool isAnchored(const unsigned char *bytes, size_t offset) const;
+	bool isPrologueSeed(ea_t ea, flags64_t flags);
+	bool buildNoRetSet();
+	bool buildTailIndex();
+
+	Database &m_db;
+	ea_t m_segStart, m_segEnd;
+	ea_t m_currentAddress, m_lastAddress;
+	ea_t m_seekEA;		// Pass 4/5 worklist entries below this are skipped, when resuming
+	std::vector<unsigned char> m_segBytes;	// Segment byte snapshot, the passes don't change bytes
+	size_t m_segBytesRead;
+	bool m_segBytesValid;
+	bool m_seg64;
+	ea_t m_loadedStart, m_loadedEnd;	// Database address range, for the decoder's direct call and branch target check
+	unsigned int m_alignment;
+	unsigned int m_alignHistogram[ALIGN_HISTOGRAM_SIZE];
+	std::vector<unsigned long long> m_xrefMap;	// Segment bitmap of addresses that might have xrefs
+	ea_t m_xrefMapEA;		// Built below this
+	bool m_xrefMapValid;
+	double m_xrefMapTime;
+	int m_pass1Loops;
+	ea_t m_pass1RangeEnd;
+	size_t m_pass1RangeIndex;
+	std::vector<EaRange> m_pass1Ranges;		// This sweep's worklist
+	std::vector<EaRange> m_pass1Changed;	// Next sweep's worklist
+	std::vector<EaRange> m_pass1Batch;		// Pending unknown conversions
+	ea_t m_pass3RunEnd;
+
+	// Decoded access class by referencing instruction address, per run.
+	// Along with the flags at decode time so a re-analysed instruction is a miss.
+	struct RefClass
+	{
+		flags64_t flags;
+		REF_ACCESS access;
+	};
+	std::map<ea_t, RefClass> m_refClassCache;
+	size_t m_funcIndex;
+	FuncSnapshot m_funcList;
+	std::vector<FuncGap> m_gapList;		// Pass 4 worklist
+	bool m_gapListStarted;
+	bool m_gapListValid;
+	size_t m_gapPlanned;	// Gaps planned and checked so far, of which the first 'm_gapKept' are kept
+	size_t m_gapKept;
+	std::vector<unsigned char> m_gapPlan;	// Decoder verdict by aligned gap address, a GAP_PLAN value
+	ea_t m_gapPlanBase;
+	unsigned int m_gapPlanThreads;
+	double m_gapPlanTime;
+	std::vector<ea_t> m_prologueHits;		// Sorted prologue signature matches in the planned gaps
+	PrologueMatcher m_prologues32, m_prologues64;
+	std::unordered_set<ea_t> m_noRetCallees;	// Functions and imports calls to which don't return, built once per run
+	bool m_noRetValid;
+	size_t m_noRetIndex;
+	std::vector<NameInfo> m_noRetNames;
+	bool m_noRetNamesRead;
+	TailIndex m_tailIndex;
+	ea_t m_tailIndexEA;		// Next function chunk to index
+	bool m_tailIndexStarted;
+	bool m_tailIndexValid;
+	std::vector<ea_t> m_tailOwners;		// Pass 5 worklist, functions in the segment that have tail chunks
+	std::unordered_map<ea_t, std::vector<FlowBlock> > m_flowCache;	// Pass 5 flow charts by function, dropped when the function changes
+	double m_flowTime;
+	double m_pass4Used;					// Pass 4 seconds spent in earlier segments
+	double m_pass4Start;
+};
+
+// Returns TRUE if flag byte is possibly a typical alignment byte
+bool isAlignByte(flags64_t flags, void *ud = NULL);
+
+// Return if flag is data type we want to convert to unknown bytes
+bool isData(flags64_t flags, void *ud = NULL);
@@ -0,0 +1,134 @@
+
+// ExtraPass pass pipeline
+#include "Pipeline.h"
+#include <chrono>
+#include <string.h>
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int Pipeline::add(const char *name, const char *title, PipelineStage::StepFunc step, bool usesFuncList, PipelineStage::HookFunc setup, PipelineStage::HookFunc teardown)
+{
+	PipelineStage stage;
+	stage.name = name;
+	stage.title = title;
+	stage.step = step;
+	stage.setup = setup;
+	stage.teardown = teardown;
+	stage.usesFuncList = usesFuncList;
+	stage.runs = 0;
+	stage.steps = 0;
+	stage.time = stage.lastTime = 0.0;
+	m_stages.push_back(stage);
+	return (int) (m_stages.size() - 1);
+}
+
+int Pipeline::find(const char *name) const
+{
+	for (size_t i = 0; i < m_stages.size(); i++)
+	{
+		if (m_stages[i].name == name)
+			return (int) i;
+	}
+	return -1;
+}
+
+bool Pipeline::setOrder(const char *order)
+{
+	std::vector<int> stages;
+	std::string name;
+	for (const char *p = order; ; p++)
+	{
+		if (!*p || (*p == ',') || (*p == ';'))
+		{
+			if (!name.empty())
+			{
+				int index = find(name.c_str());
+				if (index < 0)
+					return false;
+				stages.push_back(index);
+			}
+			name.clear();
+			if (!*p)
+				break;
+		}
+		else
+		if (*p != ' ')
+			name += *p;
+	}
+
+	m_order.swap(stages);
+	return true;
+}
+
+void Pipeline::resetStats()
+{
+	for (size_t i = 0; i < m_stages.size(); i++)
+	{
+		PipelineStage &stage = m_stages[i];
+		stage.runs = 0;
+		stage.steps = 0;
+		stage.time = stage.lastTime = 0.0;
+	}
+}
+
+void Pipeline::begin()
+{
+	m_position = 0;
+	m_started = false;
+	m_seekEA = BADADDR;
+}
+
+void Pipeline::begin(size_t position, ea_t cursor)
+{
+	m_position = position;
+	m_started = false;
+	m_seekEA = cursor;
+}
+
+const PipelineStage *Pipeline::current() const
+{
+	return((m_position < m_order.size()) ? &m_stages[m_order[m_position]] : NULL);
+}
+
+bool Pipeline::step()
+{
+	if (m_position >= m_order.size())
+		return false;
+
+	PipelineStage &stage = m_stages[m_order[m_position]];
+	if (!m_started)
+	{
+		// Top of code seg
+		m_stageStart = now();
+		m_passes.rewind();
+		if (m_seekEA != BADADDR)
+		{
+			m_passes.seek(m_seekEA);
+			m_seekEA = BADADDR;
+		}
+		if (stage.usesFuncList)
+			m_passes.cacheFunctionList();
+		if (stage.setup)
+			stage.setup(*this, stage);
+		stage.runs++;
+		m_started = true;
+	}
+
+	stage.steps++;
+	if ((m_passes.*stage.step)())
+		return true;
+
+	// Stage complete
+	if (stage.usesFuncList)
+		m_passes.clearFunctionList();
+	stage.lastTime = (now() - m_stageStart);
+	if (stage.teardown)
+		stage.teardown(*this, stage);
+	stage.time += stage.lastTime;
+	m_started = false;
+	m_position++;
+	return(m_position < m_order.size());
+}
@@ -0,0 +1,78 @@
+
+// ExtraPass pass pipeline
+// The passes are registered stages run in a configurable order over each code segment.
+#pragma once
+#include "Passes.h"
+#include <string>
+#include <vector>
+
+class Pipeline;
+
+// A registered pass stage
+struct PipelineStage
+{
+	typedef bool (Passes::*StepFunc)();
+	typedef void (*HookFunc)(Pipeline &pipeline, PipelineStage &stage);
+
+	std::string name;	// Id in a stage order list, E.G. "pass4"
+	std::string title;	// Progress heading
+	StepFunc step;		// Process one item, returns false when the stage is complete
+	HookFunc setup;		// Optional, after the rewind
+	HookFunc teardown;	// Optional, before moving on
+	bool usesFuncList;	// Needs Passes::cacheFunctionList() for its run
+
+	// Per-run counters, over all segments and repeats
+	unsigned int runs;
+	unsigned long long steps;
+	double time;		// Seconds, including setup and teardown
+	double lastTime;	// This stage run's seconds, valid in teardown
+};
+
+// Runs the stage order list over the current segment one step at a time, so the driver can check for user break, etc.
+// Stages share the Passes object and its segment cursor, so they run one after another; the same stage can be listed more than once.
+class Pipeline
+{
+public:
+	Pipeline(Passes &passes) : m_passes(passes), m_position(0), m_started(false), m_stageStart(0.0), m_seekEA(BADADDR) {}
+
+	// Register a stage, returns its index. Registration order is the default run order
+	int add(const char *name, const char *title, PipelineStage::StepFunc step, bool usesFuncList, PipelineStage::HookFunc setup = NULL, PipelineStage::HookFunc teardown = NULL);
+	int find(const char *name) const;
+
+	size_t stageCount() const { return m_stages.size(); }
+	PipelineStage &stage(size_t index) { return m_stages[index]; }
+	const PipelineStage &stage(size_t index) const { return m_stages[index]; }
+	Passes &passes() { return m_passes; }
+
+	// Set the run order from a list of stage names separated by ',' or ';', returns false on an unknown name and leaves the order unchanged
+	bool setOrder(const char *order);
+	void setOrder(const std::vector<int> &order) { m_order = order; }
+	const std::vector<int> &order() const { return m_order; }
+
+	void resetStats();
+
+	// Start the order over, for a new segment
+	void begin();
+
+	// Start at an order position instead, resuming its stage at a Passes::cursor() address, or BADADDR for the top
+	void begin(size_t position, ea_t cursor);
+
+	// Order position, and if its stage has been started
+	size_t position() const { return m_position; }
+	bool started() const { return m_started; }
+
+	// Process one step of the current stage, returns false when all stages are complete
+	bool step();
+
+	// Stage being run, or NULL when done
+	const PipelineStage *current() const;
+
+private:
+	Passes &m_passes;
+	std::vector<PipelineStage> m_stages;
+	std::vector<int> m_order;	// Stage indexes
+	size_t m_position;
+	bool m_started;
+	double m_stageStart;
+	ea_t m_seekEA;
+};
@@ -0,0 +1,287 @@
+
+// Function prologue signature matching over a segment byte snapshot
+#include "PrologueScan.h"
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define SCAN_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline unsigned int lowestBit(unsigned int mask) { unsigned long index; _BitScanForward(&index, mask); return index; }
+#else
+static inline unsigned int lowestBit(unsigned int mask) { return __builtin_ctz(mask); }
+#endif
+
+// Typical MSVC and Intel compiler function entry sequences
+static const PrologueSig defaultSigs[] =
+{
+	// x86
+	{ "mov edi,edi; push ebp; mov ebp,esp",	"8B FF 55 8B EC",			32 },	// Hot-patch pad
+	{ "push ebp; mov ebp,esp",				"55 8B EC",					32 },
+	{ "push ebp; mov ebp,esp",				"55 89 E5",					32 },
+	{ "sub esp,imm8",						"83 EC ??",					32 },
+	{ "sub esp,imm32",						"81 EC ?? ?? ?? ??",		32 },
+	{ "push ebx; mov ebx,esp",				"53 8B DC",					32 },
+
+	// x64
+	{ "mov [rsp+x],rbx",					"48 89 5C 24 ??",			64 },
+	{ "mov [rsp+x],rcx",					"48 89 4C 24 ??",			64 },
+	{ "mov [rsp+x],rdx",					"48 89 54 24 ??",			64 },
+	{ "mov [rsp+x],rbp",					"48 89 6C 24 ??",			64 },
+	{ "mov [rsp+x],rsi",					"48 89 74 24 ??",			64 },
+	{ "mov [rsp+x],rdi",					"48 89 7C 24 ??",			64 },
+	{ "mov [rsp+x],r8",						"4C 89 44 24 ??",			64 },
+	{ "mov [rsp+x],r9",						"4C 89 4C 24 ??",			64 },
+	{ "mov [rsp+x],edx",					"89 54 24 ??",				64 },
+	{ "sub rsp,imm8",						"48 83 EC ??",				64 },
+	{ "sub rsp,imm32",						"48 81 EC ?? ?? ?? ??",		64 },
+	{ "mov rax,rsp",						"48 8B C4",					64 },
+	{ "mov r11,rsp",						"4C 8B DC",					64 },
+	{ "push rbx; sub rsp,imm8",				"40 53 48 83 EC ??",		64 },
+	{ "push rbp",							"40 55",					64 },
+	{ "push rsi",							"40 56",					64 },
+	{ "push rdi",							"40 57",					64 },
+	{ "push rbx; sub rsp,imm8",				"53 48 83 EC ??",			64 },
+	{ "push rbp; mov rbp,rsp",				"55 48 8B EC",				64 },
+	{ "push rbp; mov rbp,rsp",				"55 48 89 E5",				64 },
+	{ "push r14; sub rsp,imm8",				"41 56 48 83 EC ??",		64 },
+	{ "push r15; sub rsp,imm8",				"41 57 48 83 EC ??",		64 },
+};
+
+void PrologueMatcher::addDefaults(bool is64)
+{
+	for (size_t i = 0; i < (sizeof(defaultSigs) / sizeof(defaultSigs[0])); i++)
+	{
+		if ((defaultSigs[i].bitness == 0) || (defaultSigs[i].bitness == (is64 ? 64 : 32)))
+			add(defaultSigs[i].name, defaultSigs[i].pattern);
+	}
+}
+
+static int hexValue(char c)
+{
+	if ((c >= '0') && (c <= '9')) return(c - '0');
+	c = (char) toupper((unsigned char) c);
+	if ((c >= 'A') && (c <= 'F')) return((c - 'A') + 10);
+	return -1;
+}
+
+bool PrologueMatcher::add(const char *name, const char *pattern)
+{
+	Sig sig;
+	sig.name = name;
+	sig.length = 0;
+	memset(sig.bytes, 0, sizeof(sig.bytes));
+	memset(sig.mask, 0, sizeof(sig.mask));
+
+	const char *p = pattern;
+	while (*p)
+	{
+		if (*p == ' ')
+		{
+			p++;
+			continue;
+		}
+		if (sig.length >= PROLOGUE_MAX_BYTES)
+			return false;
+
+		if ((p[0] == '?') && (p[1] == '?'))
+			sig.mask[sig.length] = 0;
+		else
+		{
+			int high = hexValue(p[0]), low = hexValue(p[1]);
+			if ((high < 0) || (low < 0))
+				return false;
+			sig.bytes[sig.length] = (unsigned char) ((high << 4) | low);
+			sig.mask[sig.length] = 0xFF;
+		}
+		sig.length++;
+		p += 2;
+	}
+
+	// Needs a fixed lead pair for the prefilter
+	if ((sig.length < 2) || (sig.mask[0] != 0xFF) || (sig.mask[1] != 0xFF))
+		return false;
+
+	unsigned short lead = (unsigned short) (sig.bytes[0] | (sig.bytes[1] << 8));
+	bool found = false;
+	for (size_t i = 0; i < m_leads.size(); i++)
+	{
+		if (m_leads[i] == lead)
+		{
+			found = true;
+			break;
+		}
+	}
+	if (!found)
+	{
+		if (m_leads.size() >= PROLOGUE_MAX_LEADS)
+			return false;
+		m_leads.push_back(lead);
+	}
+
+	m_sigs.push_back(sig);
+	return true;
+}
+
+bool PrologueMatcher::addList(const char *text, bool is64, std::string &error)
+{
+	int lineNumber = 0;
+	for (const char *line = text; line && *line;)
+	{
+		const char *end = strchr(line, '\n');
+		std::string entry(line, (end ? (size_t) (end - line) : strlen(line)));
+		line = (end ? (end + 1) : NULL);
+		lineNumber++;
+
+		// Comment and blank lines
+		size_t comment = entry.find('#');
+		if (comment != std::string::npos)
+			entry.erase(comment);
+		size_t first = entry.find_first_not_of(" \t\r");
+		if (first == std::string::npos)
+			continue;
+		entry.erase(0, first);
+
+		std::string where = ("line " + std::to_string(lineNumber) + ": ");
+		size_t separator = entry.find(';');
+		size_t space = entry.find_first_of(" \t");
+		if ((separator == std::string::npos) || (space == std::string::npos) || (space > separator))
+		{
+			error = (where + "expected \"<32|64|all> <pattern> ; <name>\"");
+			return false;
+		}
+
+		std::string bitness = entry.substr(0, space);
+		std::string pattern = entry.substr(space, (separator - space));
+		std::string name = entry.substr(separator + 1);
+		for (size_t i = 0; i < pattern.size(); i++)
+		{
+			if ((pattern[i] == '\t') || (pattern[i] == '\r'))
+				pattern[i] = ' ';
+		}
+		name.erase(0, std::min(name.size(), name.find_first_not_of(" \t")));
+		name.erase(name.find_last_not_of(" \t\r") + 1);
+
+		if ((bitness != "32") && (bitness != "64") && (bitness != "all"))
+		{
+			error = (where + "bitness \"" + bitness + "\" isn't 32, 64 or all");
+			return false;
+		}
+		if ((bitness != "all") && ((bitness == "64") != is64))
+			continue;
+		if (!add((name.empty() ? pattern.c_str() : name.c_str()), pattern.c_str()))
+		{
+			error = (where + "bad pattern, or too many distinct first byte pairs");
+			return false;
+		}
+	}
+	return true;
+}
+
+int PrologueMatcher::match(const unsigned char *buffer, size_t size) const
+{
+	int best = -1;
+	size_t bestLength = 0;
+	for (size_t i = 0; i < m_sigs.size(); i++)
+	{
+		const Sig &sig = m_sigs[i];
+		if ((sig.length > size) || (sig.length <= bestLength))
+			continue;
+
+		size_t j = 0;
+		for (; j < sig.length; j++)
+		{
+			if ((buffer[j] & sig.mask[j]) != sig.bytes[j])
+				break;
+		}
+		if (j == sig.length)
+		{
+			best = (int) i;
+			bestLength = sig.length;
+		}
+	}
+	return best;
+}
+
+size_t PrologueMatcher::find(const unsigned char *buffer, size_t size, size_t offset, int &index) const
+{
+	index = -1;
+	if (m_leads.empty())
+		return size;
+	size_t i = offset;
+
+	// Mask of the positions where a lead pair starts, each one checked in full
+	#if defined(SCAN_AVX2)
+	const size_t leadCount = m_leads.size();
+	__m256i firsts[PROLOGUE_MAX_LEADS], seconds[PROLOGUE_MAX_LEADS];
+	for (size_t k = 0; k < leadCount; k++)
+	{
+		firsts[k] = _mm256_set1_epi8((char) (m_leads[k] & 0xFF));
+		seconds[k] = _mm256_set1_epi8((char) (m_leads[k] >> 8));
+	}
+	for (; (i + 33) <= size; i += 32)
+	{
+		__m256i v0 = _mm256_loadu_si256((const __m256i *) (buffer + i));
+		__m256i v1 = _mm256_loadu_si256((const __m256i *) (buffer + i + 1));
+		__m256i m = _mm256_setzero_si256();
+		for (size_t k = 0; k < leadCount; k++)
+			m = _mm256_or_si256(m, _mm256_and_si256(_mm256_cmpeq_epi8(v0, firsts[k]), _mm256_cmpeq_epi8(v1, seconds[k])));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(m);
+		while (mask)
+		{
+			size_t at = (i + lowestBit(mask));
+			if ((index = match(buffer + at, size - at)) >= 0)
+				return at;
+			mask &= (mask - 1);
+		}
+	}
+	#elif defined(SCAN_SSE2)
+	const size_t leadCount = m_leads.size();
+	__m128i firsts[PROLOGUE_MAX_LEADS], seconds[PROLOGUE_MAX_LEADS];
+	for (size_t k = 0; k < leadCount; k++)
+	{
+		firsts[k] = _mm_set1_epi8((char) (m_leads[k] & 0xFF));
+		seconds[k] = _mm_set1_epi8((char) (m_leads[k] >> 8));
+	}
+	for (; (i + 17) <= size; i += 16)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *) (buffer + i));
+		__m128i v1 = _mm_loadu_si128((const __m128i *) (buffer + i + 1));
+		__m128i m = _mm_setzero_si128();
+		for (size_t k = 0; k < leadCount; k++)
+			m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi8(v0, firsts[k]), _mm_cmpeq_epi8(v1, seconds[k])));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(m);
+		while (mask)
+		{
+			size_t at = (i + lowestBit(mask));
+			if ((index = match(buffer + at, size - at)) >= 0)
+				return at;
+			mask &= (mask - 1);
+		}
+	}
+	#endif
+
+	// Scalar fallback and remainder
+	for (; (i + 1) < size; i++)
+	{
+		unsigned short lead = (unsigned short) (buffer[i] | (buffer[i + 1] << 8));
+		for (size_t k = 0; k < m_leads.size(); k++)
+		{
+			if (m_leads[k] == lead)
+			{
+				if ((index = match(buffer + i, size - i)) >= 0)
+					return i;
+				break;
+			}
+		}
+	}
+	return size;
+}
@@ -0,0 +1,57 @@
+
+// Function prologue signature matching over a segment byte snapshot
+#pragma once
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define PROLOGUE_MAX_BYTES 16
+#define PROLOGUE_MAX_LEADS 32	// Distinct lead byte pairs
+
+// Function prologue signature.
+// The pattern is hex bytes with "??" wildcards. The first two bytes must be fixed, they're what the prefilter looks for.
+struct PrologueSig
+{
+	const char *name;
+	const char *pattern;
+	int bitness;	// 32, 64, or 0 for both
+};
+
+// Matches a set of prologue signatures. A vector prefilter finds the signature lead byte pairs, then each is checked in full
+class PrologueMatcher
+{
+public:
+	PrologueMatcher() {}
+	explicit PrologueMatcher(bool is64) { addDefaults(is64); }
+
+	// Add the built-in MSVC/Intel prologue signatures for the mode
+	void addDefaults(bool is64);
+
+	// Add a signature, returns false if the pattern doesn't parse
+	bool add(const char *name, const char *pattern);
+
+	// Add signatures from text, one per line: "<32|64|all> <pattern> ; <name>", '#' starts a comment.
+	// Lines for the other mode are skipped. On a bad line returns false with the line and problem in 'error'
+	bool addList(const char *text, bool is64, std::string &error);
+
+	size_t size() const { return m_sigs.size(); }
+	const char *name(int index) const { return m_sigs[index].name.c_str(); }
+
+	// Index of the longest signature matching at the buffer start, or -1 if none
+	int match(const unsigned char *buffer, size_t size) const;
+
+	// Offset of the next signature match at or after 'offset', or 'size' if none. 'index' gets the signature
+	size_t find(const unsigned char *buffer, size_t size, size_t offset, int &index) const;
+
+private:
+	struct Sig
+	{
+		std::string name;
+		unsigned char bytes[PROLOGUE_MAX_BYTES];
+		unsigned char mask[PROLOGUE_MAX_BYTES];
+		size_t length;
+	};
+
+	std::vector<Sig> m_sigs;
+	std::vector<unsigned short> m_leads;	// Distinct lead byte pairs, first byte in the low byte
+};
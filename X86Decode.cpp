@@ -0,0 +1,428 @@
+
+// Table driven x86/x64 instruction length and class decoder
+#include "X86Decode.h"
+
+// Opcode attributes
+enum
+{
+	M   = 0x0001,	// Has a ModRM byte
+	I8  = 0x0002,	// imm8
+	I16 = 0x0004,	// imm16
+	IZ  = 0x0008,	// imm16/32 by operand size
+	IV  = 0x0010,	// imm16/32/64 by operand size (mov reg, imm)
+	J8  = 0x0020,	// rel8
+	JZ  = 0x0040,	// rel16/32
+	AD  = 0x0080,	// moffs by address size
+	FP  = 0x0100,	// Far pointer, seg:offset
+	GR  = 0x0200,	// Group, the ModRM reg field picks the instruction
+	PX  = 0x0400,	// Legacy prefix
+	NV  = 0x0800,	// Invalid
+	N64 = 0x1000,	// Invalid in 64 bit mode
+	RR  = 0x2000,	// Rare in compiler generated user code
+	ES  = 0x4000,	// Escape to another map, or VEX/EVEX
+};
+
+// One byte opcode map
+static const unsigned short oneByte[256] =
+{
+	/* 00 */ M,    M,    M,    M,    I8,   IZ,   N64|RR, N64|RR, M,    M,    M,    M,    I8,   IZ,   N64|RR, ES,
+	/* 10 */ M,    M,    M,    M,    I8,   IZ,   N64|RR, N64|RR, M,    M,    M,    M,    I8,   IZ,   N64|RR, N64|RR,
+	/* 20 */ M,    M,    M,    M,    I8,   IZ,   PX,     N64|RR, M,    M,    M,    M,    I8,   IZ,   PX,     N64|RR,
+	/* 30 */ M,    M,    M,    M,    I8,   IZ,   PX,     N64|RR, M,    M,    M,    M,    I8,   IZ,   PX,     N64|RR,
+	/* 40 */ 0,    0,    0,    0,    0,    0,    0,      0,      0,    0,    0,    0,    0,    0,    0,      0,
+	/* 50 */ 0,    0,    0,    0,    0,    0,    0,      0,      0,    0,    0,    0,    0,    0,    0,      0,
+	/* 60 */ N64|RR, N64|RR, ES, M,  PX,   PX,   PX,     PX,     IZ,   M|IZ, I8,   M|I8, RR,   RR,   RR,     RR,
+	/* 70 */ J8,   J8,   J8,   J8,   J8,   J8,   J8,     J8,     J8,   J8,   J8,   J8,   J8,   J8,   J8,     J8,
+	/* 80 */ M|I8, M|IZ, M|I8|N64, M|I8, M,  M,    M,      M,      M,    M,    M,    M,    M,    M,    M,      M|GR,
+	/* 90 */ 0,    0,    0,    0,    0,    0,    0,      0,      0,    0,    FP|N64|RR, 0, 0,  0,    0,      0,
+	/* A0 */ AD,   AD,   AD,   AD,   0,    0,    0,      0,      I8,   IZ,   0,    0,    0,    0,    0,      0,
+	/* B0 */ I8,   I8,   I8,   I8,   I8,   I8,   I8,     I8,     IV,   IV,   IV,   IV,   IV,   IV,   IV,     IV,
+	/* C0 */ M|I8, M|I8, I16,  0,    ES,   ES,   M|I8|GR, M|IZ|GR, I16|I8, 0, I16|RR, RR, 0,    I8|RR, N64|RR, RR,
+	/* D0 */ M,    M,    M,    M,    I8|N64|RR, I8|N64|RR, N64|RR, RR, M, M, M,    M,    M,    M,    M,      M,
+	/* E0 */ J8,   J8,   J8,   J8,   I8|RR, I8|RR, I8|RR, I8|RR,  JZ,   JZ,   FP|N64|RR, J8, RR, RR,  RR,     RR,
+	/* F0 */ PX,   RR,   PX,   PX,   RR,   0,    M|GR,   M|GR,   0,    0,    RR,   RR,   0,    0,    M|GR,   M|GR,
+};
+
+// Two byte 0F xx opcode map
+static const unsigned short twoByte[256] =
+{
+	/* 00 */ M|RR, M|RR, M|RR, M|RR, NV,   0,    RR,   0,    RR,   RR,   NV,   0,    NV,   M,    RR,   M|I8|RR,
+	/* 10 */ M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+	/* 20 */ M|RR, M|RR, M|RR, M|RR, NV,   NV,   NV,   NV,   M,    M,    M,    M,    M,    M,    M,    M,
+	/* 30 */ RR,   0,    RR,   RR,   RR,   RR,   NV,   RR,   ES,   NV,   ES,   NV,   NV,   NV,   NV,   NV,
+	/* 40 */ M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+	/* 50 */ M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+	/* 60 */ M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+	/* 70 */ M|I8, M|I8, M|I8, M|I8, M,    M,    M,    0,    M,    M,    M,    M,    M,    M,    M,    M,
+	/* 80 */ JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,   JZ,
+	/* 90 */ M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+	/* A0 */ 0,    0,    0,    M,    M|I8, M,    NV,   NV,   0,    0,    RR,   M,    M|I8, M,    M,    M,
+	/* B0 */ M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M|I8, M,    M,    M,    M,    M,
+	/* C0 */ M,    M,    M|I8, M,    M|I8, M|I8, M|I8, M,    0,    0,    0,    0,    0,    0,    0,    0,
+	/* D0 */ M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+	/* E0 */ M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+	/* F0 */ M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+};
+
+static inline long long readRel(const unsigned char *p, int size)
+{
+	switch (size)
+	{
+		case 1: return (signed char) p[0];
+		case 2: return (short) (p[0] | (p[1] << 8));
+		default: return (int) (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24));
+	};
+}
+
+int x86Decode(const unsigned char *buffer, size_t size, ea_t ea, bool is64, InsnInfo &insn, bool *rare)
+{
+	const size_t MAX_INSN_LENGTH = 15;
+	if (size > MAX_INSN_LENGTH)
+		size = MAX_INSN_LENGTH;
+
+	insn.ea = ea;
+	insn.size = 0;
+	insn.iclass = IC_OTHER;
+	insn.target = BADADDR;
+	bool isRare = false;
+
+	// Legacy prefixes, then REX right before the opcode in 64 bit mode
+	bool opSize16 = false, addrSize = false, repz = false, legacySSE = false;
+	unsigned char rex = 0;
+	size_t i = 0;
+	for (;; i++)
+	{
+		if (i >= size)
+			return 0;
+		unsigned char b = buffer[i];
+		if (is64 && ((b & 0xF0) == 0x40))
+		{
+			rex = b;
+			continue;
+		}
+		if (!(oneByte[b] & PX))
+			break;
+
+		rex = 0;
+		if (b == 0x66) { opSize16 = true; legacySSE = true; }
+		else
+		if (b == 0x67) addrSize = true;
+		else
+		if (b == 0xF3) { repz = true; legacySSE = true; }
+		else
+		if ((b == 0xF2) || (b == 0xF0)) legacySSE = true;
+	}
+	bool rexW = ((rex & 8) != 0);
+	if (rexW)
+		opSize16 = false;
+
+	unsigned char op = buffer[i++];
+	unsigned short attr = oneByte[op];
+	int map = 0;	// 0 one byte, 1 0F, 2 0F38, 3 0F3A
+	bool vex = false;
+
+	if (attr & ES)
+	{
+		if (op == 0x0F)
+		{
+			if (i >= size)
+				return 0;
+			op = buffer[i++];
+			attr = twoByte[op];
+			map = 1;
+			if (attr & ES)
+			{
+				if (i >= size)
+					return 0;
+				map = ((op == 0x38) ? 2 : 3);
+				op = buffer[i++];
+				attr = ((map == 2) ? M : (M | I8));
+			}
+		}
+		else
+		{
+			// VEX (C4, C5) and EVEX (62).
+			// In 32 bit mode only when the next byte's ModRM mod would be 3, else it's LES, LDS, or BOUND.
+			if (i >= size)
+				return 0;
+			if (is64 || ((buffer[i] & 0xC0) == 0xC0))
+			{
+				if (rex || legacySSE)
+					return 0;
+				size_t prefixLength = ((op == 0xC5) ? 1 : ((op == 0xC4) ? 2 : 3));
+				if ((i + prefixLength) >= size)
+					return 0;
+				if (op == 0xC5)
+					map = 1;
+				else
+				if (op == 0xC4)
+				{
+					map = (buffer[i] & 0x1F);
+					if ((map < 1) || (map > 3))
+						return 0;
+				}
+				else
+				{
+					// EVEX, maps 5 and 6 are AVX512-FP16
+					map = (buffer[i] & 7);
+					if ((map == 0) || (map == 4) || (map == 7) || !(buffer[i + 1] & 0x04))
+						return 0;
+				}
+				i += prefixLength;
+				op = buffer[i++];
+				vex = true;
+
+				if (map == 1)
+					attr = ((op == 0x77) ? 0 : (M | (twoByte[op] & I8)));	// vzeroupper/vzeroall have no ModRM
+				else
+				if (map == 3)
+					attr = (M | I8);
+				else
+					attr = M;
+			}
+			else
+				attr = (M | RR);
+		}
+	}
+
+	if (attr & NV)
+		return 0;
+	if ((attr & N64) && is64)
+		return 0;
+	if (attr & RR)
+		isRare = true;
+	if ((map == 0) && (op == 0x63) && !is64)
+		isRare = true;	// arpl
+
+	// Classes the passes care about
+	if (!vex)
+	{
+		if (map == 0)
+		{
+			switch (op)
+			{
+				case 0x8D:
+				insn.iclass = IC_LEA;
+				break;
+
+				case 0x8A: case 0xA0:
+				case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: case 0xB7:
+				insn.iclass = IC_MOV_REG_BYTE;
+				break;
+
+				case 0x88: case 0x89: case 0x8B: case 0x8C: case 0x8E: case 0xA1: case 0xA2: case 0xA3:
+				case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+				insn.iclass = IC_MOV;
+				break;
+
+				case 0xC2: case 0xC3: case 0xCA: case 0xCB: case 0xCF:
+				insn.iclass = IC_RET;
+				break;
+
+				case 0xE9: case 0xEB:
+				insn.iclass = IC_JMP;
+				break;
+
+				case 0xEA:
+				insn.iclass = IC_JMP_OTHER;
+				break;
+
+				case 0xE8: case 0x9A:
+				insn.iclass = IC_CALL;
+				break;
+
+				case 0xCC:
+				insn.iclass = IC_INT3;
+				break;
+
+				case 0x90:
+				if (!repz && !(rex & 1))
+					insn.iclass = IC_NOP;
+				break;
+
+				default:
+				if ((op >= 0x70) && (op <= 0x7F))
+					insn.iclass = IC_JCC;
+				break;
+			};
+		}
+		else
+		if (map == 1)
+		{
+			if ((op >= 0x80) && (op <= 0x8F))
+				insn.iclass = IC_JCC;
+			else
+			if ((op == 0xB6) || (op == 0xB7) || (op == 0xBE) || (op == 0xBF))
+				insn.iclass = IC_MOVX;
+			else
+			if (op == 0x1F)
+				insn.iclass = IC_NOP;
+			else
+			if ((op == 0x05) || (op == 0x07))
+				insn.iclass = IC_RET;
+		}
+	}
+
+	if (attr & M)
+	{
+		if (i >= size)
+			return 0;
+		unsigned char modrm = buffer[i++];
+		int mod = (modrm >> 6), reg = ((modrm >> 3) & 7), rm = (modrm & 7);
+
+		// mov cr/dr is always the register form
+		if ((map == 1) && (op >= 0x20) && (op <= 0x23))
+			mod = 3;
+
+		// Groups where the reg field picks the instruction
+		if ((map == 0) && (attr & GR))
+		{
+			switch (op)
+			{
+				case 0xF6:
+				if (reg < 2)
+					attr |= I8;	// test
+				break;
+
+				case 0xF7:
+				if (reg < 2)
+					attr |= IZ;
+				break;
+
+				case 0xFE:
+				if (reg > 1)
+					return 0;
+				break;
+
+				case 0xFF:
+				{
+					if (reg == 7)
+						return 0;
+					if (((reg == 3) || (reg == 5)) && (mod == 3))
+						return 0;
+					if ((reg == 2) || (reg == 3))
+						insn.iclass = IC_CALL;
+					else
+					if ((reg == 4) || (reg == 5))
+						insn.iclass = IC_JMP_OTHER;
+				}
+				break;
+
+				// pop r/m, anything else is AMD XOP
+				case 0x8F:
+				if (reg != 0)
+					return 0;
+				break;
+
+				// mov r/m, imm; or xabort, xbegin
+				case 0xC6: case 0xC7:
+				if (reg != 0)
+				{
+					if (modrm != 0xF8)
+						return 0;
+					insn.iclass = IC_OTHER;
+				}
+				break;
+			};
+		}
+
+		// lea, les, lds, and bound have no register form
+		if ((map == 0) && ((op == 0x8D) || (op == 0xC4) || (op == 0xC5) || (op == 0x62)) && (mod == 3) && !vex)
+			return 0;
+
+		if (mod != 3)
+		{
+			if (!is64 && addrSize)
+			{
+				// 16 bit addressing
+				if (mod == 1)
+					i += 1;
+				else
+				if ((mod == 2) || ((mod == 0) && (rm == 6)))
+					i += 2;
+			}
+			else
+			{
+				if (rm == 4)
+				{
+					if (i >= size)
+						return 0;
+					unsigned char sib = buffer[i++];
+					if ((mod == 0) && ((sib & 7) == 5))
+						i += 4;
+				}
+				if (mod == 1)
+					i += 1;
+				else
+				if ((mod == 2) || ((mod == 0) && (rm == 5)))
+					i += 4;
+			}
+		}
+	}
+
+	// Immediates
+	size_t immZ = (opSize16 ? 2 : 4);
+	if (attr & I8)
+		i += 1;
+	if (attr & I16)
+		i += 2;
+	if (attr & IZ)
+		i += immZ;
+	if (attr & IV)
+		i += (rexW ? 8 : immZ);
+	if (attr & AD)
+		i += (is64 ? (addrSize ? 4 : 8) : (addrSize ? 2 : 4));
+	if (attr & FP)
+		i += (immZ + 2);
+
+	// Relative branch target
+	int relSize = 0;
+	if (attr & J8)
+		relSize = 1;
+	else
+	if (attr & JZ)
+		relSize = ((is64 || !opSize16) ? 4 : 2);
+	if (relSize)
+	{
+		if ((i + relSize) > size)
+			return 0;
+		long long rel = readRel(buffer + i, relSize);
+		i += relSize;
+		insn.target = (ea_t) (ea + i + rel);
+	}
+
+	if (i > size)
+		return 0;
+
+	insn.size = (int) i;
+	if (rare)
+		*rare = isRare;
+	return (int) i;
+}
+
+bool x86Plausible(const unsigned char *buffer, size_t size, ea_t ea, bool is64, int count, ea_t minEA, ea_t maxEA)
+{
+	size_t offset = 0;
+	for (int n = 0; (n < count) && (offset < size); n++)
+	{
+		InsnInfo insn;
+		bool rare = false;
+		int length = x86Decode(buffer + offset, (size - offset), (ea + offset), is64, insn, &rare);
+		if (!length || rare)
+			return false;
+
+		// "add [eax], al", what zero fill decodes as
+		if ((buffer[offset] == 0) && (length == 2) && (buffer[offset + 1] == 0))
+			return false;
+
+		// Direct branches should stay in range
+		if ((insn.target != BADADDR) && ((insn.target < minEA) || (insn.target >= maxEA)))
+			return false;
+
+		// Flow ends
+		offset += length;
+		if ((insn.iclass == IC_RET) || (insn.iclass == IC_JMP) || (insn.iclass == IC_JMP_OTHER) || (insn.iclass == IC_INT3))
+			break;
+	}
+	return true;
+}
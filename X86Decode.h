@@ -0,0 +1,15 @@
+
+// Table driven x86/x64 instruction length and class decoder
+// Self-contained, no SDK, so it works straight from a segment byte snapshot and can be built and fuzzed anywhere.
+// Used to reject candidate addresses before IDA is asked to create an instruction or function there.
+#pragma once
+#include "Database.h"
+
+// Decode the instruction at the buffer start.
+// Returns the length, or 0 if the bytes are not a valid instruction in the mode or run past 'size'.
+// 'rare' is set for privileged, I/O, and legacy instructions compilers don't emit in user code.
+int x86Decode(const unsigned char *buffer, size_t size, ea_t ea, bool is64, InsnInfo &insn, bool *rare = NULL);
+
+// Returns true if up to 'count' instructions from the buffer start, or up to a flow end, decode into something
+// that looks like code: no invalid or rare instructions, no zero fill, and direct calls and branches that land in [minEA, maxEA).
+bool x86Plausible(const unsigned char *buffer, size_t size, ea_t ea, bool is64, int count, ea_t minEA, ea_t maxEA);
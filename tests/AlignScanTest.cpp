@@ -0,0 +1,93 @@
+
+// Vectorized align scan tests, against the byte at a time reference
+#include "Test.h"
+#include "Reference.h"
+#include "SyntheticImage.h"
+#include <string.h>
+
+// Every buffer length and start misalignment around the vector widths, with the match at every position
+TEST(alignscan, findAlignByte)
+{
+	unsigned char buffer[160];
+	for (size_t size = 0; size <= 96; size++)
+	{
+		for (size_t start = 0; start < 32; start++)
+		{
+			memset(buffer, 0x48, sizeof(buffer));
+			CHECK(findAlignByte(buffer + start, size) == size);
+			for (size_t at = 0; at < size; at++)
+			{
+				memset(buffer, 0x48, sizeof(buffer));
+				buffer[start + at] = ((at & 1) ? 0xCC : 0x90);
+				CHECK(findAlignByte(buffer + start, size) == at);
+				if ((at + 1) < size)
+					buffer[start + at + 1] = 0xCC;
+				CHECK(findAlignByte(buffer + start, size) == at);
+			}
+		}
+	}
+}
+
+TEST(alignscan, alignRunLength)
+{
+	unsigned char buffer[160];
+	for (size_t size = 0; size <= 96; size++)
+	{
+		for (size_t length = 0; length <= size; length++)
+		{
+			memset(buffer, 0xCC, sizeof(buffer));
+			buffer[1 + length] = 0x90;
+			CHECK(alignRunLength(buffer + 1, size, 0xCC) == length);
+			CHECK(alignRunLength(buffer + 1, size, 0xCC) == referenceAlignRunLength(buffer + 1, size, 0xCC));
+		}
+	}
+}
+
+TEST(alignscan, findPaddingByte)
+{
+	static const unsigned char leads[] = { 0xCC, 0x90, 0x66, 0x0F, 0x2E, 0x8D, 0x89 };
+	unsigned char buffer[160];
+	for (size_t size = 0; size <= 80; size++)
+	{
+		for (size_t at = 0; at < size; at++)
+		{
+			for (size_t l = 0; l < sizeof(leads); l++)
+			{
+				memset(buffer, 0x48, sizeof(buffer));
+				buffer[3 + at] = leads[l];
+				CHECK(findPaddingByte(buffer + 3, size, true) == referenceFindPaddingByte(buffer + 3, size, true));
+				CHECK(findPaddingByte(buffer + 3, size, false) == referenceFindPaddingByte(buffer + 3, size, false));
+			}
+		}
+	}
+}
+
+// The same runs as the reference over whole images
+TEST(alignscan, findAlignRun)
+{
+	const bool bitness[] = { true, false };
+	for (int b = 0; b < 2; b++)
+	{
+		SyntheticOptions options;
+		options.is64 = bitness[b];
+		options.nopPadding = true;
+		options.dataIslands = true;
+		SyntheticImage image;
+		makeSyntheticImage(options, image);
+
+		const unsigned char *bytes = image.bytes.data();
+		size_t size = image.bytes.size(), offset = 0, runs = 0;
+		for (;;)
+		{
+			AlignRun run, expected;
+			bool found = findAlignRun(bytes, size, offset, image.base, 16, image.is64, run);
+			CHECK(found == referenceFindAlignRun(bytes, size, offset, image.base, 16, image.is64, expected));
+			if (!found)
+				break;
+			CHECK((run.offset == expected.offset) && (run.length == expected.length) && (run.value == expected.value) && (run.multiByte == expected.multiByte));
+			offset = (run.offset + run.length);
+			runs++;
+		}
+		CHECK(runs > (image.funcs.size() / 2));
+	}
+}
@@ -0,0 +1,288 @@
+
+// Benchmark driver over synthetic images
+// Usage: ExtraPassBench [--quick] [section ...], no section runs them all. --quick uses small sizes for a smoke run.
+#include "SyntheticImage.h"
+#include "Reference.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+typedef void (*BenchFunc)(bool quick);
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Per pass times and counts for a full run over an image
+static void benchPasses(bool quick)
+{
+	const bool bitness[] = { true, false };
+	for (int b = 0; b < 2; b++)
+	{
+		SyntheticOptions options;
+		options.size = (quick ? 0x40000 : 0x1000000);
+		options.is64 = bitness[b];
+		options.dataIslands = true;
+		options.nopPadding = true;
+		SyntheticImage image;
+		makeSyntheticImage(options, image);
+		MemoryDatabase db(image.base, image.bytes.data(), image.bytes.size(), image.is64);
+		loadSyntheticImage(image, db);
+		size_t before = countRecovered(image, db);
+
+		Passes passes(db);
+		Pipeline pipeline(passes);
+		addPassStages(pipeline, "pass1,pass2,pass3,pass4,pass5");
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		passes.setSegment(image.base, (image.base + image.bytes.size()));
+		passes.detectAlignment();
+		pipeline.begin();
+		while (pipeline.step())
+			;
+		double seconds = secondsSince(start);
+
+		size_t bogus = 0;
+		size_t after = countRecovered(image, db, &bogus);
+		printf("  %d bit, %u KB, %u functions: %.3fs, recovered %u of %u, bogus %u\n", (image.is64 ? 64 : 32), (unsigned int) (image.bytes.size() / 1024), (unsigned int) image.funcs.size(),
+			seconds, (unsigned int) (after - before), (unsigned int) (image.funcs.size() - before), (unsigned int) bogus);
+		for (size_t i = 0; i < pipeline.stageCount(); i++)
+		{
+			const PipelineStage &stage = pipeline.stage(i);
+			printf("    %s: %.3fs, %llu steps\n", stage.name.c_str(), stage.time, stage.steps);
+		}
+		printf("    xref map: %.3fs, %u KB; gap plan: %.3fs, %u threads\n", passes.xrefMapTime(), (unsigned int) (passes.xrefMapBytes() / 1024), passes.gapPlanTime(), passes.gapPlanThreads());
+	}
+}
+
+// Vectorized align scan against the byte at a time reference, over a padded image and a buffer with no padding bytes
+template <typename ScanFunc> static double timeScan(const std::vector<unsigned char> &bytes, int repeats, ScanFunc scan, size_t &hits)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++)
+	{
+		hits = 0;
+		for (size_t offset = 0; offset < bytes.size(); )
+		{
+			offset += (scan(bytes.data() + offset, bytes.size() - offset) + 1);
+			hits++;
+		}
+	}
+	return(secondsSince(start) / repeats);
+}
+
+static void benchAlignScan(bool quick)
+{
+	#if defined(__AVX2__)
+	printf("  compiled for AVX2\n");
+	#elif defined(__SSE2__) || defined(_M_X64)
+	printf("  compiled for SSE2\n");
+	#else
+	printf("  compiled scalar\n");
+	#endif
+
+	SyntheticOptions options;
+	options.size = (quick ? 0x40000 : 0x1000000);
+	options.nopPadding = true;
+	SyntheticImage image;
+	makeSyntheticImage(options, image);
+	std::vector<unsigned char> plain(image.bytes.size(), 0x48);
+	const int repeats = (quick ? 2 : 10);
+
+	struct Buffer { const char *name; const std::vector<unsigned char> *bytes; } buffers[] = { { "image", &image.bytes }, { "no padding", &plain } };
+	for (size_t i = 0; i < (sizeof(buffers) / sizeof(buffers[0])); i++)
+	{
+		const std::vector<unsigned char> &bytes = *buffers[i].bytes;
+		double mb = ((double) bytes.size() / (1024.0 * 1024.0));
+		size_t hits, expected;
+		double simd = timeScan(bytes, repeats, findAlignByte, hits);
+		double scalar = timeScan(bytes, repeats, referenceFindAlignByte, expected);
+		printf("  %s findAlignByte: %.0f MB/s, reference %.0f MB/s, x%.1f%s\n", buffers[i].name, (mb / simd), (mb / scalar), (scalar / simd), ((hits == expected) ? "" : " MISMATCH"));
+
+		simd = timeScan(bytes, repeats, [](const unsigned char *b, size_t s) { return findPaddingByte(b, s, true); }, hits);
+		scalar = timeScan(bytes, repeats, [](const unsigned char *b, size_t s) { return referenceFindPaddingByte(b, s, true); }, expected);
+		printf("  %s findPaddingByte: %.0f MB/s, reference %.0f MB/s, x%.1f%s\n", buffers[i].name, (mb / simd), (mb / scalar), (scalar / simd), ((hits == expected) ? "" : " MISMATCH"));
+
+		// Whole run walk, as Pass 2 does it
+		size_t runs = 0, expectedRuns = 0;
+		AlignRun run;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; r++)
+		{
+			runs = 0;
+			for (size_t offset = 0; findAlignRun(bytes.data(), bytes.size(), offset, image.base, 16, true, run); offset = (run.offset + run.length))
+				runs++;
+		}
+		simd = (secondsSince(start) / repeats);
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; r++)
+		{
+			expectedRuns = 0;
+			for (size_t offset = 0; referenceFindAlignRun(bytes.data(), bytes.size(), offset, image.base, 16, true, run); offset = (run.offset + run.length))
+				expectedRuns++;
+		}
+		scalar = (secondsSince(start) / repeats);
+		printf("  %s findAlignRun: %.0f MB/s, reference %.0f MB/s, x%.1f, %u runs%s\n", buffers[i].name, (mb / simd), (mb / scalar), (scalar / simd), (unsigned int) runs, ((runs == expectedRuns) ? "" : " MISMATCH"));
+	}
+}
+
+// Pass 4's gap walk: ends of contiguous functions to the next start, rounded up to the alignment
+template <typename EndFunc, typename StartFunc, typename TailsFunc> static unsigned long long gapBytes(size_t count, EndFunc endEA, StartFunc startEA, TailsFunc tailQty)
+{
+	unsigned long long bytes = 0;
+	for (size_t i = 0; (i + 1) < count; i++)
+	{
+		if (tailQty(i) != 0)
+			continue;
+		ea_t start = ((endEA(i) + 15) & ~((ea_t) 15)), end = startEA(i + 1);
+		if (end > start)
+			bytes += (end - start);
+	}
+	return bytes;
+}
+
+// Function list snapshot with a million functions: caching it, and the gap walk over the parallel arrays against an array of FuncInfo
+static void benchSnapshot(bool quick)
+{
+	const size_t count = (quick ? 100000 : 1000000);
+	const ea_t base = 0x140001000ULL;
+	std::vector<unsigned char> bytes((count * 32), 0xCC);
+	for (size_t i = 0; i < count; i++)
+		bytes[i * 32] = 0xC3;
+	MemoryDatabase db(base, bytes.data(), bytes.size(), true);
+	db.setQuiet(true);
+	for (size_t i = 0; i < count; i++)
+	{
+		// Every other function ends short, leaving a gap
+		ea_t start = (base + (i * 32));
+		db.makeCode(start);
+		db.defineFunc(start, (start + ((i & 1) ? 32 : 1)));
+	}
+	// Have the database sort its function order first, so it isn't timed with the snapshot
+	FuncInfo fi;
+	db.getnFunc(0, fi);
+
+	Passes passes(db);
+	passes.setSegment(base, (base + bytes.size()));
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	passes.cacheFunctionList();
+	printf("  %u functions, cacheFunctionList: %.3fs\n", (unsigned int) count, secondsSince(start));
+
+	FuncSnapshot snapshot;
+	std::vector<FuncInfo> infos;
+	snapshot.reserve(count);
+	infos.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		db.getnFunc(i, fi);
+		snapshot.push_back(fi);
+		infos.push_back(fi);
+	}
+
+	const int repeats = (quick ? 5 : 20);
+	unsigned long long soaBytes = 0, aosBytes = 0;
+	start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++)
+		soaBytes = gapBytes(count, [&](size_t i) { return snapshot.endEA[i]; }, [&](size_t i) { return snapshot.startEA[i]; }, [&](size_t i) { return snapshot.tailQty[i]; });
+	double soa = (secondsSince(start) / repeats);
+	start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++)
+		aosBytes = gapBytes(count, [&](size_t i) { return infos[i].endEA; }, [&](size_t i) { return infos[i].startEA; }, [&](size_t i) { return infos[i].tailQty; });
+	double aos = (secondsSince(start) / repeats);
+
+	size_t snapshotSize = (count * (sizeof(ea_t) + sizeof(ea_t) + sizeof(int) + sizeof(unsigned long long)));
+	printf("  gap walk: snapshot %.2fms, FuncInfo array %.2fms, x%.1f%s\n", (soa * 1000.0), (aos * 1000.0), (aos / soa), ((soaBytes == aosBytes) ? "" : " MISMATCH"));
+	printf("  memory: snapshot %u KB, FuncInfo array %u KB\n", (unsigned int) (snapshotSize / 1024), (unsigned int) ((count * sizeof(FuncInfo)) / 1024));
+}
+
+// Prologue signature search, the lead pair prefilter against a full match at every offset
+static void benchPrologue(bool quick)
+{
+	const bool bitness[] = { true, false };
+	for (int b = 0; b < 2; b++)
+	{
+		SyntheticOptions options;
+		options.size = (quick ? 0x40000 : 0x1000000);
+		options.is64 = bitness[b];
+		options.dataIslands = true;
+		SyntheticImage image;
+		makeSyntheticImage(options, image);
+		PrologueMatcher matcher(image.is64);
+		const unsigned char *bytes = image.bytes.data();
+		size_t size = image.bytes.size();
+		double mb = ((double) size / (1024.0 * 1024.0));
+		const int repeats = (quick ? 2 : 5);
+
+		size_t hits = 0, expectedHits = 0;
+		int index;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; r++)
+		{
+			hits = 0;
+			for (size_t at = 0; (at = matcher.find(bytes, size, at, index)) < size; at++)
+				hits++;
+		}
+		double prefilter = (secondsSince(start) / repeats);
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeats; r++)
+		{
+			expectedHits = 0;
+			for (size_t at = 0; (at = referenceFindPrologue(matcher, bytes, size, at, index)) < size; at++)
+				expectedHits++;
+		}
+		double naive = (secondsSince(start) / repeats);
+		printf("  %d bit, %u signatures: %.0f MB/s, every offset %.0f MB/s, x%.1f, %u hits%s\n", (image.is64 ? 64 : 32), (unsigned int) matcher.size(),
+			(mb / prefilter), (mb / naive), (naive / prefilter), (unsigned int) hits, ((hits == expectedHits) ? "" : " MISMATCH"));
+	}
+}
+
+struct BenchSection
+{
+	const char *name;
+	BenchFunc func;
+};
+
+static const BenchSection sections[] =
+{
+	{ "passes", benchPasses },
+	{ "alignscan", benchAlignScan },
+	{ "snapshot", benchSnapshot },
+	{ "prologue", benchPrologue },
+};
+
+int main(int argc, char **argv)
+{
+	bool quick = false;
+	std::vector<std::string> names;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--quick") == 0)
+			quick = true;
+		else
+			names.push_back(argv[i]);
+	}
+
+	int run = 0;
+	for (size_t i = 0; i < (sizeof(sections) / sizeof(sections[0])); i++)
+	{
+		bool selected = names.empty();
+		for (size_t n = 0; n < names.size(); n++)
+			selected |= (names[n] == sections[i].name);
+		if (!selected)
+			continue;
+
+		printf("%s\n", sections[i].name);
+		sections[i].func(quick);
+		run++;
+	}
+
+	if (!run)
+	{
+		printf("No such section\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+
+// Pass 4 gap plan thread count tests
+#include "Test.h"
+#include "SyntheticImage.h"
+
+struct PlanResult
+{
+	unsigned int threads;
+	std::vector<unsigned char> plan;
+	std::vector<ea_t> prologueHits;
+	std::vector<ea_t> funcStarts;
+	unsigned int prologueFuncs;
+	unsigned int funcAddsAvoided;
+};
+
+// Run Passes 3 and 4 with a plan thread count, keeping the plan made in Pass 4's first step
+static void planRun(const SyntheticImage &image, unsigned int threads, PlanResult &result)
+{
+	MemoryDatabase db(image.base, image.bytes.data(), image.bytes.size(), image.is64);
+	loadSyntheticImage(image, db);
+	Passes passes(db);
+	passes.planThreads = threads;
+	Pipeline pipeline(passes);
+	addPassStages(pipeline, "pass3,pass4");
+	passes.setSegment(image.base, (image.base + image.bytes.size()));
+	passes.detectAlignment();
+	pipeline.begin();
+
+	result.threads = 0;
+	while (pipeline.step())
+	{
+		if (!result.threads && passes.gapPlanThreads())
+		{
+			result.threads = passes.gapPlanThreads();
+			result.plan = passes.gapPlan();
+			result.prologueHits = passes.prologueHits();
+		}
+	}
+	funcStarts(db, result.funcStarts);
+	result.prologueFuncs = passes.stats.prologueFuncs;
+	result.funcAddsAvoided = passes.stats.funcAddsAvoided;
+}
+
+// The same plan and functions whatever the thread count, over repeated runs
+TEST(plan, threadCounts)
+{
+	SyntheticOptions options;
+	options.dataIslands = true;
+	options.thunks = true;
+	SyntheticImage image;
+	makeSyntheticImage(options, image);
+
+	PlanResult expected;
+	planRun(image, 1, expected);
+	CHECK(expected.threads == 1);
+	CHECK(!expected.prologueHits.empty());
+	CHECK(expected.funcAddsAvoided > 0);
+
+	const unsigned int counts[] = { 2, 3, 8, 1, 8, 2 };
+	for (size_t i = 0; i < (sizeof(counts) / sizeof(counts[0])); i++)
+	{
+		PlanResult result;
+		planRun(image, counts[i], result);
+		if ((result.plan != expected.plan) || (result.prologueHits != expected.prologueHits) || (result.funcStarts != expected.funcStarts))
+			printf("  %u threads: %u prologue hits, %u functions, expected %u and %u\n", result.threads, (unsigned int) result.prologueHits.size(), (unsigned int) result.funcStarts.size(), (unsigned int) expected.prologueHits.size(), (unsigned int) expected.funcStarts.size());
+		CHECK(result.threads == counts[i]);
+		CHECK(result.plan == expected.plan);
+		CHECK(result.prologueHits == expected.prologueHits);
+		CHECK(result.funcStarts == expected.funcStarts);
+		CHECK(result.prologueFuncs == expected.prologueFuncs);
+		CHECK(result.funcAddsAvoided == expected.funcAddsAvoided);
+	}
+}
@@ -0,0 +1,434 @@
+
+// Pass tests over synthetic images in the in-memory database
+#include "Test.h"
+#include "SyntheticImage.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace DbFlags;
+
+// Most of the functions left as unknown bytes or under bogus data get recovered. The few under data the passes can't
+// fix may get a function on their body instead, but nothing else is made one.
+static void checkRecovery(const SyntheticOptions &options)
+{
+	SyntheticImage image;
+	makeSyntheticImage(options, image);
+	MemoryDatabase db(image.base, image.bytes.data(), image.bytes.size(), image.is64);
+	loadSyntheticImage(image, db);
+	size_t before = countRecovered(image, db);
+
+	Passes passes(db);
+	runAllPasses(passes, image.base, (image.base + image.bytes.size()));
+
+	size_t bogus = 0;
+	size_t after = countRecovered(image, db, &bogus);
+	printf("  functions: %u, defined: %u, recovered: %u, bogus: %u\n", (unsigned int) image.funcs.size(), (unsigned int) before, (unsigned int) (after - before), (unsigned int) bogus);
+	CHECK(after > before);
+	CHECK((after * 100) >= (image.funcs.size() * 95));
+	CHECK((bogus * 100) <= image.funcs.size());
+	CHECK(passes.stats.alignFixes > 0);
+	CHECK(passes.stats.codeFixes > 0);
+}
+
+TEST(passes, recover64)
+{
+	SyntheticOptions options;
+	checkRecovery(options);
+}
+
+TEST(passes, recover32)
+{
+	SyntheticOptions options;
+	options.is64 = false;
+	options.seed = 2;
+	checkRecovery(options);
+}
+
+TEST(passes, recoverNopPadding)
+{
+	SyntheticOptions options;
+	options.nopPadding = true;
+	options.seed = 3;
+	checkRecovery(options);
+}
+
+// Records the largest byte read
+class ReadSizeDatabase : public MemoryDatabase
+{
+public:
+	ReadSizeDatabase(ea_t base, const void *bytes, size_t size, bool is64) : MemoryDatabase(base, bytes, size, is64), largestRead(0) {}
+
+	size_t getBytes(ea_t ea, void *buffer, size_t size)
+	{
+		largestRead = std::max(largestRead, size);
+		return MemoryDatabase::getBytes(ea, buffer, size);
+	}
+
+	size_t largestRead;
+};
+
+// A segment several steps of setup work big recovers the same, with the snapshot read and the gaps planned over steps
+TEST(passes, largeSegment)
+{
+	SyntheticOptions options;
+	options.size = ((BUILD_STEP_BYTES * 5) / 2);
+	options.seed = 4;
+	SyntheticImage image;
+	makeSyntheticImage(options, image);
+	ReadSizeDatabase db(image.base, image.bytes.data(), image.bytes.size(), image.is64);
+	loadSyntheticImage(image, db);
+
+	Passes passes(db);
+	runAllPasses(passes, image.base, (image.base + image.bytes.size()));
+
+	size_t bogus = 0;
+	size_t after = countRecovered(image, db, &bogus);
+	printf("  functions: %u, recovered: %u, bogus: %u, gaps: %u, largest read: %u\n", (unsigned int) image.funcs.size(), (unsigned int) after, (unsigned int) bogus,
+		passes.stats.gapCount, (unsigned int) db.largestRead);
+	CHECK((after * 100) >= (image.funcs.size() * 95));
+	CHECK((bogus * 100) <= image.funcs.size());
+	CHECK(passes.stats.gapCount > GAP_PLAN_STEP);
+	CHECK(db.largestRead <= BUILD_STEP_BYTES);
+}
+
+// Function starts after a run of the default pipeline over a fresh copy of the image
+static void runFresh(const SyntheticImage &image, const char *order, std::vector<ea_t> &starts)
+{
+	MemoryDatabase db(image.base, image.bytes.data(), image.bytes.size(), image.is64);
+	loadSyntheticImage(image, db);
+	Passes passes(db);
+	Pipeline pipeline(passes);
+	addPassStages(pipeline, order);
+	passes.setSegment(image.base, (image.base + image.bytes.size()));
+	passes.detectAlignment();
+	pipeline.begin();
+	while (pipeline.step())
+		;
+	funcStarts(db, starts);
+}
+
+// Stopping a run anywhere and resuming it from its position and cursor, like a checkpoint, gives the same result
+TEST(passes, resume)
+{
+	SyntheticOptions options;
+	options.size = 0x10000;
+	options.dataIslands = true;
+	SyntheticImage image;
+	makeSyntheticImage(options, image);
+
+	const char order[] = "pass1,pass2,pass3,pass4,pass5";
+	std::vector<ea_t> expected;
+	runFresh(image, order, expected);
+
+	const long stops[] = { 1, 50, 500, 2000, 5000, 8000, 12000, 20000 };
+	for (size_t i = 0; i < (sizeof(stops) / sizeof(stops[0])); i++)
+	{
+		MemoryDatabase db(image.base, image.bytes.data(), image.bytes.size(), image.is64);
+		loadSyntheticImage(image, db);
+		ea_t end = (image.base + image.bytes.size());
+
+		size_t position;
+		ea_t cursor;
+		bool more = true;
+		{
+			Passes passes(db);
+			Pipeline pipeline(passes);
+			addPassStages(pipeline, order);
+			passes.setSegment(image.base, end);
+			passes.detectAlignment();
+			pipeline.begin();
+			for (long n = 0; more && (n < stops[i]); n++)
+				more = pipeline.step();
+			position = pipeline.position();
+			cursor = (pipeline.started() ? passes.cursor() : BADADDR);
+		}
+
+		if (more)
+		{
+			Passes passes(db);
+			Pipeline pipeline(passes);
+			addPassStages(pipeline, order);
+			passes.setSegment(image.base, end);
+			passes.detectAlignment();
+			pipeline.begin(position, cursor);
+			while (pipeline.step())
+				;
+		}
+
+		std::vector<ea_t> starts;
+		funcStarts(db, starts);
+		if (starts != expected)
+			printf("  stop at step %ld, position %u: %u functions, expected %u\n", stops[i], (unsigned int) position, (unsigned int) starts.size(), (unsigned int) expected.size());
+		CHECK(starts == expected);
+	}
+}
+
+// Running Pass 4 again after Pass 5 only ever adds functions
+TEST(passes, repeatStage)
+{
+	SyntheticOptions options;
+	options.size = 0x10000;
+	options.thunks = true;
+	SyntheticImage image;
+	makeSyntheticImage(options, image);
+
+	std::vector<ea_t> once, twice;
+	runFresh(image, "pass2,pass3,pass4,pass5", once);
+	runFresh(image, "pass2,pass3,pass4,pass5,pass4", twice);
+	CHECK(twice.size() >= once.size());
+	CHECK(std::includes(twice.begin(), twice.end(), once.begin(), once.end()));
+}
+
+// Pass 2 makes NOP padding an align block, but not the tail of a data item that decodes as NOPs ending on the alignment
+TEST(passes, pass2KeepsData)
+{
+	static const unsigned char bytes[] =
+	{
+		0x55, 0x48, 0x8B, 0xEC, 0x48, 0x83, 0xEC, 0x20, 0x48, 0x83, 0xC4, 0x20, 0x5D, 0xC3, 0x66, 0x90,	// Function, "xchg ax,ax" padding
+		0x11, 0x22, 0x33, 0x44, 0x55, 0x56, 0x57, 0x58, 0x48, 0x48, 0x48, 0x48, 0x0F, 0x1F, 0x40, 0x00,	// Two qwords, "nop [rax+0]" in the second
+		0x55, 0x48, 0x8B, 0xEC, 0x48, 0x83, 0xEC, 0x20, 0x48, 0x83, 0xC4, 0x20, 0x5D, 0xC3, 0xCC, 0xCC,
+	};
+	const ea_t base = 0x140001000ULL;
+	MemoryDatabase db(base, bytes, sizeof(bytes), true);
+	db.setQuiet(true);
+	for (ea_t ea = base; ea < (base + 14); ea += db.getItemSize(ea))
+		db.makeCode(ea);
+	db.defineFunc(base, (base + 14));
+	db.makeData((base + 0x10), 8, FF_QWORD);
+	db.makeData((base + 0x18), 8, FF_QWORD);
+
+	Passes passes(db);
+	Pipeline pipeline(passes);
+	addPassStages(pipeline, "pass2");
+	passes.setSegment(base, (base + sizeof(bytes)));
+	passes.detectAlignment();
+	pipeline.begin();
+	while (pipeline.step())
+		;
+
+	CHECK(is_align(db.getFlags(base + 14)));
+	CHECK(is_data(db.getFlags(base + 0x18)) && !is_align(db.getFlags(base + 0x18)));
+	CHECK(db.getItemSize(base + 0x18) == 8);
+	CHECK(is_tail(db.getFlags(base + 0x1C)));
+}
+
+// With the Pass 4 budget used up in the first segment, the second one's gaps are counted as left without planning them
+TEST(passes, budgetSkipsPlanning)
+{
+	SyntheticOptions options;
+	options.size = 0x20000;
+	SyntheticImage image;
+	makeSyntheticImage(options, image);
+	MemoryDatabase db(image.base, image.bytes.data(), image.bytes.size(), image.is64);
+	loadSyntheticImage(image, db);
+
+	Passes passes(db);
+	passes.pass4Budget = 1e-9;
+	Pipeline pipeline(passes);
+	addPassStages(pipeline, "pass3,pass4");
+	ea_t middle = (image.base + (image.bytes.size() / 2));
+	const EaRange segments[] = { { image.base, middle }, { middle, (image.base + image.bytes.size()) } };
+	for (int i = 0; i < 2; i++)
+	{
+		unsigned int gapsLeft = passes.stats.gapsLeft;
+		passes.setSegment(segments[i].start, segments[i].end);
+		passes.detectAlignment();
+		pipeline.begin();
+		while (pipeline.step())
+			;
+		CHECK(passes.stats.gapsLeft > gapsLeft);
+		CHECK((passes.gapPlanThreads() != 0) == (i == 0));
+	}
+	CHECK(passes.stats.gapBytesLeft > 0);
+
+	// A resumed run with the used time restored skips planning from the first segment it does
+	Passes resumed(db);
+	resumed.pass4Budget = passes.pass4Budget;
+	resumed.setPass4Used(passes.pass4Used());
+	Pipeline resumedPipeline(resumed);
+	addPassStages(resumedPipeline, "pass4");
+	resumed.setSegment(segments[1].start, segments[1].end);
+	resumed.detectAlignment();
+	resumedPipeline.begin();
+	while (resumedPipeline.step())
+		;
+	CHECK(resumed.stats.gapsLeft > 0);
+	CHECK(resumed.gapPlanThreads() == 0);
+}
+
+// A function that calls into another code segment, like a thunk in ".plt", is still recovered
+TEST(passes, crossSegmentCall)
+{
+	static const unsigned char bytes[] =
+	{
+		0x55, 0x8B, 0xEC, 0x5D, 0xC3, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,	// Function
+		0xE8, 0x2B, 0x00, 0x00, 0x00, 0x33, 0xC0, 0xC3, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,	// Unknown; "call thunk", "xor eax,eax", "ret"
+		0x55, 0x8B, 0xEC, 0x5D, 0xC3, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,	// Function
+		0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,
+		0xFF, 0x25, 0x00, 0x20, 0x40, 0x00, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,	// Next segment, "jmp [import]" thunk
+	};
+	const ea_t base = 0x401000;
+	const ea_t segmentEnd = (base + 0x40);
+	MemoryDatabase db(base, bytes, sizeof(bytes), false);
+	db.setQuiet(true);
+	const ea_t funcs[] = { base, (base + 0x20) };
+	for (int i = 0; i < 2; i++)
+	{
+		for (ea_t ea = funcs[i]; ea < (funcs[i] + 5); ea += db.getItemSize(ea))
+			db.makeCode(ea);
+		db.defineFunc(funcs[i], (funcs[i] + 5));
+	}
+
+	Passes passes(db);
+	Pipeline pipeline(passes);
+	addPassStages(pipeline, "pass3,pass4");
+	passes.setSegment(base, segmentEnd);
+	passes.detectAlignment();
+	pipeline.begin();
+	while (pipeline.step())
+		;
+
+	FuncInfo f;
+	CHECK(db.getFunc((base + 0x10), f) && (f.startEA == (base + 0x10)));
+	CHECK(passes.stats.insnCreatesAvoided == 0);
+}
+
+// A detached tail's index entry isn't used again, lookups of it go the slow way
+TEST(passes, tailIndexDetach)
+{
+	TailIndex index;
+	const ea_t tails[] = { 0x1000, 0x2000, 0x3000 };
+	index.refStart.push_back(0);
+	for (int i = 0; i < 3; i++)
+	{
+		index.tailEA.push_back(tails[i]);
+		index.tailEndEA.push_back(tails[i] + 0x10);
+		index.xrefQty.push_back(2);
+		index.referers.push_back(0x100);
+		index.refStart.push_back(index.referers.size());
+		index.detached.push_back(false);
+	}
+	CHECK(index.find(0x2000) == 1);
+	CHECK(index.find(0x2001) == -1);
+	index.detached[1] = true;
+	CHECK(index.find(0x2000) == -1);
+	CHECK(index.find(0x3000) == 2);
+}
+
+// Function with two cold tails, like a PGO build's: T1 is jumped to twice from the function, or once, T2 once
+class MultiTailImage
+{
+public:
+	enum { F = 0x000, T1 = 0x100, T2 = 0x120, G = 0x140, PDATA = 0x180, SIZE = 0x200 };
+
+	explicit MultiTailImage(bool secondJump) : m_bytes(SIZE, 0xCC)
+	{
+		static const unsigned char func[] =
+		{
+			0x85, 0xC9, 0x0F, 0x84, 0, 0, 0, 0,	// test ecx,ecx; jz T1
+			0x85, 0xD2, 0x0F, 0x84, 0, 0, 0, 0,	// test edx,edx; jz T1
+			0x83, 0xF8, 0x01, 0x0F, 0x84, 0, 0, 0, 0,	// cmp eax,1; jz T2
+			0xC3,
+		};
+		memcpy(&m_bytes[F], func, sizeof(func));
+		rel32(0x04, T1);
+		if (secondJump)
+			rel32(0x0C, T1);
+		rel32(0x15, T2);
+		static const unsigned char t1[] = { 0x31, 0xC0, 0xC3 };						// xor eax,eax; ret
+		static const unsigned char t2[] = { 0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3 };	// mov eax,1; ret
+		memcpy(&m_bytes[T1], t1, sizeof(t1));
+		memcpy(&m_bytes[T2], t2, sizeof(t2));
+		m_bytes[G] = 0xE9;	// jmp T1
+		rel32((G + 1), T1);
+		memset(&m_bytes[PDATA], 0, 0x10);
+	}
+
+	// Load it with F and its tails, 'jumpFromG' adds function G jumping to T1, 'pdata' a data reference to T1
+	void load(MemoryDatabase &db, bool jumpFromG, bool pdata)
+	{
+		db.setQuiet(true);
+		code(db, F, (F + 0x1A));
+		code(db, T1, (T1 + 3));
+		code(db, T2, (T2 + 6));
+		db.defineFunc((base + F), (base + F + 0x1A));
+		db.appendFuncTail((base + F), (base + T1), (base + T1 + 3));
+		db.appendFuncTail((base + F), (base + T2), (base + T2 + 6));
+		if (jumpFromG)
+		{
+			code(db, G, (G + 5));
+			db.defineFunc((base + G), (base + G + 5));
+		}
+		if (pdata)
+		{
+			db.makeData((base + PDATA), 4, FF_DWORD);
+			db.addDref((base + PDATA), (base + T1));
+		}
+	}
+
+	// Run Pass 5, returns if T1 is still F's tail
+	bool run(MemoryDatabase &db, Passes &passes)
+	{
+		Pipeline pipeline(passes);
+		addPassStages(pipeline, "pass5");
+		passes.setSegment(base, (base + SIZE));
+		passes.detectAlignment();
+		pipeline.begin();
+		while (pipeline.step())
+			;
+		FuncInfo fi;
+		return(db.getFunc((base + T1), fi) && (fi.startEA == (base + F)));
+	}
+
+	static const ea_t base = 0x140001000ULL;
+	std::vector<unsigned char> m_bytes;
+
+private:
+	void rel32(size_t at, size_t to)
+	{
+		int rel = (int) ((long long) to - (long long) (at + 4));
+		memcpy(&m_bytes[at], &rel, sizeof(rel));
+	}
+	static void code(MemoryDatabase &db, size_t start, size_t end)
+	{
+		for (ea_t ea = (base + start); ea < (base + end); ea += db.getItemSize(ea))
+			db.makeCode(ea);
+	}
+};
+
+// Two jumps from its own function don't make a cold tail a function
+TEST(passes, multiTailOwnJumps)
+{
+	MultiTailImage image(true);
+	MemoryDatabase db(MultiTailImage::base, image.m_bytes.data(), image.m_bytes.size(), true);
+	image.load(db, false, false);
+	Passes passes(db);
+	CHECK(image.run(db, passes));
+	CHECK(passes.stats.multiTailFuncs == 1);
+	CHECK(passes.stats.multiTailFixes == 0);
+}
+
+// Nor does one jump and a data reference
+TEST(passes, multiTailDataRef)
+{
+	MultiTailImage image(false);
+	MemoryDatabase db(MultiTailImage::base, image.m_bytes.data(), image.m_bytes.size(), true);
+	image.load(db, false, true);
+	Passes passes(db);
+	CHECK(image.run(db, passes));
+	CHECK(passes.stats.multiTailFuncs == 1);
+	CHECK(passes.stats.multiTailFixes == 0);
+}
+
+// A jump from another function does
+TEST(passes, multiTailShared)
+{
+	MultiTailImage image(false);
+	MemoryDatabase db(MultiTailImage::base, image.m_bytes.data(), image.m_bytes.size(), true);
+	image.load(db, true, false);
+	Passes passes(db);
+	CHECK(!image.run(db, passes));
+	CHECK(passes.stats.multiTailFixes == 1);
+	FuncInfo fi;
+	CHECK(db.getFunc((MultiTailImage::base + MultiTailImage::T1), fi) && (fi.startEA == (MultiTailImage::base + MultiTailImage::T1)));
+}
@@ -0,0 +1,139 @@
+
+// Prologue signature matcher tests
+#include "Test.h"
+#include "Reference.h"
+#include "SyntheticImage.h"
+#include <string.h>
+#include <string>
+
+// The prefilter finds the same matches as trying every offset, over images and random bytes around the vector widths
+TEST(prologue, findMatchesReference)
+{
+	const bool bitness[] = { true, false };
+	for (int b = 0; b < 2; b++)
+	{
+		PrologueMatcher matcher(bitness[b]);
+		SyntheticOptions options;
+		options.size = 0x10000;
+		options.is64 = bitness[b];
+		options.dataIslands = true;
+		options.thunks = true;
+		SyntheticImage image;
+		makeSyntheticImage(options, image);
+
+		const unsigned char *bytes = image.bytes.data();
+		size_t size = image.bytes.size(), offset = 0, hits = 0;
+		for (;;)
+		{
+			int index, expectedIndex;
+			size_t at = matcher.find(bytes, size, offset, index);
+			size_t expected = referenceFindPrologue(matcher, bytes, size, offset, expectedIndex);
+			CHECK((at == expected) && (index == expectedIndex));
+			if (at >= size)
+				break;
+			offset = (at + 1);
+			hits++;
+		}
+		CHECK(hits >= image.funcs.size());
+	}
+
+	// A signature cut off by the buffer end at every length
+	PrologueMatcher matcher(true);
+	unsigned char buffer[80];
+	for (size_t size = 0; size <= 72; size++)
+	{
+		static const unsigned char sig[] = { 0x48, 0x81, 0xEC, 0x00, 0x01, 0x00, 0x00 };	// sub rsp,100h
+		memset(buffer, 0x33, sizeof(buffer));
+		size_t at = ((size > 4) ? (size - 4) : 0);
+		memcpy(&buffer[at], sig, sizeof(sig));
+		int index, expectedIndex;
+		CHECK(matcher.find(buffer, size, 0, index) == referenceFindPrologue(matcher, buffer, size, 0, expectedIndex));
+		CHECK(index == expectedIndex);
+	}
+}
+
+TEST(prologue, names)
+{
+	PrologueMatcher matcher(true);
+	static const unsigned char pushR14[] = { 0x41, 0x56, 0x48, 0x83, 0xEC, 0x20 };
+	int index = matcher.match(pushR14, sizeof(pushR14));
+	CHECK((index >= 0) && (strcmp(matcher.name(index), "push r14; sub rsp,imm8") == 0));
+}
+
+TEST(prologue, addList)
+{
+	const char text[] =
+		"# Extra signatures\n"
+		"64 48 89 5C 24 ?? 55 ; mov [rsp+x],rbx; push rbp\n"
+		"32\t8B FF 55 ; mov edi,edi; push ebp\r\n"
+		"\n"
+		"all 0F 0B ; ud2   \n";
+	PrologueMatcher matcher64(true), matcher32(false);
+	size_t defaults64 = matcher64.size(), defaults32 = matcher32.size();
+	std::string error;
+	CHECK(matcher64.addList(text, true, error));
+	CHECK(matcher32.addList(text, false, error));
+	CHECK(matcher64.size() == (defaults64 + 2));
+	CHECK(matcher32.size() == (defaults32 + 2));
+	CHECK(strcmp(matcher64.name((int) defaults64), "mov [rsp+x],rbx; push rbp") == 0);
+	CHECK(strcmp(matcher32.name((int) defaults32), "mov edi,edi; push ebp") == 0);
+	CHECK(strcmp(matcher32.name((int) (defaults32 + 1)), "ud2") == 0);
+
+	static const unsigned char bytes[] = { 0x48, 0x89, 0x5C, 0x24, 0x08, 0x55 };
+	int index = matcher64.match(bytes, sizeof(bytes));
+	CHECK(index == (int) defaults64);
+
+	// Bad lines name the line
+	const char *bad[] = { "64 48 89 5C\n", "16 48 89 ; x\n", "64 ?? 89 ; wild lead\n", "# ok\n64 4 ; odd digit\n" };
+	const char *lines[] = { "line 1:", "line 1:", "line 1:", "line 2:" };
+	for (size_t i = 0; i < (sizeof(bad) / sizeof(bad[0])); i++)
+	{
+		PrologueMatcher matcher(true);
+		error.clear();
+		CHECK(!matcher.addList(bad[i], true, error));
+		CHECK(error.compare(0, strlen(lines[i]), lines[i]) == 0);
+	}
+}
+
+// Pass 4 only keeps signature matches on the alignment, or right after padding, a return, or a jump
+TEST(prologue, anchored)
+{
+	static const unsigned char bytes[] =
+	{
+		0x55, 0x8B, 0xEC, 0x5D, 0xC3, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,	// Function
+		0x55, 0x8B, 0xEC, 0x83, 0xEC, 0x10, 0x8B, 0xE5, 0x5D, 0xC3, 0xE9, 0x00, 0x00, 0x00, 0x00, 0x55,	// Unknown; "sub esp,10h" inside, a prologue after "jmp"
+		0x8B, 0xEC, 0x5D, 0xC3, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,
+		0x55, 0x8B, 0xEC, 0x5D, 0xC3, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,	// Function
+	};
+	const ea_t base = 0x401000;
+	MemoryDatabase db(base, bytes, sizeof(bytes), false);
+	db.setQuiet(true);
+	const ea_t funcs[] = { base, (base + 0x30) };
+	for (int i = 0; i < 2; i++)
+	{
+		for (ea_t ea = funcs[i]; ea < (funcs[i] + 5); ea += db.getItemSize(ea))
+			db.makeCode(ea);
+		db.defineFunc(funcs[i], (funcs[i] + 5));
+	}
+
+	Passes passes(db);
+	passes.setSegment(base, (base + sizeof(bytes)));
+	passes.detectAlignment();
+	passes.cacheFunctionList();
+	while (passes.gapPlan().empty() && passes.pass4Step())
+		;
+	const std::vector<ea_t> &hits = passes.prologueHits();
+	CHECK(hits.size() == 2);
+	CHECK((hits.size() == 2) && (hits[0] == (base + 0x10)) && (hits[1] == (base + 0x1F)));
+}
+
+TEST(prologue, extraPrologues)
+{
+	MemoryDatabase db(0x401000, "\xC3", 1, false);
+	Passes passes(db);
+	std::string error;
+	CHECK(passes.setExtraPrologues("64 48 89 5C 24 ?? 55 ; extra\n", error));
+	CHECK(passes.setExtraPrologues("", error));
+	CHECK(!passes.setExtraPrologues("64 zz ; bad\n", error));
+	CHECK(!error.empty());
+}
@@ -0,0 +1,82 @@
+
+// Plain byte at a time versions of the vectorized scanners
+#include "Reference.h"
+
+size_t referenceFindAlignByte(const unsigned char *buffer, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		if ((buffer[i] == 0xCC) || (buffer[i] == 0x90))
+			return i;
+	}
+	return size;
+}
+
+size_t referenceAlignRunLength(const unsigned char *buffer, size_t size, unsigned char value)
+{
+	size_t i = 0;
+	while ((i < size) && (buffer[i] == value))
+		i++;
+	return i;
+}
+
+size_t referenceFindPaddingByte(const unsigned char *buffer, size_t size, bool is64)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		unsigned char b = buffer[i];
+		if ((b == 0xCC) || (b == 0x90) || (b == 0x66) || (b == 0x0F) || (b == 0x2E))
+			return i;
+		if (!is64 && ((b == 0x8D) || (b == 0x89)))
+			return i;
+	}
+	return size;
+}
+
+// Same walk as findAlignRun(), NOP decoding is already scalar
+bool referenceFindAlignRun(const unsigned char *buffer, size_t size, size_t offset, unsigned long long baseEA, unsigned int alignment, bool is64, AlignRun &run)
+{
+	while (offset < size)
+	{
+		size_t start = (offset + referenceFindPaddingByte(buffer + offset, size - offset, is64));
+		if (start >= size)
+			break;
+
+		unsigned char value = buffer[start];
+		bool multiByte = false;
+		size_t length;
+		if (value == 0xCC)
+			length = referenceAlignRunLength(buffer + start, size - start, value);
+		else
+		{
+			length = nopRunLength(buffer + start, size - start, is64, multiByte);
+			if (length == 0)
+			{
+				offset = (start + 1);
+				continue;
+			}
+		}
+
+		if (((baseEA + start + length) & (alignment - 1)) == 0)
+		{
+			run.offset = start;
+			run.length = length;
+			run.value = value;
+			run.multiByte = multiByte;
+			return true;
+		}
+		offset = (start + length);
+	}
+	return false;
+}
+
+size_t referenceFindPrologue(const PrologueMatcher &matcher, const unsigned char *buffer, size_t size, size_t offset, int &index)
+{
+	for (size_t i = offset; i < size; i++)
+	{
+		if ((index = matcher.match(buffer + i, size - i)) >= 0)
+			return i;
+	}
+	index = -1;
+	return size;
+}
@@ -0,0 +1,13 @@
+
+// Plain byte at a time versions of the vectorized scanners, for checking and timing them against
+#pragma once
+#include "AlignScan.h"
+#include "PrologueScan.h"
+
+size_t referenceFindAlignByte(const unsigned char *buffer, size_t size);
+size_t referenceAlignRunLength(const unsigned char *buffer, size_t size, unsigned char value);
+size_t referenceFindPaddingByte(const unsigned char *buffer, size_t size, bool is64);
+bool referenceFindAlignRun(const unsigned char *buffer, size_t size, size_t offset, unsigned long long baseEA, unsigned int alignment, bool is64, AlignRun &run);
+
+// PrologueMatcher::find() without the prefilter, a full match at every offset
+size_t referenceFindPrologue(const PrologueMatcher &matcher, const unsigned char *buffer, size_t size, size_t offset, int &index);
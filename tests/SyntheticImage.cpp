@@ -0,0 +1,236 @@
+
+// Synthetic code segment images for the tests and benchmarks
+#include "SyntheticImage.h"
+#include <string.h>
+
+// xorshift32, so images don't depend on the C library's rand()
+class Random
+{
+public:
+	explicit Random(unsigned int seed) : m_state(seed ? seed : 1) {}
+	unsigned int next()
+	{
+		m_state ^= (m_state << 13);
+		m_state ^= (m_state >> 17);
+		m_state ^= (m_state << 5);
+		return m_state;
+	}
+	unsigned int below(unsigned int count) { return(next() % count); }
+
+private:
+	unsigned int m_state;
+};
+
+static void append(std::vector<unsigned char> &bytes, const unsigned char *data, size_t size)
+{
+	bytes.insert(bytes.end(), data, (data + size));
+}
+
+static void appendRel32(std::vector<unsigned char> &bytes, unsigned char op, size_t from, size_t to)
+{
+	int rel = (int) ((long long) to - (long long) (from + 5));
+	bytes.push_back(op);
+	for (int i = 0; i < 4; i++)
+		bytes.push_back((unsigned char) (rel >> (i * 8)));
+}
+
+void makeSyntheticImage(const SyntheticOptions &options, SyntheticImage &image)
+{
+	static const unsigned char prologue64[] = { 0x55, 0x48, 0x8B, 0xEC, 0x48, 0x83, 0xEC, 0x20 };	// push rbp; mov rbp,rsp; sub rsp,20h
+	static const unsigned char epilogue64[] = { 0x48, 0x83, 0xC4, 0x20, 0x5D, 0xC3 };				// add rsp,20h; pop rbp; ret
+	static const unsigned char prologue32[] = { 0x55, 0x8B, 0xEC, 0x83, 0xEC, 0x20 };				// push ebp; mov ebp,esp; sub esp,20h
+	static const unsigned char epilogue32[] = { 0x8B, 0xE5, 0x5D, 0xC3 };							// mov esp,ebp; pop ebp; ret
+	static const unsigned char nop9[] = { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 };
+	static const unsigned char nop4[] = { 0x0F, 0x1F, 0x40, 0x00 };
+	static const unsigned char nop2[] = { 0x66, 0x90 };
+
+	image.base = (options.is64 ? 0x140001000ULL : 0x401000ULL);
+	image.is64 = options.is64;
+	image.bytes.clear();
+	image.funcs.clear();
+	std::vector<unsigned char> &b = image.bytes;
+	Random random(options.seed);
+
+	while (b.size() < options.size)
+	{
+		if (options.thunks && (random.below(5) == 0) && !image.funcs.empty())
+		{
+			// Unaligned jmp thunk to an earlier function, the next function follows it right away
+			size_t at = b.size();
+			appendRel32(b, 0xE9, at, (size_t) (image.funcs[random.below((unsigned int) image.funcs.size())].start - image.base));
+			EaRange thunk = { (image.base + at), (image.base + b.size()) };
+			image.funcs.push_back(thunk);
+		}
+
+		size_t start = b.size();
+		if (options.is64)
+			append(b, prologue64, sizeof(prologue64));
+		else
+			append(b, prologue32, sizeof(prologue32));
+
+		unsigned int count = (2 + random.below(20));
+		for (unsigned int i = 0; i < count; i++)
+		{
+			switch (random.below(6))
+			{
+				// mov rax,[rbp-8] / mov eax,[ebp-8]
+				case 0:
+				{
+					static const unsigned char insn64[] = { 0x48, 0x8B, 0x45, 0xF8 }, insn32[] = { 0x8B, 0x45, 0xF8 };
+					if (options.is64)
+						append(b, insn64, sizeof(insn64));
+					else
+						append(b, insn32, sizeof(insn32));
+				}
+				break;
+
+				// mov eax,ecx
+				case 1:
+				{
+					static const unsigned char insn[] = { 0x89, 0xC8 };
+					append(b, insn, sizeof(insn));
+				}
+				break;
+
+				// add eax,1
+				case 2:
+				{
+					static const unsigned char insn[] = { 0x83, 0xC0, 0x01 };
+					append(b, insn, sizeof(insn));
+				}
+				break;
+
+				// jz over xor eax,eax
+				case 3:
+				{
+					static const unsigned char insn[] = { 0x74, 0x02, 0x31, 0xC0 };
+					append(b, insn, sizeof(insn));
+				}
+				break;
+
+				// mov eax,imm32
+				case 4:
+				{
+					unsigned char insn[] = { 0xB8, 0, 0, 0, 0 };
+					unsigned int value = random.next();
+					memcpy(&insn[1], &value, sizeof(value));
+					append(b, insn, sizeof(insn));
+				}
+				break;
+
+				// call an earlier function
+				case 5:
+				if (!image.funcs.empty())
+					appendRel32(b, 0xE8, b.size(), (size_t) (image.funcs[random.below((unsigned int) image.funcs.size())].start - image.base));
+				break;
+			};
+		}
+
+		if (options.is64)
+			append(b, epilogue64, sizeof(epilogue64));
+		else
+			append(b, epilogue32, sizeof(epilogue32));
+		EaRange func = { (image.base + start), (image.base + b.size()) };
+		image.funcs.push_back(func);
+
+		if (options.dataIslands && (random.below(7) == 0))
+		{
+			// Jump table like dwords, zero fill, or random bytes
+			unsigned int kind = random.below(3), size = (64 + random.below(448));
+			for (unsigned int i = 0; i < size; i++)
+				b.push_back((kind == 0) ? (((i & 3) == 3) ? 0 : (unsigned char) random.next()) : ((kind == 1) ? 0 : (unsigned char) random.next()));
+		}
+
+		if (options.nopPadding && random.below(2))
+		{
+			size_t left = ((options.alignment - (b.size() & (options.alignment - 1))) & (options.alignment - 1));
+			while (left >= sizeof(nop9)) { append(b, nop9, sizeof(nop9)); left -= sizeof(nop9); }
+			while (left >= sizeof(nop4)) { append(b, nop4, sizeof(nop4)); left -= sizeof(nop4); }
+			while (left >= sizeof(nop2)) { append(b, nop2, sizeof(nop2)); left -= sizeof(nop2); }
+			if (left)
+				b.push_back(0x90);
+		}
+
+		unsigned char pad = (random.below(4) ? 0xCC : 0x90);
+		while (b.size() & (options.alignment - 1))
+			b.push_back(pad);
+	}
+}
+
+void loadSyntheticImage(const SyntheticImage &image, MemoryDatabase &db)
+{
+	db.setQuiet(true);
+	for (size_t i = 0; i < image.funcs.size(); i++)
+	{
+		const EaRange &f = image.funcs[i];
+		switch (i % 6)
+		{
+			case 0: case 1: case 2: case 3:
+			{
+				for (ea_t ea = f.start; ea < f.end; ea += db.getItemSize(ea))
+				{
+					if (!db.makeCode(ea))
+						break;
+				}
+				db.defineFunc(f.start, f.end);
+			}
+			break;
+
+			case 4:
+			db.makeData(f.start, 4, FF_DWORD);
+			break;
+		};
+	}
+}
+
+size_t countRecovered(const SyntheticImage &image, MemoryDatabase &db, size_t *bogus)
+{
+	size_t found = 0;
+	for (size_t i = 0; i < image.funcs.size(); i++)
+	{
+		FuncInfo fi;
+		if (db.getFuncChunk(image.funcs[i].start, fi) && (fi.startEA == image.funcs[i].start))
+			found++;
+	}
+	if (bogus)
+		*bogus = (db.getFuncQty() - found);
+	return found;
+}
+
+void addPassStages(Pipeline &pipeline, const char *order)
+{
+	pipeline.add("pass1", "Fixing bad code bytes", &Passes::pass1Step, false);
+	pipeline.add("pass2", "Fixing align blocks", &Passes::pass2Step, false);
+	pipeline.add("pass3", "Fixing missing code", &Passes::pass3Step, false);
+	pipeline.add("pass4", "Fixing missing functions", &Passes::pass4Step, true);
+	pipeline.add("pass5", "Fixing bad tail blocks", &Passes::pass5Step, true);
+	pipeline.setOrder(order);
+}
+
+unsigned long long runAllPasses(Passes &passes, ea_t start, ea_t end)
+{
+	Pipeline pipeline(passes);
+	addPassStages(pipeline, "pass1,pass2,pass3,pass4,pass5");
+
+	passes.setSegment(start, end);
+	passes.detectAlignment();
+	pipeline.begin();
+	while (pipeline.step())
+		;
+
+	unsigned long long steps = 0;
+	for (size_t i = 0; i < pipeline.stageCount(); i++)
+		steps += pipeline.stage(i).steps;
+	return steps;
+}
+
+void funcStarts(MemoryDatabase &db, std::vector<ea_t> &starts)
+{
+	starts.clear();
+	for (size_t i = 0; i < db.getFuncQty(); i++)
+	{
+		FuncInfo fi;
+		if (db.getnFunc(i, fi))
+			starts.push_back(fi.startEA);
+	}
+}
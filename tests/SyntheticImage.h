@@ -0,0 +1,49 @@
+
+// Synthetic code segment images for the tests and benchmarks
+// Compiler like functions with padding between them, loaded into a MemoryDatabase with some of the functions
+// left for the passes to find.
+#pragma once
+#include "MemoryDatabase.h"
+#include "Passes.h"
+#include "Pipeline.h"
+#include <vector>
+
+struct SyntheticOptions
+{
+	size_t size;			// Image size, rounded up to a whole function
+	unsigned int seed;
+	bool is64;
+	unsigned int alignment;	// Function alignment
+	bool nopPadding;		// Multi-byte NOP padding between some functions
+	bool dataIslands;		// Data between some functions
+	bool thunks;			// Unaligned jmp thunks right before some functions
+
+	SyntheticOptions() : size(0x40000), seed(1), is64(true), alignment(16), nopPadding(false), dataIslands(false), thunks(false) {}
+};
+
+struct SyntheticImage
+{
+	ea_t base;
+	bool is64;
+	std::vector<unsigned char> bytes;
+	std::vector<EaRange> funcs;		// All the functions in the image, in address order
+};
+
+// Deterministic, the same options always give the same image
+void makeSyntheticImage(const SyntheticOptions &options, SyntheticImage &image);
+
+// Set up the database's items and functions like an incomplete IDA analysis:
+// of every six functions four are code and a function, one starts with a bogus dword, and one is left unknown.
+void loadSyntheticImage(const SyntheticImage &image, MemoryDatabase &db);
+
+// Count of the image's functions that are functions in the database, and of the database functions that aren't one of them
+size_t countRecovered(const SyntheticImage &image, MemoryDatabase &db, size_t *bogus = NULL);
+
+// Register the five passes as the plugin does and set an order, E.G. "pass1,pass2,pass3,pass4,pass5"
+void addPassStages(Pipeline &pipeline, const char *order);
+
+// Run the five passes over the whole image in the default order, returns the total steps
+unsigned long long runAllPasses(Passes &passes, ea_t start, ea_t end);
+
+// Database function starts, for comparing runs
+void funcStarts(MemoryDatabase &db, std::vector<ea_t> &starts);
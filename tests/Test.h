@@ -0,0 +1,23 @@
+
+// Minimal test harness for the platform neutral parts, no dependencies
+#pragma once
+#include <stdio.h>
+
+typedef void (*TestFunc)();
+
+// Registers a test at static init time, run by TestMain.cpp
+struct TestRegistrar
+{
+	TestRegistrar(const char *name, TestFunc func);
+};
+
+// Record a failed check, the test carries on
+void testFailed(const char *file, int line, const char *expression);
+
+// TEST(suite, name) defines test "suite.name". The test runner's argument selects a suite
+#define TEST(_suite, _name) \
+	static void _suite##_##_name(); \
+	static TestRegistrar _suite##_##_name##Registrar(#_suite "." #_name, _suite##_##_name); \
+	static void _suite##_##_name()
+
+#define CHECK(_expression) do { if (!(_expression)) testFailed(__FILE__, __LINE__, #_expression); } while (0)
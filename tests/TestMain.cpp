@@ -0,0 +1,71 @@
+
+// Test runner, runs every registered test or those of the suites named on the command line
+#include "Test.h"
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct TestCase
+{
+	const char *name;
+	TestFunc func;
+};
+
+static std::vector<TestCase> &testCases()
+{
+	static std::vector<TestCase> cases;
+	return cases;
+}
+
+static unsigned int s_failures = 0;
+
+TestRegistrar::TestRegistrar(const char *name, TestFunc func)
+{
+	TestCase tc = { name, func };
+	testCases().push_back(tc);
+}
+
+void testFailed(const char *file, int line, const char *expression)
+{
+	printf("  %s(%d): CHECK(%s) failed\n", file, line, expression);
+	s_failures++;
+}
+
+// Test "suite.name" is in a suite argument
+static bool selected(const char *name, int argc, char **argv)
+{
+	if (argc < 2)
+		return true;
+	for (int i = 1; i < argc; i++)
+	{
+		size_t length = strlen(argv[i]);
+		if ((strncmp(name, argv[i], length) == 0) && ((name[length] == '.') || (name[length] == 0)))
+			return true;
+	}
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int run = 0, failed = 0;
+	const std::vector<TestCase> &cases = testCases();
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		if (!selected(cases[i].name, argc, argv))
+			continue;
+
+		unsigned int failures = s_failures;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		printf("%s\n", cases[i].name);
+		cases[i].func();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("  %s, %.3fs\n", ((s_failures == failures) ? "ok" : "FAILED"), seconds);
+		run++;
+		if (s_failures != failures)
+			failed++;
+	}
+
+	printf("%u tests, %u failed\n", run, failed);
+	return((run && !failed) ? 0 : 1);
+}
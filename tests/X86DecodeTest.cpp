@@ -0,0 +1,212 @@
+
+// Instruction length decoder tests
+#include "Test.h"
+#include "X86Decode.h"
+#include <string.h>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+struct LengthCase
+{
+	bool is64;
+	int length;			// 0 for invalid
+	size_t size;
+	unsigned char bytes[15];
+};
+
+// Lengths checked against objdump
+static const LengthCase lengthCases[] =
+{
+	// Prefixes
+	{ true, 2, 2, { 0x66, 0x90 } },
+	{ true, 2, 2, { 0xF3, 0xC3 } },
+	{ true, 10, 10, { 0x66, 0x2E, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+	{ true, 3, 3, { 0xF0, 0xFF, 0x00 } },
+	{ true, 4, 4, { 0x66, 0xB8, 0x34, 0x12 } },
+	{ true, 3, 3, { 0x67, 0x8B, 0x00 } },
+	{ true, 9, 9, { 0x64, 0x48, 0x8B, 0x04, 0x25, 0x28, 0x00, 0x00, 0x00 } },
+	{ true, 4, 4, { 0xF2, 0x0F, 0x10, 0xC1 } },
+	{ true, 4, 4, { 0x66, 0x0F, 0xEF, 0xC0 } },
+	{ true, 14, 14, { 0x66, 0x66, 0x66, 0x66, 0x66, 0x2E, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+
+	// REX
+	{ true, 3, 3, { 0x48, 0x89, 0xE5 } },
+	{ true, 10, 10, { 0x48, 0xB8, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 } },
+	{ true, 10, 10, { 0x49, 0xBB, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 } },
+	{ true, 11, 11, { 0x66, 0x48, 0xB8, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 } },
+	{ true, 5, 5, { 0x66, 0x41, 0xB8, 0x34, 0x12 } },
+	{ true, 7, 7, { 0x48, 0xC7, 0xC0, 0x01, 0x00, 0x00, 0x00 } },
+	{ true, 2, 2, { 0x41, 0x50 } },
+	{ true, 7, 7, { 0x4C, 0x8D, 0x05, 0x10, 0x00, 0x00, 0x00 } },
+	{ false, 1, 1, { 0x48 } },
+
+	// VEX, and LES/LDS in 32 bit code unless the ModRM is register form
+	{ true, 3, 3, { 0xC5, 0xF8, 0x77 } },
+	{ true, 4, 4, { 0xC5, 0xFC, 0x28, 0xC1 } },
+	{ true, 9, 9, { 0xC4, 0xE2, 0x7D, 0x18, 0x05, 0x10, 0x00, 0x00, 0x00 } },
+	{ true, 6, 6, { 0xC4, 0xE3, 0x7D, 0x18, 0xC1, 0x01 } },
+	{ true, 6, 6, { 0xC5, 0xF9, 0x6F, 0x44, 0x24, 0x10 } },
+	{ false, 3, 3, { 0xC5, 0xF8, 0x77 } },
+	{ false, 2, 2, { 0xC5, 0x06 } },
+	{ false, 2, 2, { 0xC4, 0x00 } },
+	{ true, 7, 7, { 0xC4, 0xE2, 0x79, 0x13, 0x44, 0x24, 0x08 } },
+
+	// EVEX
+	{ true, 6, 6, { 0x62, 0xF1, 0x7C, 0x48, 0x28, 0xC1 } },
+	{ true, 8, 8, { 0x62, 0xF1, 0x7C, 0x48, 0x10, 0x44, 0x24, 0x01 } },
+	{ true, 6, 6, { 0x62, 0xF2, 0x7D, 0x48, 0x18, 0xC1 } },
+	{ true, 7, 7, { 0x62, 0xF3, 0x7D, 0x48, 0x18, 0xC1, 0x01 } },
+
+	// 0F38 and 0F3A maps
+	{ true, 5, 5, { 0x66, 0x0F, 0x38, 0x00, 0xC1 } },
+	{ true, 4, 4, { 0x0F, 0x38, 0xF0, 0x06 } },
+	{ true, 6, 6, { 0x66, 0x0F, 0x3A, 0x0F, 0xC1, 0x08 } },
+	{ true, 6, 6, { 0x66, 0x0F, 0x3A, 0x16, 0xC0, 0x01 } },
+	{ true, 6, 6, { 0x66, 0x0F, 0x3A, 0x63, 0xC1, 0x0C } },
+	{ true, 7, 7, { 0x66, 0x48, 0x0F, 0x3A, 0x16, 0xC0, 0x01 } },
+
+	// ModRM, SIB and displacements
+	{ true, 3, 3, { 0x8B, 0x04, 0x24 } },
+	{ true, 4, 4, { 0x8B, 0x44, 0x24, 0x08 } },
+	{ true, 7, 7, { 0x8B, 0x84, 0x24, 0x00, 0x01, 0x00, 0x00 } },
+	{ true, 6, 6, { 0x8B, 0x05, 0x10, 0x00, 0x00, 0x00 } },
+	{ true, 7, 7, { 0x8B, 0x04, 0x25, 0x10, 0x00, 0x00, 0x00 } },
+	{ true, 3, 3, { 0x8B, 0x45, 0xF8 } },
+	{ true, 6, 6, { 0x8B, 0x85, 0x00, 0xFF, 0xFF, 0xFF } },
+	{ true, 7, 7, { 0x8B, 0x04, 0xC5, 0x10, 0x00, 0x00, 0x00 } },
+	{ true, 4, 4, { 0x8B, 0x44, 0xC5, 0x08 } },
+	{ true, 2, 2, { 0x8B, 0xC1 } },
+	{ false, 6, 6, { 0x8B, 0x05, 0x10, 0x00, 0x40, 0x00 } },
+	{ false, 5, 5, { 0x67, 0x8B, 0x06, 0x34, 0x12 } },
+	{ false, 4, 4, { 0x67, 0x8B, 0x46, 0x08 } },
+
+	// Immediates and moffs
+	{ true, 3, 3, { 0x83, 0xC0, 0x01 } },
+	{ true, 6, 6, { 0x81, 0xC1, 0x00, 0x01, 0x00, 0x00 } },
+	{ true, 5, 5, { 0x66, 0x81, 0xC1, 0x00, 0x01 } },
+	{ true, 2, 2, { 0x6A, 0x01 } },
+	{ true, 5, 5, { 0x68, 0x00, 0x01, 0x00, 0x00 } },
+	{ true, 3, 3, { 0xC2, 0x08, 0x00 } },
+	{ true, 4, 4, { 0xC8, 0x10, 0x00, 0x00 } },
+	{ true, 3, 3, { 0xF6, 0xC1, 0x01 } },
+	{ true, 6, 6, { 0xF7, 0xC1, 0x00, 0x01, 0x00, 0x00 } },
+	{ true, 2, 2, { 0xF7, 0xD1 } },
+	{ true, 5, 5, { 0x66, 0xF7, 0xC1, 0x00, 0x01 } },
+	{ true, 5, 5, { 0xE8, 0x00, 0x00, 0x00, 0x00 } },
+	{ true, 2, 2, { 0xEB, 0x10 } },
+	{ true, 6, 6, { 0x0F, 0x84, 0x00, 0x01, 0x00, 0x00 } },
+	{ true, 9, 9, { 0xA1, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 } },
+	{ false, 5, 5, { 0xA1, 0x01, 0x02, 0x03, 0x04 } },
+	{ false, 7, 7, { 0x9A, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 } },
+	{ true, 6, 6, { 0x67, 0xA1, 0x01, 0x02, 0x03, 0x04 } },
+
+	// Invalid in the mode
+	{ true, 2, 2, { 0x0F, 0x05 } },
+	{ true, 0, 1, { 0x06 } },
+	{ false, 1, 1, { 0x06 } },
+	{ true, 0, 7, { 0x9A, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 } },
+};
+
+TEST(decode, lengths)
+{
+	for (size_t i = 0; i < (sizeof(lengthCases) / sizeof(lengthCases[0])); i++)
+	{
+		const LengthCase &lc = lengthCases[i];
+		InsnInfo insn;
+		int length = x86Decode(lc.bytes, lc.size, 0x1000, lc.is64, insn);
+		if (length != lc.length)
+		{
+			printf("  case %u (%d bit):", (unsigned int) i, (lc.is64 ? 64 : 32));
+			for (size_t b = 0; b < lc.size; b++)
+				printf(" %02X", lc.bytes[b]);
+			printf(", length %d, expected %d\n", length, lc.length);
+		}
+		CHECK(length == lc.length);
+
+		// One byte short is an invalid instruction, not a read past the end
+		if (lc.length > 0)
+			CHECK(x86Decode(lc.bytes, (lc.size - 1), 0x1000, lc.is64, insn) == 0);
+	}
+}
+
+// Page sized buffer followed by an inaccessible page, so a read past the end faults
+class GuardedBuffer
+{
+public:
+	GuardedBuffer()
+	{
+		#ifdef _WIN32
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		m_pageSize = si.dwPageSize;
+		m_base = (unsigned char *) VirtualAlloc(NULL, (m_pageSize * 2), (MEM_RESERVE | MEM_COMMIT), PAGE_READWRITE);
+		DWORD oldProtect;
+		VirtualProtect((m_base + m_pageSize), m_pageSize, PAGE_NOACCESS, &oldProtect);
+		#else
+		m_pageSize = (size_t) sysconf(_SC_PAGESIZE);
+		m_base = (unsigned char *) mmap(NULL, (m_pageSize * 2), (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+		mprotect((m_base + m_pageSize), m_pageSize, PROT_NONE);
+		#endif
+	}
+	~GuardedBuffer()
+	{
+		#ifdef _WIN32
+		VirtualFree(m_base, 0, MEM_RELEASE);
+		#else
+		munmap(m_base, (m_pageSize * 2));
+		#endif
+	}
+
+	// 'size' bytes that end right at the guard page
+	unsigned char *tail(size_t size) { return(m_base + (m_pageSize - size)); }
+
+private:
+	unsigned char *m_base;
+	size_t m_pageSize;
+};
+
+// Random and mutated instruction bytes never make the decoder read past 'size', and any length is within it
+TEST(decode, fuzz)
+{
+	GuardedBuffer guard;
+	unsigned int state = 12345;
+	for (int i = 0; i < 2000000; i++)
+	{
+		state ^= (state << 13);
+		state ^= (state >> 17);
+		state ^= (state << 5);
+		size_t size = (state % 17);
+
+		unsigned char *buffer = guard.tail(size);
+		unsigned int bits = state;
+		for (size_t b = 0; b < size; b++)
+		{
+			// Half the time start from a table case, so prefixes and escapes are common
+			if (((i & 1) == 0) && (b < 15))
+			{
+				const LengthCase &lc = lengthCases[(i >> 1) % (sizeof(lengthCases) / sizeof(lengthCases[0]))];
+				buffer[b] = ((b < lc.size) ? lc.bytes[b] : 0);
+				if ((bits & 7) == b)
+					buffer[b] ^= (unsigned char) (bits >> 8);
+			}
+			else
+			{
+				bits = ((bits * 1103515245) + 12345);
+				buffer[b] = (unsigned char) (bits >> 16);
+			}
+		}
+
+		InsnInfo insn;
+		for (int mode = 0; mode < 2; mode++)
+		{
+			int length = x86Decode(buffer, size, 0x1000, (mode != 0), insn);
+			CHECK((length >= 0) && ((size_t) length <= size));
+			x86Plausible(buffer, size, 0x1000, (mode != 0), 4, 0x1000, 0x2000);
+		}
+	}
+}
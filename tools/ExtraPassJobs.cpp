@@ -0,0 +1,712 @@
+
+// ExtraPass multi-database job runner
+// Runs headless IDA (or a stand-in command) workers over a queue of databases, each run in ExtraPass batch mode
+// round after round until it stops finding functions. Then writes one JSON and one CSV report of them all.
+// Linux/POSIX, see README.md for the build line.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// Default worker command. Placeholders: {db} database, {summary} JSON summary file, {script} IDC script, {log} log file
+static const char DEFAULT_COMMAND[] = "idat -A -OExtraPassBatch:{summary} -OExtraPassPasses:2345 -L{log} -S{script} {db}";
+
+// Runs the plugin in batch mode, and exits saving the database
+static const char IDC_SCRIPT[] = "static main() { auto_wait(); load_and_run_plugin(\"ExtraPass\", 1); qexit(0); }\n";
+
+struct Options
+{
+	unsigned int jobs;			// Concurrent workers
+	unsigned int retries;		// Per run
+	unsigned int maxRounds;		// Per database
+	long converged;				// Done when a round recovers this many functions or fewer
+	double timeout;				// Seconds per run, 0 for none
+	std::string outDir;
+	std::string command;
+};
+
+// Per database result, over all its rounds
+struct DbResult
+{
+	std::string path;
+	std::string status;		// "done", "failed"
+	std::string error;
+	unsigned int rounds;
+	unsigned int attempts;
+	long startFunctions, endFunctions;
+	double seconds;			// Worker wall time
+	double pluginSeconds;	// As reported by the plugin
+	std::map<std::string, double> stats;		// Summed pass counters
+	std::map<std::string, double> stageSeconds;
+	bool converged;
+};
+
+// A worker run of a database round
+struct Job
+{
+	size_t db;
+	unsigned int round;
+	unsigned int attempt;
+	pid_t pid;
+	double start;
+	std::string summary, log;
+};
+
+static double timeNow()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+// ----------------------------------------------------------------------------
+// Summary JSON, flattened to "a.b.0.c" leaf paths and their raw values
+
+class JsonReader
+{
+public:
+	JsonReader(const std::string &text) : m_text(text), m_pos(0), m_ok(true) {}
+
+	bool parse(std::map<std::string, std::string> &values)
+	{
+		value("", values);
+		skipSpace();
+		return(m_ok && (m_pos == m_text.size()));
+	}
+
+private:
+	void skipSpace()
+	{
+		while ((m_pos < m_text.size()) && isspace((unsigned char) m_text[m_pos]))
+			m_pos++;
+	}
+
+	bool take(char c)
+	{
+		skipSpace();
+		if ((m_pos < m_text.size()) && (m_text[m_pos] == c))
+		{
+			m_pos++;
+			return true;
+		}
+		return false;
+	}
+
+	std::string string()
+	{
+		std::string s;
+		if (!take('"'))
+		{
+			m_ok = false;
+			return s;
+		}
+		while ((m_pos < m_text.size()) && (m_text[m_pos] != '"'))
+		{
+			char c = m_text[m_pos++];
+			if ((c == '\\') && (m_pos < m_text.size()))
+			{
+				c = m_text[m_pos++];
+				if (c == 'n') c = '\n';
+				else
+				if (c == 't') c = '\t';
+				else
+				if (c == 'u')
+				{
+					// Only the control characters the plugin escapes
+					c = (char) strtol(m_text.substr(m_pos, 4).c_str(), NULL, 16);
+					m_pos += 4;
+				}
+			}
+			s += c;
+		}
+		if (!take('"'))
+			m_ok = false;
+		return s;
+	}
+
+	void value(const std::string &path, std::map<std::string, std::string> &values)
+	{
+		skipSpace();
+		if (!m_ok || (m_pos >= m_text.size()))
+		{
+			m_ok = false;
+			return;
+		}
+
+		char c = m_text[m_pos];
+		if (c == '{')
+		{
+			m_pos++;
+			if (take('}'))
+				return;
+			do
+			{
+				std::string key = string();
+				if (!take(':'))
+				{
+					m_ok = false;
+					return;
+				}
+				value((path.empty() ? key : (path + "." + key)), values);
+			} while (m_ok && take(','));
+			if (!take('}'))
+				m_ok = false;
+		}
+		else
+		if (c == '[')
+		{
+			m_pos++;
+			if (take(']'))
+				return;
+			int index = 0;
+			do
+			{
+				value((path + "." + std::to_string(index++)), values);
+			} while (m_ok && take(','));
+			if (!take(']'))
+				m_ok = false;
+		}
+		else
+		if (c == '"')
+			values[path] = string();
+		else
+		{
+			// Number, true, false, null
+			size_t start = m_pos;
+			while ((m_pos < m_text.size()) && !strchr(",}] \t\r\n", m_text[m_pos]))
+				m_pos++;
+			if (m_pos == start)
+				m_ok = false;
+			else
+				values[path] = m_text.substr(start, (m_pos - start));
+		}
+	}
+
+	const std::string &m_text;
+	size_t m_pos;
+	bool m_ok;
+};
+
+static bool readSummary(const std::string &file, std::map<std::string, std::string> &values)
+{
+	std::ifstream in(file.c_str(), std::ios::binary);
+	if (!in)
+		return false;
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	std::string text = buffer.str();
+	return JsonReader(text).parse(values);
+}
+
+static double number(const std::map<std::string, std::string> &values, const std::string &key, double def = 0.0)
+{
+	std::map<std::string, std::string>::const_iterator it = values.find(key);
+	return((it != values.end()) ? atof(it->second.c_str()) : def);
+}
+
+// True if one of the fixing passes 2 to 5 is in the summary's stages. Pass 1 alone only makes unknown bytes
+static bool ranFixPasses(const std::map<std::string, std::string> &values)
+{
+	for (int i = 0; ; i++)
+	{
+		std::map<std::string, std::string>::const_iterator n = values.find("stages." + std::to_string(i) + ".name");
+		if (n == values.end())
+			return false;
+		const std::string &name = n->second;
+		if ((name.size() == 5) && (name.compare(0, 4, "pass") == 0) && (name[4] >= '2') && (name[4] <= '5'))
+			return true;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Output
+
+static std::string jsonString(const std::string &text)
+{
+	std::string s = "\"";
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		char c = text[i];
+		if ((c == '"') || (c == '\\'))
+		{
+			s += '\\';
+			s += c;
+		}
+		else
+		if ((unsigned char) c < ' ')
+		{
+			char buffer[8];
+			snprintf(buffer, sizeof(buffer), "\\u%04X", (unsigned char) c);
+			s += buffer;
+		}
+		else
+			s += c;
+	}
+	return(s + "\"");
+}
+
+static std::string csvString(const std::string &text)
+{
+	if (text.find_first_of(",\"\r\n") == std::string::npos)
+		return text;
+	std::string s = "\"";
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		if (text[i] == '"')
+			s += '"';
+		s += text[i];
+	}
+	return(s + "\"");
+}
+
+static std::string numberString(double value)
+{
+	char buffer[32];
+	if ((value == (double) (long long) value) && (fabs(value) < 1e15))
+		snprintf(buffer, sizeof(buffer), "%lld", (long long) value);
+	else
+		snprintf(buffer, sizeof(buffer), "%.3f", value);
+	return buffer;
+}
+
+static bool writeJsonReport(const std::string &file, const std::vector<DbResult> &results, double wallSeconds)
+{
+	FILE *fp = fopen(file.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	unsigned int done = 0;
+	long recovered = 0;
+	double seconds = 0.0;
+	fprintf(fp, "{\n  \"databases\": [");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const DbResult &r = results[i];
+		if (r.status == "done")
+			done++;
+		recovered += (r.endFunctions - r.startFunctions);
+		seconds += r.seconds;
+
+		fprintf(fp, "%s\n    {\n", (i ? "," : ""));
+		fprintf(fp, "      \"database\": %s,\n", jsonString(r.path).c_str());
+		fprintf(fp, "      \"status\": \"%s\",\n", r.status.c_str());
+		if (!r.error.empty())
+			fprintf(fp, "      \"error\": %s,\n", jsonString(r.error).c_str());
+		fprintf(fp, "      \"converged\": %s,\n", (r.converged ? "true" : "false"));
+		fprintf(fp, "      \"rounds\": %u,\n      \"attempts\": %u,\n", r.rounds, r.attempts);
+		fprintf(fp, "      \"startFunctions\": %ld,\n      \"endFunctions\": %ld,\n      \"recovered\": %ld,\n", r.startFunctions, r.endFunctions, (r.endFunctions - r.startFunctions));
+		fprintf(fp, "      \"seconds\": %.3f,\n      \"pluginSeconds\": %.3f,\n", r.seconds, r.pluginSeconds);
+
+		fprintf(fp, "      \"stats\": {");
+		size_t n = 0;
+		for (std::map<std::string, double>::const_iterator it = r.stats.begin(); it != r.stats.end(); ++it)
+			fprintf(fp, "%s \"%s\": %s", (n++ ? "," : ""), it->first.c_str(), numberString(it->second).c_str());
+		fprintf(fp, " },\n      \"stageSeconds\": {");
+		n = 0;
+		for (std::map<std::string, double>::const_iterator it = r.stageSeconds.begin(); it != r.stageSeconds.end(); ++it)
+			fprintf(fp, "%s %s: %.3f", (n++ ? "," : ""), jsonString(it->first).c_str(), it->second);
+		fprintf(fp, " }\n    }");
+	}
+	fprintf(fp, "\n  ],\n  \"totals\": {\n");
+	fprintf(fp, "    \"databases\": %u,\n    \"done\": %u,\n    \"failed\": %u,\n", (unsigned int) results.size(), done, (unsigned int) (results.size() - done));
+	fprintf(fp, "    \"recovered\": %ld,\n    \"workerSeconds\": %.3f,\n    \"wallSeconds\": %.3f\n  }\n}\n", recovered, seconds, wallSeconds);
+	return(fclose(fp) == 0);
+}
+
+static bool writeCsvReport(const std::string &file, const std::vector<DbResult> &results)
+{
+	FILE *fp = fopen(file.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	// Counter columns, all that any database has
+	std::set<std::string> statNames;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		for (std::map<std::string, double>::const_iterator it = results[i].stats.begin(); it != results[i].stats.end(); ++it)
+			statNames.insert(it->first);
+	}
+
+	fprintf(fp, "database,status,converged,rounds,attempts,startFunctions,endFunctions,recovered,seconds,pluginSeconds");
+	for (std::set<std::string>::const_iterator it = statNames.begin(); it != statNames.end(); ++it)
+		fprintf(fp, ",%s", it->c_str());
+	fprintf(fp, "\n");
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const DbResult &r = results[i];
+		fprintf(fp, "%s,%s,%d,%u,%u,%ld,%ld,%ld,%.3f,%.3f", csvString(r.path).c_str(), r.status.c_str(), (r.converged ? 1 : 0), r.rounds, r.attempts,
+			r.startFunctions, r.endFunctions, (r.endFunctions - r.startFunctions), r.seconds, r.pluginSeconds);
+		for (std::set<std::string>::const_iterator it = statNames.begin(); it != statNames.end(); ++it)
+		{
+			std::map<std::string, double>::const_iterator stat = r.stats.find(*it);
+			fprintf(fp, ",%s", ((stat != r.stats.end()) ? numberString(stat->second).c_str() : ""));
+		}
+		fprintf(fp, "\n");
+	}
+	return(fclose(fp) == 0);
+}
+
+// ----------------------------------------------------------------------------
+// Workers
+
+// Single quote for /bin/sh
+static std::string shellQuote(const std::string &text)
+{
+	std::string s = "'";
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		if (text[i] == '\'')
+			s += "'\\''";
+		else
+			s += text[i];
+	}
+	return(s + "'");
+}
+
+static std::string expandCommand(const std::string &command, const std::map<std::string, std::string> &fields)
+{
+	std::string s;
+	for (size_t i = 0; i < command.size(); )
+	{
+		if (command[i] == '{')
+		{
+			size_t end = command.find('}', i);
+			if (end != std::string::npos)
+			{
+				std::map<std::string, std::string>::const_iterator it = fields.find(command.substr(i + 1, (end - i) - 1));
+				if (it != fields.end())
+				{
+					s += shellQuote(it->second);
+					i = (end + 1);
+					continue;
+				}
+			}
+		}
+		s += command[i++];
+	}
+	return s;
+}
+
+// Base name, with the characters that would need quoting replaced
+static std::string fileTag(const std::string &path, size_t index)
+{
+	size_t slash = path.find_last_of('/');
+	std::string name = ((slash != std::string::npos) ? path.substr(slash + 1) : path);
+	for (size_t i = 0; i < name.size(); i++)
+	{
+		if (!isalnum((unsigned char) name[i]) && (name[i] != '.') && (name[i] != '-') && (name[i] != '_'))
+			name[i] = '_';
+	}
+	return(std::to_string(index) + "_" + name);
+}
+
+static pid_t launch(const Options &opt, const std::string &db, const std::string &script, Job &job)
+{
+	std::map<std::string, std::string> fields;
+	fields["db"] = db;
+	fields["summary"] = job.summary;
+	fields["script"] = script;
+	fields["log"] = job.log;
+	std::string command = expandCommand(opt.command, fields);
+
+	// Stale summary from an earlier run would read as this one's
+	unlink(job.summary.c_str());
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		// Own process group so a timeout kills the whole worker
+		setpgid(0, 0);
+		int fd = open((job.log + ".out").c_str(), (O_WRONLY | O_CREAT | O_TRUNC), 0644);
+		if (fd >= 0)
+		{
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		int null = open("/dev/null", O_RDONLY);
+		if (null >= 0)
+		{
+			dup2(null, STDIN_FILENO);
+			close(null);
+		}
+		execl("/bin/sh", "sh", "-c", command.c_str(), (char *) NULL);
+		_exit(127);
+	}
+	return pid;
+}
+
+// ----------------------------------------------------------------------------
+
+static void usage()
+{
+	printf("ExtraPass multi-database job runner\n"
+		"Usage: extrapass-jobs [options] database...\n"
+		"  -j N     Concurrent workers, default: one per core\n"
+		"  -r N     Retries of a failed run, default: 2\n"
+		"  -m N     Max rounds per database, default: 4\n"
+		"  -c N     Converged when a round recovers N functions or fewer, default: 0\n"
+		"  -t SEC   Run timeout in seconds, default: none\n"
+		"  -o DIR   Output directory for summaries, logs, and the reports, default: extrapass-jobs\n"
+		"  -l FILE  Read more database paths from a file, one per line\n"
+		"  -x CMD   Worker command, run with /bin/sh. Default:\n"
+		"           \"%s\"\n"
+		"           {db}, {summary}, {script} and {log} are replaced with quoted paths.\n",
+		DEFAULT_COMMAND);
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	opt.jobs = ((cores > 0) ? (unsigned int) cores : 1);
+	opt.retries = 2;
+	opt.maxRounds = 4;
+	opt.converged = 0;
+	opt.timeout = 0.0;
+	opt.outDir = "extrapass-jobs";
+	opt.command = DEFAULT_COMMAND;
+
+	std::vector<std::string> databases;
+	int c;
+	while ((c = getopt(argc, argv, "j:r:m:c:t:o:l:x:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'j': opt.jobs = std::max(1, atoi(optarg)); break;
+			case 'r': opt.retries = (unsigned int) std::max(0, atoi(optarg)); break;
+			case 'm': opt.maxRounds = (unsigned int) std::max(1, atoi(optarg)); break;
+			case 'c': opt.converged = atol(optarg); break;
+			case 't': opt.timeout = atof(optarg); break;
+			case 'o': opt.outDir = optarg; break;
+			case 'x': opt.command = optarg; break;
+			case 'l':
+			{
+				std::ifstream in(optarg);
+				if (!in)
+				{
+					fprintf(stderr, "Can't read database list \"%s\".\n", optarg);
+					return 2;
+				}
+				std::string line;
+				while (std::getline(in, line))
+				{
+					while (!line.empty() && ((line.back() == '\r') || (line.back() == ' ')))
+						line.pop_back();
+					if (!line.empty() && (line[0] != '#'))
+						databases.push_back(line);
+				}
+			}
+			break;
+
+			default:
+			usage();
+			return 2;
+		}
+	}
+	for (int i = optind; i < argc; i++)
+		databases.push_back(argv[i]);
+	if (databases.empty())
+	{
+		usage();
+		return 2;
+	}
+
+	if ((mkdir(opt.outDir.c_str(), 0755) != 0) && (errno != EEXIST))
+	{
+		fprintf(stderr, "Can't create output directory \"%s\": %s\n", opt.outDir.c_str(), strerror(errno));
+		return 2;
+	}
+	std::string script = (opt.outDir + "/extrapass.idc");
+	{
+		FILE *fp = fopen(script.c_str(), "wb");
+		if (!fp || (fputs(IDC_SCRIPT, fp) < 0) || (fclose(fp) != 0))
+		{
+			fprintf(stderr, "Can't write \"%s\".\n", script.c_str());
+			return 2;
+		}
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	std::vector<DbResult> results(databases.size());
+	std::deque<Job> pending;
+	for (size_t i = 0; i < databases.size(); i++)
+	{
+		DbResult &r = results[i];
+		r.path = databases[i];
+		r.status = "failed";
+		r.rounds = r.attempts = 0;
+		r.startFunctions = r.endFunctions = 0;
+		r.seconds = r.pluginSeconds = 0.0;
+		r.converged = false;
+
+		Job job = { i, 1, 0, 0, 0.0, "", "" };
+		pending.push_back(job);
+	}
+
+	// Queue loop. A database's rounds run one after another, different databases in parallel
+	double startTime = timeNow();
+	size_t finished = 0;
+	std::map<pid_t, Job> running;
+	while (!pending.empty() || !running.empty())
+	{
+		while ((running.size() < opt.jobs) && !pending.empty())
+		{
+			Job job = pending.front();
+			pending.pop_front();
+			std::string tag = (opt.outDir + "/" + fileTag(databases[job.db], job.db) + ".r" + std::to_string(job.round) + ".a" + std::to_string(job.attempt));
+			job.summary = (tag + ".json");
+			job.log = (tag + ".log");
+			job.start = timeNow();
+			results[job.db].attempts++;
+			job.pid = launch(opt, databases[job.db], script, job);
+			if (job.pid < 0)
+			{
+				fprintf(stderr, "fork failed: %s\n", strerror(errno));
+				return 3;
+			}
+			running[job.pid] = job;
+		}
+
+		// Reap, and enforce the timeout
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+		if (pid <= 0)
+		{
+			if (opt.timeout > 0.0)
+			{
+				double now = timeNow();
+				for (std::map<pid_t, Job>::const_iterator it = running.begin(); it != running.end(); ++it)
+				{
+					if ((now - it->second.start) > opt.timeout)
+						kill(-it->first, SIGKILL);
+				}
+			}
+			usleep(50000);
+			continue;
+		}
+		std::map<pid_t, Job>::iterator it = running.find(pid);
+		if (it == running.end())
+			continue;
+		Job job = it->second;
+		running.erase(it);
+
+		DbResult &r = results[job.db];
+		double seconds = (timeNow() - job.start);
+		r.seconds += seconds;
+
+		std::map<std::string, std::string> summary;
+		std::string error;
+		bool retry = true;
+		if (WIFSIGNALED(status))
+			error = ("killed by signal " + std::to_string(WTERMSIG(status)) + (((opt.timeout > 0.0) && (seconds > opt.timeout)) ? ", timed out" : ""));
+		else
+		if (WEXITSTATUS(status) != 0)
+			error = ("exit code " + std::to_string(WEXITSTATUS(status)));
+		else
+		if (!readSummary(job.summary, summary))
+			error = "no summary";
+		else
+		if (summary["status"] != "done")
+			error = ("run " + summary["status"]);
+		else
+		if (!ranFixPasses(summary))
+		{
+			// The command or options select the wrong passes, a retry would do the same
+			error = "none of passes 2 to 5 ran";
+			retry = false;
+		}
+
+		const char *name = databases[job.db].c_str();
+		if (!error.empty())
+		{
+			// Retry, a batch run resumes from the plugin's checkpoint
+			if (retry && (job.attempt < opt.retries))
+			{
+				printf("%s round %u: %s, retrying.\n", name, job.round, error.c_str());
+				job.attempt++;
+				pending.push_back(job);
+			}
+			else
+			{
+				r.error = error;
+				printf("[%u/%u] %s round %u: %s, failed.\n", (unsigned int) ++finished, (unsigned int) databases.size(), name, job.round, error.c_str());
+			}
+			fflush(stdout);
+			continue;
+		}
+
+		// Round done
+		long start = (long) number(summary, "startFunctions"), end = (long) number(summary, "endFunctions");
+		if (job.round == 1)
+			r.startFunctions = start;
+		r.endFunctions = end;
+		r.rounds = job.round;
+		r.pluginSeconds += number(summary, "seconds");
+		for (std::map<std::string, std::string>::const_iterator v = summary.begin(); v != summary.end(); ++v)
+		{
+			if (v->first.compare(0, 6, "stats.") == 0)
+				r.stats[v->first.substr(6)] += atof(v->second.c_str());
+		}
+		for (int i = 0; ; i++)
+		{
+			std::string stage = ("stages." + std::to_string(i) + ".");
+			std::map<std::string, std::string>::const_iterator n = summary.find(stage + "name");
+			if (n == summary.end())
+				break;
+			r.stageSeconds[n->second] += number(summary, (stage + "seconds"));
+		}
+
+		long recovered = (end - start);
+		r.converged = (recovered <= opt.converged);
+		if (!r.converged && (job.round < opt.maxRounds))
+		{
+			printf("%s round %u: %+ld functions, %.1fs.\n", name, job.round, recovered, seconds);
+			Job next = { job.db, (job.round + 1), 0, 0, 0.0, "", "" };
+			pending.push_back(next);
+		}
+		else
+		{
+			r.status = "done";
+			printf("[%u/%u] %s round %u: %+ld functions, %.1fs, %ld recovered in all.\n", (unsigned int) ++finished, (unsigned int) databases.size(), name, job.round, recovered, seconds,
+				(r.endFunctions - r.startFunctions));
+		}
+		fflush(stdout);
+	}
+
+	double wallSeconds = (timeNow() - startTime);
+	std::string jsonFile = (opt.outDir + "/report.json"), csvFile = (opt.outDir + "/report.csv");
+	bool written = writeJsonReport(jsonFile, results, wallSeconds);
+	written = (writeCsvReport(csvFile, results) && written);
+	if (!written)
+	{
+		fprintf(stderr, "Report write failed in \"%s\".\n", opt.outDir.c_str());
+		return 3;
+	}
+
+	size_t failed = 0;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		if (results[i].status != "done")
+			failed++;
+	}
+	printf("%u databases, %u failed, took %.1fs. Reports: %s, %s\n", (unsigned int) results.size(), (unsigned int) failed, wallSeconds, jsonFile.c_str(), csvFile.c_str());
+	return(failed ? 1 : 0);
+}